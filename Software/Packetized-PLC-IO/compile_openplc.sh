@@ -44,7 +44,7 @@ fi
 echo "Generating glueVars..."
 ./glue_generator
 echo "Compiling main program..."
-g++ -std=gnu++11 tsn_drivers/rtc.c tsn_drivers/uio.c tsn_drivers/ptp_types.c tsn_drivers/gpio_reset.c *.cpp *.o -o openplc -I ./lib -pthread -fpermissive `pkg-config --cflags --libs libmodbus` -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w
+g++ -std=gnu++11 tsn_drivers/rtc.c tsn_drivers/uio.c tsn_drivers/ptp_types.c tsn_drivers/gpio_reset.c tsn_drivers/thread_policy.c *.cpp *.o -o openplc -I ./lib -pthread -fpermissive `pkg-config --cflags --libs libmodbus` -lasiodnp3 -lasiopal -lopendnp3 -lopenpal -w
 if [ $? -ne 0 ]; then
     echo "Error compiling C files"
     echo "Compilation finished with errors!"
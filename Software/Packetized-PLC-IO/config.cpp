@@ -7,19 +7,23 @@
 
 #include "config.h"
 #include "json.hpp"
+#include "topo_image.h"
 
 using json = nlohmann::json;
 using namespace std;
 
 int INPUT_STREAM_NUM = 0;
 std::vector<uint32_t> input_seq_ids;
+int8_t input_stream_slot[1 << 16];
+std::vector<std::vector<PayloadPoint> > input_payloads;
+std::vector<std::vector<PayloadPoint> > output_payloads;
 int OUTPUT_STREAM_NUM = 0;
 std::vector<uint32_t> output_seq_ids;
 std::vector<char*> output_dst_addresses;
 char* output_src_address;
-uint32_t CYCLE_TIME = 0;
-uint32_t COMPUTE_OFFSET = 0;
-uint32_t COMPUTE_TIME = 0;
+std::vector<JobConfig> plc_jobs;
+std::vector<int> input_stream_job;
+std::vector<int> output_stream_job;
 
 string toUpper(const string& s) {
 	string ret = s;
@@ -126,9 +130,176 @@ bool find_src_dst(const json& sche, int job_id, int flow_id, int& src_id, int& d
     return src_id != -1 && dst_id != -1;
 }
 
+/* "payload": [{"type": "bool"|"int"|"dint"|"real", "index": n}, ...] of a flow */
+vector<PayloadPoint> parse_payload(const json& flow) {
+    vector<PayloadPoint> points;
+    if (flow.find("payload") == flow.end())
+        return points;
+    for (const auto& item: flow["payload"]) {
+        const string type = item["type"].get<string>();
+        PayloadPoint point;
+        if (type == "bool") point.type = PAYLOAD_BOOL;
+        else if (type == "int") point.type = PAYLOAD_INT;
+        else if (type == "dint") point.type = PAYLOAD_DINT;
+        else if (type == "real") point.type = PAYLOAD_REAL;
+        else {
+            cerr << "[Error] Unknown payload point type \"" << type << "\" in flow#" << flow["flow_id"].get<int>() << endl;
+            exit(1);
+        }
+        point.index = item["index"].get<uint16_t>();
+        points.push_back(point);
+    }
+    return points;
+}
+
+/* "input_policy": "hold"|"default"|"skip" of a job, "hold" if not given */
+int parse_policy(const json& job) {
+    if (job.find("input_policy") == job.end())
+        return INPUT_POLICY_HOLD;
+    const string policy = job["input_policy"].get<string>();
+    if (policy == "hold") return INPUT_POLICY_HOLD;
+    if (policy == "default") return INPUT_POLICY_DEFAULT;
+    if (policy == "skip") return INPUT_POLICY_SKIP;
+    cerr << "[Error] Unknown input_policy \"" << policy << "\" in job#" << job["job_id"].get<int>() << endl;
+    exit(1);
+}
+
+/* load streams and compute window of this node from config.bin, false if there is no image */
+bool init_configure_from_image(MacAddr& myMacAddr) {
+    TopoImage image;
+    int ret = topo_image_open(&image, TOPO_IMAGE_FILE);
+    if (ret == -1) return false;
+    if (ret == -2) {
+        cout << "[WARNING] " << TOPO_IMAGE_FILE << " is invalid or of another version, using json config" << endl;
+        return false;
+    }
+
+    const TopoImageNode* node = topo_image_find_node(&image, (const uint8_t*)myMacAddr.get_addr());
+    if (node == NULL) {
+        cout << "[ERROR] Could not find node with mac address " << myMacAddr << " in " << TOPO_IMAGE_FILE << endl;
+        exit(1);
+    }
+
+    const TopoImagePoint* points = topo_image_points(&image, node);
+    auto stream_points = [&](const TopoImageStream& stream) {
+        vector<PayloadPoint> ret;
+        for (int k = 0; k < stream.point_count; k++) {
+            PayloadPoint point;
+            point.type = points[stream.first_point + k].type;
+            point.index = points[stream.first_point + k].index;
+            ret.push_back(point);
+        }
+        return ret;
+    };
+
+    const TopoImageStream* inputs = topo_image_input_streams(&image, node);
+    for (int i = 0; i < node->input_stream_count; i++) {
+        INPUT_STREAM_NUM++;
+        input_seq_ids.emplace_back(inputs[i].seq_id);
+        input_payloads.push_back(stream_points(inputs[i]));
+    }
+    const TopoImageStream* outputs = topo_image_output_streams(&image, node);
+    for (int i = 0; i < node->output_stream_count; i++) {
+        OUTPUT_STREAM_NUM++;
+        output_seq_ids.emplace_back(outputs[i].seq_id);
+        output_payloads.push_back(stream_points(outputs[i]));
+        char* dst_addr_array = (char*)malloc(6*sizeof(char));
+        memcpy(dst_addr_array, outputs[i].dst_mac, 6);
+        output_dst_addresses.push_back(dst_addr_array);
+    }
+
+    const TopoImageJob* jobs = topo_image_jobs(&image, node);
+    for (int i = 0; i < node->job_count; i++) {
+        JobConfig cfg;
+        cfg.job_id = jobs[i].job_id;
+        cfg.cycle_time = (jobs[i].period << 14);
+        cfg.compute_offset = (jobs[i].start << 14);
+        cfg.compute_time = ((jobs[i].end - jobs[i].start - 1) << 14);
+        cfg.input_policy = jobs[i].input_policy;
+        plc_jobs.push_back(cfg);
+    }
+
+    munmap((void*)image.base, image.size);
+    return true;
+}
+
+/* dense seq_id -> input stream table, looked up for every received frame */
+void build_input_stream_slots() {
+    if (INPUT_STREAM_NUM > INPUT_STREAM_MAX) {
+        cout << "[ERROR] " << INPUT_STREAM_NUM << " input streams, at most " << INPUT_STREAM_MAX << " are supported" << endl;
+        exit(1);
+    }
+    memset(input_stream_slot, -1, sizeof(input_stream_slot));
+    for (int i = 0; i < INPUT_STREAM_NUM; i++) {
+        if (input_seq_ids[i] > 0xFFFF || input_stream_slot[input_seq_ids[i]] != -1) {
+            cout << "[ERROR] Invalid or duplicated input seq_id 0x" << hex << input_seq_ids[i] << dec << endl;
+            exit(1);
+        }
+        input_stream_slot[input_seq_ids[i]] = i;
+    }
+}
+
+/* streams of every job, matched by the job_id in the upper byte of their seq_id */
+void build_job_streams() {
+    auto job_of = [](uint32_t seq_id) {
+        for (int j = 0; j < (int)plc_jobs.size(); j++) {
+            if (plc_jobs[j].job_id == (seq_id >> 8)) return j;
+        }
+        cout << "[ERROR] Stream 0x" << hex << seq_id << dec << " belongs to no job of this node" << endl;
+        exit(1);
+        return -1;
+    };
+    for (int i = 0; i < INPUT_STREAM_NUM; i++) {
+        input_stream_job.push_back(job_of(input_seq_ids[i]));
+        plc_jobs[input_stream_job[i]].inputs.push_back(i);
+    }
+    for (int i = 0; i < OUTPUT_STREAM_NUM; i++) {
+        output_stream_job.push_back(job_of(output_seq_ids[i]));
+        plc_jobs[output_stream_job[i]].outputs.push_back(i);
+    }
+}
+
+void print_configure() {
+    cout << "INPUT_STREAM_NUM = " << INPUT_STREAM_NUM << endl;
+    cout << "input_seq_ids = {";
+    for (auto& seq_id: input_seq_ids) cout << "0x" << hex << seq_id << dec << ", ";
+    cout << "}" << endl;
+    cout << "OUTPUT_STREAM_NUM = " << OUTPUT_STREAM_NUM << endl;
+    cout << "output_seq_ids = {";
+    for (auto& seq_id: output_seq_ids) cout << "0x" << hex << seq_id << dec << ", ";
+    cout << "}" << endl;
+    cout << "output_dst_addresses = {";
+    for (char* c: output_dst_addresses) {
+        cout << hex << uppercase;
+        for (int i = 0; i < 5; i++) {
+            cout << setw(2) << setfill('0') << unsigned(c[i]) << ":";
+        }
+        cout << setw(2) << setfill('0') << unsigned(c[5]);
+        cout << dec;
+    }
+    cout << "}" << endl;
+
+    for (int i = 0; i < INPUT_STREAM_NUM; i++) {
+        if (!input_payloads[i].empty())
+            cout << "input stream 0x" << hex << input_seq_ids[i] << dec << ": " << input_payloads[i].size() << " payload points" << endl;
+    }
+    for (int i = 0; i < OUTPUT_STREAM_NUM; i++) {
+        if (!output_payloads[i].empty())
+            cout << "output stream 0x" << hex << output_seq_ids[i] << dec << ": " << output_payloads[i].size() << " payload points" << endl;
+    }
+
+    const char* policies[] = {"hold", "default", "skip"};
+    for (const auto& job: plc_jobs) {
+        cout << "job " << job.job_id << ": CYCLE_TIME = " << (job.cycle_time >> 14)
+             << ", COMPUTE_OFFSET = " << (job.compute_offset >> 14)
+             << ", COMPUTE_TIME = " << (job.compute_time >> 14) + 1
+             << ", INPUT_POLICY = " << policies[job.input_policy]
+             << ", " << job.inputs.size() << "/" << job.outputs.size() << " input/output streams" << endl;
+    }
+}
+
 void init_configure() {
 	const string my_mac_addr = get_mac_address();
-	json topo = *get_topo();
 	int my_id = -1;
     std::string my_type;
 
@@ -136,6 +307,16 @@ void init_configure() {
 	output_src_address = (char*)malloc(6*sizeof(char));
     for (int i = 0; i < 6; i++) output_src_address[i] = myMacAddr.get_addr()[i];
 
+    if (init_configure_from_image(myMacAddr)) {
+        cout << "Loaded configuration from " << TOPO_IMAGE_FILE << endl;
+        build_input_stream_slots();
+        build_job_streams();
+        print_configure();
+        return;
+    }
+
+	const json& topo = *get_topo();
+
     unordered_map<int, std::string> mId2mac;
     unordered_map<int, std::string> mId2type;
     for (const auto &node: topo["nodes"]) {
@@ -156,7 +337,7 @@ void init_configure() {
         exit(1);
     }
     
-    json sche = *get_schedule();
+    const json& sche = *get_schedule();
 
 	// get input & output stream
 	for (const auto& elem: sche) {
@@ -180,8 +361,12 @@ void init_configure() {
 							continue;
 						int flow_id = flow["flow_id"].get<int>();
 						uint32_t seq_id = (job_id << 8) | flow_id;
+						// replicas of an input are one stream, duplicate frames are dropped on receive
+						if (find(input_seq_ids.begin(), input_seq_ids.end(), seq_id) != input_seq_ids.end())
+							continue;
 						INPUT_STREAM_NUM++;
 						input_seq_ids.emplace_back(seq_id);
+						input_payloads.push_back(parse_payload(flow));
 					}
 				}
 
@@ -194,6 +379,7 @@ void init_configure() {
 						uint32_t seq_id = (job_id << 8) | flow_id;
 						OUTPUT_STREAM_NUM++;
 						output_seq_ids.emplace_back(seq_id);
+						output_payloads.push_back(parse_payload(flow));
 
 						int src_id, dst_id;
 						if (!find_src_dst(sche, job_id, flow_id, src_id, dst_id)) {
@@ -203,53 +389,39 @@ void init_configure() {
 
 						MacAddr dst_addr(mId2mac[dst_id]);
                         char* dst_addr_array = (char*)malloc(6*sizeof(char));
-                        for (int k = 0; k < 6; k++) dst_addr_array[k] = dst_addr.get_addr()[k];
+                        int replica = flow.find("replica") != flow.end() ? flow["replica"].get<int>() : 0;
+                        topo_replica_mac((const uint8_t*)dst_addr.get_addr(), replica, (uint8_t*)dst_addr_array);
 						output_dst_addresses.push_back(dst_addr_array);
 					}
 				}
 			}
 		}
 	}
-    cout << "INPUT_STREAM_NUM = " << INPUT_STREAM_NUM << endl;
-    cout << "input_seq_ids = {";
-    for (auto& seq_id: input_seq_ids) cout << "0x" << hex << seq_id << dec << ", ";
-    cout << "}" << endl;
-    cout << "OUTPUT_STREAM_NUM = " << OUTPUT_STREAM_NUM << endl;
-    cout << "output_seq_ids = {";
-    for (auto& seq_id: output_seq_ids) cout << "0x" << hex << seq_id << dec << ", ";
-    cout << "}" << endl;
-    cout << "output_dst_addresses = {";
-    for (char* c: output_dst_addresses) {
-        cout << hex << uppercase;
-        for (int i = 0; i < 5; i++) {
-            cout << setw(2) << setfill('0') << unsigned(c[i]) << ":";
-        }
-        cout << setw(2) << setfill('0') << unsigned(c[5]);
-        cout << dec;
-    }
-    cout << "}" << endl;
-
-	// compute time
+	// compute windows, a transit switch has none
 	for (const auto& elem: sche) {
 		if (elem["type"] != "switch")
             continue;
 		if (toUpper(elem["mac"].get<string>()) != my_mac_addr)
 			continue;
-		assert(elem["schedule"].size() == 1);
-
-		const auto& job = elem["schedule"][0];
-		uint32_t period = job["period"].get<uint32_t>();
-		uint32_t start  = job["start"].get<uint32_t>();
-		uint32_t end    = job["end"].get<uint32_t>();
 
-		CYCLE_TIME = (period << 14);
-		COMPUTE_OFFSET = (start << 14);
-		COMPUTE_TIME = ((end - start - 1) << 14);
+		for (const auto& job: elem["schedule"]) {
+			uint32_t period = job["period"].get<uint32_t>();
+			uint32_t start  = job["start"].get<uint32_t>();
+			uint32_t end    = job["end"].get<uint32_t>();
+
+			JobConfig cfg;
+			cfg.job_id = job["job_id"].get<uint32_t>();
+			cfg.cycle_time = (period << 14);
+			cfg.compute_offset = (start << 14);
+			cfg.compute_time = ((end - start - 1) << 14);
+			cfg.input_policy = parse_policy(job);
+			plc_jobs.push_back(cfg);
+		}
 	}
 
-    cout << "CYCLE_TIME = " << (CYCLE_TIME >> 14) << endl;
-    cout << "COMPUTE_OFFSET = " << (COMPUTE_OFFSET >> 14) << endl;
-    cout << "COMPUTE_TIME = " << (COMPUTE_TIME >> 14) + 1 << endl;
+    build_input_stream_slots();
+    build_job_streams();
+    print_configure();
 }
 
 // int main() {
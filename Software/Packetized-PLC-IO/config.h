@@ -3,14 +3,50 @@
 
 #include <vector>
 
+/* input streams are tracked in a 64-bit arrival mask per cycle */
+#define INPUT_STREAM_MAX 64
+
 extern int INPUT_STREAM_NUM;
 extern std::vector<uint32_t> input_seq_ids;
+/* seq_id -> index in input_seq_ids, -1 if the seq_id is not an input of this node */
+extern int8_t input_stream_slot[1 << 16];
+/* payload point types, same values as TOPO_POINT_* in topo_image.h */
+#define PAYLOAD_BOOL 0
+#define PAYLOAD_INT  1
+#define PAYLOAD_DINT 2
+#define PAYLOAD_REAL 3
+
+/* process-image point carried in the payload of a stream, declared per flow in schedule.json */
+struct PayloadPoint {
+	uint8_t type;
+	uint16_t index;   // bit address for bools (byte * 8 + bit), word address otherwise
+};
+/* payload points of each input/output stream, empty for streams without "payload" */
+extern std::vector<std::vector<PayloadPoint> > input_payloads;
+extern std::vector<std::vector<PayloadPoint> > output_payloads;
+
 extern int OUTPUT_STREAM_NUM;
 extern std::vector<uint32_t> output_seq_ids;
 extern std::vector<char*> output_dst_addresses;
 extern char* output_src_address;
-extern uint32_t CYCLE_TIME;
-extern uint32_t COMPUTE_OFFSET;
-extern uint32_t COMPUTE_TIME;
+/* what the scan cycle does when input streams miss the compute release, same values as TOPO_POLICY_* */
+#define INPUT_POLICY_HOLD    0   // missing inputs keep their last value
+#define INPUT_POLICY_DEFAULT 1   // the payload points of missing inputs are cleared
+#define INPUT_POLICY_SKIP    2   // the cycle is not run
+
+/* compute window and streams of one job run by this node, a switch may host several */
+struct JobConfig {
+	uint32_t job_id;
+	uint32_t cycle_time;        // ns
+	uint32_t compute_offset;    // ns, release of the compute task in the cycle
+	uint32_t compute_time;      // ns
+	int input_policy;
+	std::vector<int> inputs;    // indices into input_seq_ids
+	std::vector<int> outputs;   // indices into output_seq_ids
+};
+extern std::vector<JobConfig> plc_jobs;
+/* index into plc_jobs of every input/output stream, the job is the upper byte of its seq_id */
+extern std::vector<int> input_stream_job;
+extern std::vector<int> output_stream_job;
 void init_configure();
 #endif
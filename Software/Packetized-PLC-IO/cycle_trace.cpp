@@ -0,0 +1,218 @@
+//-----------------------------------------------------------------------------
+// Per-cycle latency instrumentation of the packetized control loop. The scan
+// cycle is the only writer: it appends one record per cycle to a ring and
+// adds the cycle to the log-linear histograms of its job. The RX thread counts late frames
+// per input stream. The interactive server reads everything without locks:
+// ring slots are guarded by a per-slot sequence number, counters are atomics.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <atomic>
+
+#include "cycle_trace.h"
+
+/* log-linear buckets: 64 ns wide below 1024 ns, then 16 sub-buckets per power of two (<= 6% error) */
+#define HIST_SUB_BITS   4
+#define HIST_MIN_SHIFT  6
+#define HIST_BUCKETS    512
+
+struct TraceSlot {
+	std::atomic<uint32_t> seq;        // odd while the record is written
+	std::atomic<uint64_t> fields[sizeof(CycleTraceRecord) / sizeof(uint64_t)];
+};
+
+struct Histogram {
+	std::atomic<uint64_t> buckets[HIST_BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> max;
+};
+
+struct TraceJob {
+	uint32_t job_id;
+	uint64_t deadline;                          // outputs are due this long after compute_ts (ns)
+	std::atomic<uint64_t> cycles;
+	std::atomic<uint64_t> deadline_misses;      // cycles whose outputs left after the compute window
+	Histogram hists[2][HIST_COUNT];             // current and previous window
+};
+
+static TraceSlot ring[TRACE_RING_SIZE];
+static std::atomic<uint64_t> ring_head(0);                  // records written so far
+
+static int job_count = 0;
+static TraceJob *jobs = NULL;
+static std::atomic<int> hist_window(0);
+static uint64_t window_cycles = 0;
+
+static int stream_count = 0;
+static std::atomic<uint64_t> *stream_misses = NULL;         // late input frames per stream
+
+static const char *hist_names[HIST_COUNT] = {"e2e", "release", "arrival_spread", "compute", "tx"};
+
+static inline int bucket_of(uint64_t v)
+{
+	if (v < (1ULL << (HIST_SUB_BITS + HIST_MIN_SHIFT))) return (int)(v >> HIST_MIN_SHIFT);
+	int msb = 63 - __builtin_clzll(v);
+	int b = (msb - (HIST_SUB_BITS + HIST_MIN_SHIFT) + 1) * (1 << HIST_SUB_BITS) + (int)((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+	return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+/* lowest value of bucket b */
+static inline uint64_t bucket_floor(int b)
+{
+	if (b < (1 << HIST_SUB_BITS)) return (uint64_t)b << HIST_MIN_SHIFT;
+	int msb = b / (1 << HIST_SUB_BITS) + (HIST_SUB_BITS + HIST_MIN_SHIFT) - 1;
+	uint64_t sub = b % (1 << HIST_SUB_BITS);
+	return (((uint64_t)1 << HIST_SUB_BITS) + sub) << (msb - HIST_SUB_BITS);
+}
+
+static void hist_add(Histogram *h, int64_t value)
+{
+	uint64_t v = value > 0 ? (uint64_t)value : 0;
+	std::atomic<uint64_t> &bucket = h->buckets[bucket_of(v)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	h->count.store(h->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (v > h->max.load(std::memory_order_relaxed)) h->max.store(v, std::memory_order_relaxed);
+}
+
+static void hist_clear(Histogram *h)
+{
+	for (int b = 0; b < HIST_BUCKETS; b++) h->buckets[b].store(0, std::memory_order_relaxed);
+	h->count.store(0, std::memory_order_relaxed);
+	h->max.store(0, std::memory_order_relaxed);
+}
+
+void trace_init(int input_streams, int job_num, const uint32_t *job_ids, const uint64_t *deadlines_ns)
+{
+	stream_count = input_streams;
+	stream_misses = new std::atomic<uint64_t>[input_streams > 0 ? input_streams : 1]();
+	job_count = job_num;
+	jobs = new TraceJob[job_num > 0 ? job_num : 1]();
+	for (int j = 0; j < job_num; j++) {
+		jobs[j].job_id = job_ids[j];
+		jobs[j].deadline = deadlines_ns[j];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Called by the scan cycle once per cycle, after the output frames are sent
+//-----------------------------------------------------------------------------
+void trace_record(const CycleTraceRecord *rec)
+{
+	uint64_t head = ring_head.load(std::memory_order_relaxed);
+	TraceSlot &slot = ring[head & (TRACE_RING_SIZE - 1)];
+	uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+	slot.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	const uint64_t *fields = (const uint64_t *)rec;
+	for (size_t i = 0; i < sizeof(CycleTraceRecord) / sizeof(uint64_t); i++)
+		slot.fields[i].store(fields[i], std::memory_order_relaxed);
+	slot.seq.store(seq + 2, std::memory_order_release);
+	ring_head.store(head + 1, std::memory_order_release);
+	if (rec->job >= (uint64_t)job_count) return;
+
+	if (++window_cycles >= TRACE_WINDOW_CYCLES) {
+		int next = 1 - hist_window.load(std::memory_order_relaxed);
+		for (int j = 0; j < job_count; j++)
+			for (int h = 0; h < HIST_COUNT; h++) hist_clear(&jobs[j].hists[next][h]);
+		hist_window.store(next, std::memory_order_release);
+		window_cycles = 0;
+	}
+	TraceJob &job = jobs[rec->job];
+	Histogram *cur = job.hists[hist_window.load(std::memory_order_relaxed)];
+	hist_add(&cur[HIST_E2E], (int64_t)(rec->tx_done - rec->send_timestamp));
+	hist_add(&cur[HIST_RELEASE], (int64_t)(rec->release - rec->compute_ts));
+	hist_add(&cur[HIST_SPREAD], (int64_t)(rec->last_arrival - rec->first_arrival));
+	hist_add(&cur[HIST_COMPUTE], (int64_t)(rec->logic_end - rec->release));
+	hist_add(&cur[HIST_TX], (int64_t)(rec->tx_done - rec->logic_end));
+
+	if (rec->tx_done > rec->compute_ts + job.deadline)
+		job.deadline_misses.store(job.deadline_misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	job.cycles.store(job.cycles.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Called by the RX thread for an input frame that missed its compute release
+//-----------------------------------------------------------------------------
+void trace_stream_miss(int stream)
+{
+	if (stream >= 0 && stream < stream_count)
+		stream_misses[stream].fetch_add(1, std::memory_order_relaxed);
+}
+
+/* value below which the given fraction of the cycles of the job in both windows falls (bucket upper edge) */
+uint64_t trace_percentile(int job, int hist, double fraction)
+{
+	if (job < 0 || job >= job_count) return 0;
+	Histogram (*hists)[HIST_COUNT] = jobs[job].hists;
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total = 0, max = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		counts[b] = hists[0][hist].buckets[b].load(std::memory_order_relaxed) +
+					hists[1][hist].buckets[b].load(std::memory_order_relaxed);
+		total += counts[b];
+	}
+	max = hists[0][hist].max.load(std::memory_order_relaxed);
+	if (hists[1][hist].max.load(std::memory_order_relaxed) > max) max = hists[1][hist].max.load(std::memory_order_relaxed);
+	if (total == 0) return 0;
+
+	uint64_t rank = (uint64_t)(fraction * total);
+	if (rank >= total) rank = total - 1;
+	uint64_t seen = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += counts[b];
+		if (seen > rank) {
+			uint64_t upper = (b + 1 < HIST_BUCKETS) ? bucket_floor(b + 1) - 1 : max;
+			return upper < max ? upper : max;
+		}
+	}
+	return max;
+}
+
+int trace_format_stats(char *buf, int size)
+{
+	int n = 0;
+	for (int j = 0; j < job_count && n < size; j++) {
+		n += snprintf(buf + n, size - n, "job %" PRIu32 ": cycles %" PRIu64 ", deadline misses %" PRIu64 "\n", jobs[j].job_id,
+			jobs[j].cycles.load(std::memory_order_relaxed), jobs[j].deadline_misses.load(std::memory_order_relaxed));
+		for (int h = 0; h < HIST_COUNT && n < size; h++) {
+			n += snprintf(buf + n, size - n, "%s_ns p50 %" PRIu64 " p99 %" PRIu64 " p99.9 %" PRIu64 " max %" PRIu64 "\n",
+				hist_names[h], trace_percentile(j, h, 0.5), trace_percentile(j, h, 0.99), trace_percentile(j, h, 0.999),
+				trace_percentile(j, h, 1.0));
+		}
+	}
+	for (int i = 0; i < stream_count && n < size; i++) {
+		n += snprintf(buf + n, size - n, "stream %d late frames %" PRIu64 "\n", i, stream_misses[i].load(std::memory_order_relaxed));
+	}
+	return n < size ? n : size - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Format the last n records, oldest first, one line each
+//-----------------------------------------------------------------------------
+int trace_format_recent(char *buf, int size, int count)
+{
+	uint64_t head = ring_head.load(std::memory_order_acquire);
+	if (count > TRACE_RING_SIZE - 1) count = TRACE_RING_SIZE - 1;
+	if ((uint64_t)count > head) count = (int)head;
+
+	int n = snprintf(buf, size, "cycle job compute_ts send_timestamp first_arrival last_arrival release logic_end tx_done\n");
+	for (uint64_t i = head - count; i < head && n < size; i++) {
+		TraceSlot &slot = ring[i & (TRACE_RING_SIZE - 1)];
+		CycleTraceRecord rec;
+		uint64_t *fields = (uint64_t *)&rec;
+		uint32_t seq0, seq1;
+		do {
+			seq0 = slot.seq.load(std::memory_order_acquire);
+			for (size_t f = 0; f < sizeof(CycleTraceRecord) / sizeof(uint64_t); f++)
+				fields[f] = slot.fields[f].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			seq1 = slot.seq.load(std::memory_order_relaxed);
+		} while ((seq0 & 1) || seq0 != seq1);
+		uint32_t job_id = rec.job < (uint64_t)job_count ? jobs[rec.job].job_id : 0;
+		n += snprintf(buf + n, size - n, "%" PRIu64 " %" PRIu32 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			rec.cycle, job_id, rec.compute_ts, rec.send_timestamp, rec.first_arrival, rec.last_arrival, rec.release, rec.logic_end, rec.tx_done);
+	}
+	return n < size ? n : size - 1;
+}
@@ -0,0 +1,40 @@
+#ifndef CYCLE_TRACE_H
+#define CYCLE_TRACE_H
+
+#include <stdint.h>
+
+/* per-cycle records kept for trace readers, must be a power of two */
+#define TRACE_RING_SIZE      1024
+/* the histograms cover the last one to two windows of this many cycles */
+#define TRACE_WINDOW_CYCLES  100000
+
+/* Timestamps of one control cycle, all in synchronized time (ns) */
+struct CycleTraceRecord {
+	uint64_t cycle;
+	uint64_t job;              // index of the job run in the cycle, as passed to trace_init
+	uint64_t compute_ts;       // planned compute release
+	uint64_t send_timestamp;   // oldest device tx_timestamp among the cycle's input frames
+	uint64_t first_arrival;    // first input frame of the cycle received
+	uint64_t last_arrival;     // last input frame of the cycle received
+	uint64_t release;          // compute task released
+	uint64_t logic_end;        // control logic done, sending starts
+	uint64_t tx_done;          // all output frames completed
+};
+
+/* rolling latency histograms of every job, in ns */
+enum TraceHistogram {
+	HIST_E2E,       // tx_done - send_timestamp: device send to output frames on the wire
+	HIST_RELEASE,   // release - compute_ts
+	HIST_SPREAD,    // last_arrival - first_arrival
+	HIST_COMPUTE,   // logic_end - release
+	HIST_TX,        // tx_done - logic_end
+	HIST_COUNT
+};
+
+void trace_init(int input_streams, int jobs, const uint32_t *job_ids, const uint64_t *deadlines_ns);
+void trace_record(const CycleTraceRecord *rec);
+void trace_stream_miss(int stream);
+uint64_t trace_percentile(int job, int hist, double fraction);
+int trace_format_stats(char *buf, int size);
+int trace_format_recent(char *buf, int size, int n);
+#endif
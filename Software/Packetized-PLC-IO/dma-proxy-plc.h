@@ -26,8 +26,8 @@
 #define BUFFER_SIZE (128 * 1024)	 	/* must match driver exactly */
 #define BUFFER_COUNT 32					/* driver only */
 
-#define TX_BUFFER_COUNT 	1				/* app only, must be <= to the number in the driver */
-#define RX_BUFFER_COUNT 	1				/* app only, must be <= to the number in the driver */
+#define TX_BUFFER_COUNT 	16				/* app only, must be <= to the number in the driver */
+#define RX_BUFFER_COUNT 	4				/* app only, must be <= to the number in the driver */
 #define BUFFER_INCREMENT	1				/* normally 1, but skipping buffers (2) defeats prefetching in the CPU */
 
 #define FINISH_XFER 	_IOW('a','a',int32_t*)
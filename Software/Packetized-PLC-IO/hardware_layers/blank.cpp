@@ -48,25 +48,76 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <atomic>
 
 #include "dma-proxy-plc.h"
 #include "tsn_drivers/gpio_reset.h"
 #include "tsn_drivers/rtc.h"
 #include "tsn_drivers/ptp_types.h"
 #include "config.h"
+#include "release_timer.h"
+#include "workload.h"
+#include "payload.h"
+#include "cycle_trace.h"
+#include "seq_recovery.h"
 
 /* ----------------------- CONFIG begin ----------------------------- */
 
 /* output more info */
 #define DEBUG_ENABLE 0
 
+/* the compute task sleeps until this long before its release time and spins on the RTC for the rest (ns) */
+#define RELEASE_SPIN_MARGIN_NS 50000
+
+/* collect release jitter and workload statistics over this many cycles for release_stats(), 0 disables it */
+#define RELEASE_REPORT_CYCLES 10000
+
+/* synthetic control logic run in every cycle: WORKLOAD_NONE, WORKLOAD_CPU, WORKLOAD_MEMORY or WORKLOAD_FB_MIX.
+ * It is calibrated at startup to COMPUTE_TIME - WORKLOAD_SLACK_NS (ns), the slack is left for sending
+ */
+#define WORKLOAD_KIND WORKLOAD_CPU
+#define WORKLOAD_SLACK_NS 200000
+
+/* Order in which the cycles of several jobs on this node are run:
+ * JOB_SCHED_TABLE runs them by release time, following the disjoint compute windows of schedule.json,
+ * JOB_SCHED_EDF runs the released cycle with the earliest deadline (end of its compute window) first,
+ * and the earliest release when none is released yet, so that late cycles do not push back the others
+ */
+#define JOB_SCHED_TABLE 0
+#define JOB_SCHED_EDF   1
+#define JOB_SCHEDULING JOB_SCHED_TABLE
+
+/* The job_id of the cycle being run is exposed to the IEC program in special function [JOB_SPECIAL] (%ML1024 + n) */
+#define JOB_SPECIAL 4
+
+/* Input streams that have not arrived by the compute release are handled by the job's "input_policy"
+ * (see config.h). Their staleness is exposed to the IEC program in special functions (%ML1024 + n):
+ * [STALENESS_SPECIAL_BASE] counts the cycles run or skipped with missing inputs,
+ * [STALENESS_SPECIAL_BASE + 1 + i] the consecutive cycles input stream i has been missing
+ */
+#define STALENESS_SPECIAL_BASE 5
+
+/* Scan overruns are exposed in special functions (%ML1024 + n):
+ * [OVERRUN_SPECIAL] counts the cycles the scan cycle only got to after their compute release,
+ * [OVERRUN_SPECIAL + 1] the compute releases that passed without their cycle being run
+ */
+#define OVERRUN_SPECIAL (STALENESS_SPECIAL_BASE + 1 + INPUT_STREAM_MAX)
+
+/* Replicated input streams (see seq_recovery.h): the duplicate filter of a stream takes any pkt_id
+ * again after this many cycles without a frame
+ */
+#define RECOVERY_RESET_CYCLES 4
+
+/* drop this many of every 1000 received frames before duplicate elimination, to test replication on target */
+#define INJECT_DROP_PERMILLE 0
+
 /* Packet header structure (42 bytes):
  * destination ethernet address                          - 6 bytes
  * source ethernet address                               - 6 bytes
  * TPID                                                  - 2 bytes
  * vlan header: PCP(3 bits), CFI (1 bits), VID (12 bits) - 2 bytes
  * ether_length                                          - 2 bytes
- * unused                                                - 2 bytes
+ * payload_length, bytes after the header                - 2 bytes
  * tx_timestamp                                          - 8 bytes
  * rx_timestamp                                          - 8 bytes
  * seq_id                                                - 2 bytes  
@@ -74,6 +125,10 @@
  */
 #define PACKET_HEADER_SIZE  42 
 
+/* Streams with "payload" points in schedule.json carry process-image data after the header instead
+ * (see payload.h), frames are padded to at least PACKET_HEADER_SIZE + PACKET_PAYLOAD_SIZE bytes.
+ */
+
 /* 在正经的 critical content 之后，buf[42:59] 所有 byte 的值应该从 0x12 依次递减到 0x01
 */
 #define PACKET_PAYLOAD_SIZE 18 /* 0x12, 0x11,..., 0x01 */
@@ -96,8 +151,6 @@
 const char *tx_channel_names_[] = {"dma_proxy_tx_plc", /* add unique channel names here */};
 const char *rx_channel_names_[] = {"dma_proxy_rx_plc", /* add unique channel names here */};
 
-#define MAX_INPUT 1
-#define MAX_OUTPUT 1
 #define MAX_ANALOG_OUT 1
 
 struct channel
@@ -113,15 +166,42 @@ uint32_t out_pkt_id;
 uint64_t *input_timestamp;
 uint32_t *input_pkt_id;
 
-std::map<int, int> seqid_index;
 
 UScaledNs next_compute_ts;
 
+/* copy plans of the payload points of every input/output stream */
+std::vector<CopyPlan> input_plans;
+std::vector<CopyPlan> output_plans;
+int rx_payload_bytes = 0;       // largest input payload, copied out of each received frame
+uint8_t *input_payload;         // payload of each input stream in the consumed cycle, PACKET_PAYLOAD_MAX bytes apart
+
 int dropped = 0;
+int short_frames = 0;           // frames with less payload than the copy plan of their stream
 
 uint64_t send_timestamp; 
 uint32_t send_pkt_id;
 
+SeqRecovery *rx_recovery = NULL;
+
+/* statistics of the last RELEASE_REPORT_CYCLES cycles, formatted off the scan thread by formatCycleReport() */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static ReleaseStats report_release;
+static WorkloadStats report_workload;
+unsigned int inject_drop_seed = 1;
+
+/* input staleness, see STALENESS_SPECIAL_BASE */
+uint64_t partial_cycles = 0;
+uint64_t *staleness;
+static const uint8_t default_payload[PACKET_PAYLOAD_MAX] = {0};
+
+/* scan overruns, see OVERRUN_SPECIAL */
+uint64_t overrun_cycles = 0;
+uint64_t missed_releases = 0;
+
+/* trace record of the cycle being run, filled in by updateBuffersIn/updateBuffersOut */
+CycleTraceRecord cycle_rec;
+uint64_t cycle_count = 0;
+
 void print_formatted_bytes(uint8_t *RxBufferPtr, int output_size) {
 	 for(int i = 0; i < output_size; i++) {
 	 	if (i%8 == 0 && i!=0) {
@@ -178,38 +258,31 @@ void dma_init()
 
 }
 
-void sendFrame(uint32_t seq_id, uint64_t send_timestamp, uint32_t send_pkt_id, char *src_mac_addr, char *dst_mac_addr)
+/* Output frames are prebuilt at startup, one per output stream in its own TX
+ * buffer (output stream i uses buffer i). Every cycle only tx_timestamp and
+ * pkt_id are patched in place before the buffers are submitted.
+ */
+void buildFrameTemplates(char *src_mac_addr)
 {
-	int i, counter = 0, buffer_id, in_progress_count = 0;
-	int stop_in_progress = 0;
-
-	// Start all buffers being sent
-    uint8_t *vp;
-
-	for (buffer_id = 0; buffer_id < TX_BUFFER_COUNT; buffer_id += BUFFER_INCREMENT)
+	if (OUTPUT_STREAM_NUM > TX_BUFFER_COUNT)
 	{
+		printf("%d output streams, at most TX_BUFFER_COUNT (%d) are supported\n", OUTPUT_STREAM_NUM, TX_BUFFER_COUNT);
+		exit(EXIT_FAILURE);
+	}
 
-		/* Set up the length for the DMA transfer and initialize the transmit
-		 * buffer to a known pattern.
-		 */
-        int origin_frame_length = PACKET_HEADER_SIZE + PACKET_PAYLOAD_SIZE; 
-		tx_channels[0].buf_ptr[buffer_id].length = origin_frame_length;
+	for (int buffer_id = 0; buffer_id < OUTPUT_STREAM_NUM; buffer_id++)
+	{
+		int payload_size = output_plans[buffer_id].size;
+		int origin_frame_length = PACKET_HEADER_SIZE + std::max(PACKET_PAYLOAD_SIZE, payload_size);
+		uint8_t *BufferPtr = (uint8_t *)tx_channels[0].buf_ptr[buffer_id].buffer;
+		char *dst_mac_addr = output_dst_addresses[buffer_id];
+		uint16_t seq_id = (uint16_t)output_seq_ids[buffer_id];
 
-		uint8_t BufferPtr[origin_frame_length];
+		memset(BufferPtr, 0, origin_frame_length);
 		/* destination ethernet address */
-		BufferPtr[0] = dst_mac_addr[0];
-		BufferPtr[1] = dst_mac_addr[1];
-		BufferPtr[2] = dst_mac_addr[2];
-		BufferPtr[3] = dst_mac_addr[3];
-		BufferPtr[4] = dst_mac_addr[4];
-		BufferPtr[5] = dst_mac_addr[5];
+		memcpy(&BufferPtr[0], dst_mac_addr, 6);
 		/* source ethernet address */
-		BufferPtr[6]  = src_mac_addr[0];
-		BufferPtr[7]  = src_mac_addr[1];
-		BufferPtr[8]  = src_mac_addr[2];
-		BufferPtr[9]  = src_mac_addr[3];
-		BufferPtr[10] = src_mac_addr[4];
-		BufferPtr[11] = src_mac_addr[5];
+		memcpy(&BufferPtr[6], src_mac_addr, 6);
 		/* 0x8100 */
 		BufferPtr[12] = 0x81;
 		BufferPtr[13] = 0x00;
@@ -219,62 +292,419 @@ void sendFrame(uint32_t seq_id, uint64_t send_timestamp, uint32_t send_pkt_id, c
 		/* ether length */
 		BufferPtr[16] = 0x00;
 		BufferPtr[17] = 0x2A;
-		/* unused */
-		BufferPtr[18] = 0x00;
-		BufferPtr[19] = 0x00;
-		/* timestamp when packet is sent before PHY */
-		vp = (uint8_t *)&send_timestamp;
-		BufferPtr[20] = vp[7];
-		BufferPtr[21] = vp[6];
-		BufferPtr[22] = vp[5];
-		BufferPtr[23] = vp[4];
-		BufferPtr[24] = vp[3];
-		BufferPtr[25] = vp[2];
-		BufferPtr[26] = vp[1];
-		BufferPtr[27] = vp[0];
-		/* timestamp when packet is received after PHY */
-		BufferPtr[28] = 0;
-		BufferPtr[29] = 0;
-		BufferPtr[30] = 0;
-		BufferPtr[31] = 0;
-		BufferPtr[32] = 0;
-		BufferPtr[33] = 0;
-		BufferPtr[34] = 0;
-		BufferPtr[35] = 0;
+		/* payload length [18:19], checked by the receiver against its copy plan */
+		BufferPtr[18] = (uint8_t)((origin_frame_length - PACKET_HEADER_SIZE) >> 8);
+		BufferPtr[19] = (uint8_t)((origin_frame_length - PACKET_HEADER_SIZE) >> 0);
+		/* tx_timestamp [20:27] patched per cycle, rx_timestamp [28:35] stays 0 */
 		/* sequence id for this data stream traffic */
-		vp = (uint8_t *)&seq_id;
-		BufferPtr[36] = vp[1];
-		BufferPtr[37] = vp[0];
-		/* packet id for this packet in the seq_id data stream */
-   		vp = (uint8_t *)&send_pkt_id;
-		BufferPtr[38] = vp[3];
-		BufferPtr[39] = vp[2];
-		BufferPtr[40] = vp[1];
-		BufferPtr[41] = vp[0];
-		/* rest: 0x12, 0x11,..., 0x01 */
-		for (i = PACKET_HEADER_SIZE; i < origin_frame_length; i++)
-			BufferPtr[i] = origin_frame_length - i;
-        // print_formatted_bytes(BufferPtr, 60);
-        
-		if (DEBUG_ENABLE) {
-			printf("-->TX: seq_id: 0x%04x, pkt_id: %" PRIu32 ", timestamp: %" PRIu64 "\n", (unsigned long)seq_id, send_pkt_id, send_timestamp);
+		BufferPtr[36] = (uint8_t)(seq_id >> 8);
+		BufferPtr[37] = (uint8_t)(seq_id >> 0);
+		/* pkt_id [38:41] patched per cycle */
+		/* rest: 0x12, 0x11,..., 0x01, or the process-image payload encoded every cycle */
+		if (payload_size == 0) {
+			for (int i = PACKET_HEADER_SIZE; i < origin_frame_length; i++)
+				BufferPtr[i] = origin_frame_length - i;
 		}
 
-		memcpy(tx_channels[0].buf_ptr[buffer_id].buffer, BufferPtr, origin_frame_length);
+		tx_channels[0].buf_ptr[buffer_id].length = origin_frame_length;
+	}
+}
+
+static inline void patchFrame(uint8_t *BufferPtr, uint64_t send_timestamp, uint32_t send_pkt_id)
+{
+	/* timestamp when packet is sent before PHY */
+	for (int i = 0; i < 8; i++)
+		BufferPtr[20 + i] = (uint8_t)(send_timestamp >> (56 - 8 * i));
+	/* packet id for this packet in the seq_id data stream */
+	BufferPtr[38] = (uint8_t)(send_pkt_id >> 24);
+	BufferPtr[39] = (uint8_t)(send_pkt_id >> 16);
+	BufferPtr[40] = (uint8_t)(send_pkt_id >>  8);
+	BufferPtr[41] = (uint8_t)(send_pkt_id >>  0);
+}
+
+/* Patch and submit the frames of the output streams of a job back to back, then reap the completions */
+void sendOutputFrames(const JobConfig &job, uint64_t send_timestamp, uint32_t send_pkt_id)
+{
+	for (int buffer_id: job.outputs)
+	{
+		patchFrame((uint8_t *)tx_channels[0].buf_ptr[buffer_id].buffer, send_timestamp, send_pkt_id);
+		if (DEBUG_ENABLE) {
+			printf("-->TX: seq_id: 0x%04x, pkt_id: %" PRIu32 ", timestamp: %" PRIu64 "\n", (unsigned long)output_seq_ids[buffer_id], send_pkt_id, send_timestamp);
+		}
+		ioctl(tx_channels[0].fd, START_XFER, &buffer_id);
+	}
 
-		ioctl(tx_channels[0].fd, XFER, &buffer_id);
+	for (int buffer_id: job.outputs)
+	{
+		ioctl(tx_channels[0].fd, FINISH_XFER, &buffer_id);
 		if (tx_channels[0].buf_ptr[buffer_id].status != PROXY_NO_ERROR)
 		{
 			printf("tx_thread fail.\r\n");
 		}
 		else
 		{
-			// printf("tx_thread success. out_pkt_id = %d\r\n", out_pkt_id);
 			out_pkt_id += 1;
 		}
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Input streams are received by a dedicated RX thread. It keeps
+// RX_BUFFER_COUNT DMA transfers in flight, decodes every frame and publishes
+// it in the cycle slot of the job the stream belongs to. The scan cycle picks
+// the job to run next (JOB_SCHEDULING) and only consumes the latest cycle
+// published for it, so bufferLock is no longer held while waiting for packets.
+//-----------------------------------------------------------------------------
+
+/* Latest frame of one input stream, owned by the RX thread */
+struct RxStream
+{
+	uint64_t tx_timestamp;
+	uint32_t pkt_id;
+	uint8_t payload[PACKET_PAYLOAD_MAX];
+};
+
+/* Input image of one compute cycle. Single writer (RX thread), single reader
+ * (scan cycle): seq is odd while the slot is written, the reader retries when
+ * it changed during its copy.
+ */
+struct CycleSlot
+{
+	std::atomic<uint32_t> seq;
+	std::atomic<uint64_t> compute_ts;
+	std::atomic<uint64_t> mask;         // streams that arrived for compute_ts so far
+	std::atomic<uint64_t> send_timestamp;
+	std::atomic<uint32_t> send_pkt_id;
+	std::atomic<uint64_t> first_arrival;
+	std::atomic<uint64_t> last_arrival;
+	std::atomic<uint64_t> *tx_timestamp;
+	std::atomic<uint32_t> *pkt_id;
+	std::atomic<uint32_t> *payload;     // PACKET_PAYLOAD_MAX / 4 words per stream
+};
+
+/* Cycles of one job. rx_cycle_* is the cycle being collected by the RX thread: the streams that
+ * arrived for it, the running min tx_timestamp / max pkt_id over them and when its first frame arrived.
+ * Masks have bit i set for input stream i, complete_mask for all input streams of the job.
+ */
+struct JobState
+{
+	uint64_t rx_cycle_compute_ts;
+	uint64_t rx_cycle_mask;
+	uint64_t rx_cycle_min_timestamp;
+	uint32_t rx_cycle_max_pkt_id;
+	uint64_t rx_cycle_first_arrival;
+	uint64_t complete_mask;
+	uint64_t consumed_compute_ts;   // last cycle run or skipped by the scan cycle
+	uint32_t sent_pkt_id;           // pkt_id of the last output frames sent, 0 before the first
+	CycleSlot slot;
+};
+
+RxStream *rx_streams;
+JobState *job_states;
+ReleaseEvent cycle_event;           // signalled for every cycle published, the scan cycle sleeps on it
+int current_job = 0;                // index into plc_jobs of the cycle being run
+
+static inline void decodeFrame(const uint8_t *RxBufferPtr, uint16_t *seq_id, uint32_t *pkt_id, uint64_t *tx_timestamp, int *payload_length)
+{
+	*payload_length = ((int)(RxBufferPtr[18]) << 8) |
+					  ((int)(RxBufferPtr[19]) << 0);
+	*seq_id = ((uint16_t)(RxBufferPtr[36]) << 8) |
+			  ((uint16_t)(RxBufferPtr[37]) << 0);
+	*pkt_id = ((uint32_t)(RxBufferPtr[38]) << 24) |
+			  ((uint32_t)(RxBufferPtr[39]) << 16) |
+			  ((uint32_t)(RxBufferPtr[40]) <<  8) |
+			  ((uint32_t)(RxBufferPtr[41]) <<  0);
+	*tx_timestamp = ((uint64_t)(RxBufferPtr[20]) << 56) |
+					((uint64_t)(RxBufferPtr[21]) << 48) |
+					((uint64_t)(RxBufferPtr[22]) << 40) |
+					((uint64_t)(RxBufferPtr[23]) << 32) |
+					((uint64_t)(RxBufferPtr[24]) << 24) |
+					((uint64_t)(RxBufferPtr[25]) << 16) |
+					((uint64_t)(RxBufferPtr[26]) <<  8) |
+					((uint64_t)(RxBufferPtr[27]) <<  0);
+}
+
+static void publishCycle(int j, uint64_t compute_ts, uint64_t mask, uint64_t send_ts, uint32_t send_id, uint64_t first_arrival, uint64_t last_arrival)
+{
+	CycleSlot &cycle_slot = job_states[j].slot;
+	uint32_t seq = cycle_slot.seq.load(std::memory_order_relaxed);
+	cycle_slot.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (int i: plc_jobs[j].inputs) {
+		cycle_slot.tx_timestamp[i].store(rx_streams[i].tx_timestamp, std::memory_order_relaxed);
+		cycle_slot.pkt_id[i].store(rx_streams[i].pkt_id, std::memory_order_relaxed);
+		for (int w = 0; w < (input_plans[i].size + 3) / 4; w++) {
+			uint32_t word;
+			memcpy(&word, &rx_streams[i].payload[4 * w], 4);
+			cycle_slot.payload[i * (PACKET_PAYLOAD_MAX / 4) + w].store(word, std::memory_order_relaxed);
+		}
+	}
+	cycle_slot.send_timestamp.store(send_ts, std::memory_order_relaxed);
+	cycle_slot.send_pkt_id.store(send_id, std::memory_order_relaxed);
+	cycle_slot.first_arrival.store(first_arrival, std::memory_order_relaxed);
+	cycle_slot.last_arrival.store(last_arrival, std::memory_order_relaxed);
+	cycle_slot.mask.store(mask, std::memory_order_relaxed);
+	cycle_slot.compute_ts.store(compute_ts, std::memory_order_relaxed);
+
+	cycle_slot.seq.store(seq + 2, std::memory_order_release);
+	release_signal(&cycle_event);
+}
+
+/* Copy the cycle published for job j into input_timestamp/input_pkt_id/input_payload/send_timestamp/send_pkt_id,
+ * the arrival times into cycle_rec and the streams that arrived into mask
+ */
+static uint64_t readCycleSlot(int j, uint64_t *mask)
+{
+	CycleSlot &cycle_slot = job_states[j].slot;
+	uint32_t seq0, seq1;
+	uint64_t compute_ts;
+	do {
+		seq0 = cycle_slot.seq.load(std::memory_order_acquire);
+		for (int i: plc_jobs[j].inputs) {
+			input_timestamp[i] = cycle_slot.tx_timestamp[i].load(std::memory_order_relaxed);
+			input_pkt_id[i] = cycle_slot.pkt_id[i].load(std::memory_order_relaxed);
+			for (int w = 0; w < (input_plans[i].size + 3) / 4; w++) {
+				uint32_t word = cycle_slot.payload[i * (PACKET_PAYLOAD_MAX / 4) + w].load(std::memory_order_relaxed);
+				memcpy(&input_payload[i * PACKET_PAYLOAD_MAX + 4 * w], &word, 4);
+			}
+		}
+		send_timestamp = cycle_slot.send_timestamp.load(std::memory_order_relaxed);
+		send_pkt_id = cycle_slot.send_pkt_id.load(std::memory_order_relaxed);
+		cycle_rec.first_arrival = cycle_slot.first_arrival.load(std::memory_order_relaxed);
+		cycle_rec.last_arrival = cycle_slot.last_arrival.load(std::memory_order_relaxed);
+		*mask = cycle_slot.mask.load(std::memory_order_relaxed);
+		compute_ts = cycle_slot.compute_ts.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		seq1 = cycle_slot.seq.load(std::memory_order_relaxed);
+	} while ((seq0 & 1) || seq0 != seq1);
+	return compute_ts;
+}
+
+static void handleInputFrame(uint16_t seq_id, uint32_t pkt_id, uint64_t tx_timestamp, const uint8_t *payload, int payload_length)
+{
+	UScaledNs tmp, current_ts;
+	get_current_local_sync_ts(&tmp, &current_ts);
+
+	int slot = input_stream_slot[seq_id];
+	if (slot < 0)
+		return;
+	int j = input_stream_job[slot];
+	JobState &js = job_states[j];
+	uint64_t cycle_time = plc_jobs[j].cycle_time;
+	uint64_t compute_offset = plc_jobs[j].compute_offset;
+	if (DEBUG_ENABLE) {
+		printf("[%" PRIu64 " ns]{%" PRIu64 "} receive packet. packet's tx_timestamp is %" PRIu64 "{%" PRIu64 "}. d2s latency: %" PRIu64 ". \n", current_ts.nsec, current_ts.nsec / cycle_time, tx_timestamp, tx_timestamp / cycle_time, current_ts.nsec - tx_timestamp);
+		printf("<--RX: seq_id: 0x%04x, pkt_id: %" PRIu32 ", timestamp: %" PRIu64 "\n", (unsigned long)seq_id, pkt_id, tx_timestamp);
+	}
+	/* a frame built for another payload layout would be decoded from bytes it does not carry */
+	if (payload_length < input_plans[slot].size) {
+		short_frames += 1;
+		printf("**** Drop off short packet of stream 0x%04x: %d payload bytes, %d expected.[%d]\n", seq_id, payload_length, input_plans[slot].size, short_frames);
+		return;
+	}
+	if (INJECT_DROP_PERMILLE && rand_r(&inject_drop_seed) % 1000 < INJECT_DROP_PERMILLE)
+		return;
+	/* the first copy of a replicated frame wins */
+	if (!recovery_accept(&rx_recovery[slot], pkt_id, current_ts.nsec))
+		return;
+
+	/* get nearest timestamp to compute task */
+	uint64_t compute_ts;
+	uint64_t past_cycles = tx_timestamp / cycle_time;
+	if ((past_cycles * cycle_time + compute_offset >= current_ts.nsec)) {
+		compute_ts = past_cycles * cycle_time + compute_offset;
+	} else if (compute_offset <= (tx_timestamp % cycle_time)) {
+		compute_ts = (past_cycles + 1) * cycle_time + compute_offset;
+	} else {
+		dropped += 1;
+		trace_stream_miss(slot);
+		printf("**** Drop off late packet.[%d]\n", dropped);
+		return;
+	}
+
+	/* a frame of an older cycle than the one being collected is stale */
+	if (compute_ts < js.rx_cycle_compute_ts)
+		return;
+	if (compute_ts > js.rx_cycle_compute_ts) {
+		js.rx_cycle_compute_ts = compute_ts;
+		js.rx_cycle_mask = 0;
+		js.rx_cycle_min_timestamp = UINT64_MAX;
+		js.rx_cycle_max_pkt_id = 0;
+		js.rx_cycle_first_arrival = current_ts.nsec;
+	}
+
+	rx_streams[slot].tx_timestamp = tx_timestamp;
+	rx_streams[slot].pkt_id = pkt_id;
+	memcpy(rx_streams[slot].payload, payload, input_plans[slot].size);
+	js.rx_cycle_mask |= (uint64_t)1 << slot;
+	/* send minimum timestamp of streams */
+	if (js.rx_cycle_min_timestamp > tx_timestamp)
+		js.rx_cycle_min_timestamp = tx_timestamp;
+	/* select maximum packet id of streams */
+	if (js.rx_cycle_max_pkt_id < pkt_id)
+		js.rx_cycle_max_pkt_id = pkt_id;
+
+	/* Publish every arrival, the scan cycle runs once the mask is complete or at the compute release */
+	if (compute_ts >= js.slot.compute_ts.load(std::memory_order_relaxed)) {
+		publishCycle(j, compute_ts, js.rx_cycle_mask, js.rx_cycle_min_timestamp, js.rx_cycle_max_pkt_id, js.rx_cycle_first_arrival, current_ts.nsec);
+	}
+}
+
+/* Compute release of the next cycle of job j to run: one cycle after the last one run. The first
+ * cycle is the first one all input streams arrived for, UINT64_MAX until then; a job without
+ * input streams starts with its latest release.
+ */
+static uint64_t nextRelease(int j, uint64_t now)
+{
+	JobState &js = job_states[j];
+	const JobConfig &job = plc_jobs[j];
+	if (js.consumed_compute_ts)
+		return js.consumed_compute_ts + job.cycle_time;
+	if (js.complete_mask == 0)
+		return now / job.cycle_time * job.cycle_time + job.compute_offset;
+	if (js.slot.mask.load(std::memory_order_acquire) == js.complete_mask)
+		return js.slot.compute_ts.load(std::memory_order_relaxed);
+	return UINT64_MAX;
+}
+
+/* Pick the job whose cycle runs next (see JOB_SCHEDULING) and its release, -1 if no job has one yet */
+static int selectJob(uint64_t now, uint64_t *release)
+{
+	int first = -1, earliest_deadline = -1;
+	uint64_t first_release = UINT64_MAX, edf_release = 0, deadline = UINT64_MAX;
+	for (int j = 0; j < (int)plc_jobs.size(); j++) {
+		uint64_t r = nextRelease(j, now);
+		if (r < first_release) {
+			first = j;
+			first_release = r;
+		}
+		/* the compute window ends one slot after compute_time */
+		uint64_t d = r + plc_jobs[j].compute_time + (1ULL << 14);
+		if (JOB_SCHEDULING == JOB_SCHED_EDF && r <= now && d < deadline) {
+			earliest_deadline = j;
+			edf_release = r;
+			deadline = d;
+		}
+	}
+	if (earliest_deadline >= 0) {
+		*release = edf_release;
+		return earliest_deadline;
+	}
+	*release = first_release;
+	return first;
+}
+
+/* Wait for the next cycle to run and copy it in, returns its compute_ts, 0 if the PLC stops.
+ * job is set to the job of the cycle. The first cycle of a job needs all its input streams.
+ * After that a cycle whose streams are still missing at its compute release is taken as it is,
+ * mask tells which streams arrived for it.
+ */
+/* Set send_pkt_id/send_timestamp for the cycle at target of job j. A cycle whose inputs were published
+ * (fresh) sends the largest input pkt_id and the oldest input tx_timestamp, as read by readCycleSlot.
+ * Otherwise, and whenever that would not advance the pkt_id, it sends one more than the last cycle of
+ * the job and its release time. The first cycle of a job starts from its cycle number, so that its
+ * pkt_ids after a restart are not taken for duplicates downstream.
+ */
+static void setSendIds(int j, uint64_t target, bool fresh)
+{
+	JobState &js = job_states[j];
+	if (fresh && (js.sent_pkt_id == 0 || (int32_t)(send_pkt_id - js.sent_pkt_id) > 0))
+		return;
+	send_pkt_id = js.sent_pkt_id ? js.sent_pkt_id + 1 : (uint32_t)(target / plc_jobs[j].cycle_time);
+	send_timestamp = target;
+	if (!fresh) {
+		cycle_rec.first_arrival = target;
+		cycle_rec.last_arrival = target;
+	}
+}
+
+static uint64_t waitCycle(int *job, uint64_t *mask)
+{
+	while (run_openplc) {
+		uint32_t event = cycle_event.count.load(std::memory_order_acquire);
+		UScaledNs tmp, current_ts;
+		get_current_local_sync_ts(&tmp, &current_ts);
+		uint64_t target;
+		int j = selectJob(current_ts.nsec, &target);
+		if (j < 0) {
+			release_wait(&cycle_event, event, UINT64_MAX);
+			continue;
+		}
+		JobState &js = job_states[j];
+		const JobConfig &cfg = plc_jobs[j];
+		*job = j;
+
+		if (js.complete_mask != 0 &&
+			js.slot.compute_ts.load(std::memory_order_acquire) > js.consumed_compute_ts &&
+			js.slot.mask.load(std::memory_order_relaxed) == js.complete_mask) {
+			uint64_t compute_ts = readCycleSlot(j, mask);
+			if (compute_ts > js.consumed_compute_ts && *mask == js.complete_mask) {
+				setSendIds(j, compute_ts, true);
+				return compute_ts;
+			}
+		}
+		/* sleep until more input is published or the release is close, then spin to it */
+		if (current_ts.nsec < target) {
+			release_wait(&cycle_event, event, target);
+			continue;
+		}
+		/* the RX thread drops frames of this cycle from now on; after an overrun take the latest cycle due */
+		target += (current_ts.nsec - target) / cfg.cycle_time * cfg.cycle_time;
+		bool fresh = js.complete_mask != 0 && readCycleSlot(j, mask) == target;
+		if (!fresh)
+			*mask = 0;
+		setSendIds(j, target, fresh && *mask != 0);
+		return target;
+	}
+	return 0;
+}
+
+void *rxThread(void *arg)
+{
+	struct channel *channel_ptr = rx_channels;
+	int buffer_id;
+
+	thread_policy_apply("plc_rx");
+
+	/* Start all buffers being received */
+	for (buffer_id = 0; buffer_id < RX_BUFFER_COUNT; buffer_id += BUFFER_INCREMENT)
+	{
+		channel_ptr->buf_ptr[buffer_id].length = PACKET_HEADER_SIZE + PACKET_PAYLOAD_SIZE + 2000; // make buffer a little more
+		ioctl(channel_ptr->fd, START_XFER, &buffer_id);
+	}
+
+	/* Finish the buffers in order and start each one over again right after
+	 * decoding it, so that the other buffers stay queued meanwhile
+	 */
+	buffer_id = 0;
+	while (run_openplc)
+	{
+		ioctl(channel_ptr->fd, FINISH_XFER, &buffer_id);
+
+		bool received = (channel_ptr->buf_ptr[buffer_id].status == PROXY_NO_ERROR);
+		uint16_t seq_id;
+		uint32_t pkt_id;
+		uint64_t tx_timestamp;
+		int payload_length;
+		uint8_t payload[PACKET_PAYLOAD_MAX];
+		if (received) {
+			decodeFrame((uint8_t *)channel_ptr->buf_ptr[buffer_id].buffer, &seq_id, &pkt_id, &tx_timestamp, &payload_length);
+			memcpy(payload, (uint8_t *)channel_ptr->buf_ptr[buffer_id].buffer + PACKET_HEADER_SIZE, rx_payload_bytes);
+		}
+
+		channel_ptr->buf_ptr[buffer_id].length = PACKET_HEADER_SIZE + PACKET_PAYLOAD_SIZE + 2000;
+		ioctl(channel_ptr->fd, START_XFER, &buffer_id);
+		buffer_id += BUFFER_INCREMENT;
+		buffer_id %= RX_BUFFER_COUNT;
+
+		if (received) {
+			handleInputFrame(seq_id, pkt_id, tx_timestamp, payload, payload_length);
+		}
+	}
+	return NULL;
+}
+
 //-----------------------------------------------------------------------------
 // This function is called by the main OpenPLC routine when it is initializing.
 // Hardware initialization procedures should be here.
@@ -288,12 +718,74 @@ void initializeHardware()
 	for (int i = 0; i < INPUT_STREAM_NUM; i++) {
 		input_timestamp[i] = 0;
 	}
+	/* build the copy plans of the payload points */
+	input_plans.resize(INPUT_STREAM_NUM);
+	output_plans.resize(OUTPUT_STREAM_NUM);
+	for (int i = 0; i < INPUT_STREAM_NUM; i++) {
+		if (!payload_build_plan(input_payloads[i], &input_plans[i])) exit(EXIT_FAILURE);
+		rx_payload_bytes = std::max(rx_payload_bytes, input_plans[i].size);
+	}
+	for (int i = 0; i < OUTPUT_STREAM_NUM; i++) {
+		if (!payload_build_plan(output_payloads[i], &output_plans[i])) exit(EXIT_FAILURE);
+	}
+	input_payload = (uint8_t*)calloc(INPUT_STREAM_NUM, PACKET_PAYLOAD_MAX);
 	dma_init();
-    /* init seq_id_index dict */
-    for (int i = 0; i < INPUT_STREAM_NUM; i++) {
-        seqid_index[input_seq_ids[i]] = i;
+	buildFrameTemplates(output_src_address);
+    if (plc_jobs.empty())
+    {
+        printf("No job is scheduled on this node\n");
+        exit(EXIT_FAILURE);
+    }
+    int job_num = (int)plc_jobs.size();
+    std::vector<uint32_t> job_ids(job_num);
+    std::vector<uint64_t> deadlines(job_num);
+    uint64_t max_compute_time = 0;
+    for (int j = 0; j < job_num; j++) {
+        job_ids[j] = plc_jobs[j].job_id;
+        /* the outputs must leave within the compute window, which is one slot longer than compute_time */
+        deadlines[j] = (uint64_t)plc_jobs[j].compute_time + (1ULL << 14);
+        max_compute_time = std::max(max_compute_time, (uint64_t)plc_jobs[j].compute_time);
     }
     // reset_PL_by_GPIO("960");
+    release_init(RELEASE_SPIN_MARGIN_NS);
+    /* calibrated once, resized to the compute window of each job when it runs */
+    workload_init(WORKLOAD_KIND, max_compute_time > WORKLOAD_SLACK_NS ? max_compute_time - WORKLOAD_SLACK_NS : 0);
+    trace_init(INPUT_STREAM_NUM, job_num, job_ids.data(), deadlines.data());
+
+    /* start the RX thread */
+    rx_streams = new RxStream[INPUT_STREAM_NUM]();
+    staleness = new uint64_t[INPUT_STREAM_NUM]();
+    SeqRecovery *recovery = new SeqRecovery[INPUT_STREAM_NUM];
+    for (int i = 0; i < INPUT_STREAM_NUM; i++) {
+        recovery_init(&recovery[i], RECOVERY_RESET_CYCLES * (uint64_t)plc_jobs[input_stream_job[i]].cycle_time);
+    }
+    rx_recovery = recovery;
+    job_states = new JobState[job_num];
+    for (int j = 0; j < job_num; j++) {
+        JobState &js = job_states[j];
+        js.rx_cycle_compute_ts = 0;
+        js.rx_cycle_mask = 0;
+        js.complete_mask = 0;
+        for (int i: plc_jobs[j].inputs)
+            js.complete_mask |= (uint64_t)1 << i;
+        js.consumed_compute_ts = 0;
+        js.sent_pkt_id = 0;
+        js.slot.seq = 0;
+        js.slot.compute_ts = 0;
+        js.slot.mask = 0;
+        js.slot.send_timestamp = 0;
+        js.slot.send_pkt_id = 0;
+        js.slot.first_arrival = 0;
+        js.slot.last_arrival = 0;
+        js.slot.tx_timestamp = new std::atomic<uint64_t>[INPUT_STREAM_NUM]();
+        js.slot.pkt_id = new std::atomic<uint32_t>[INPUT_STREAM_NUM]();
+        js.slot.payload = new std::atomic<uint32_t>[INPUT_STREAM_NUM * (PACKET_PAYLOAD_MAX / 4)]();
+    }
+    if (pthread_create(&rx_channels[0].tid, NULL, rxThread, NULL) != 0)
+    {
+        printf("Failed to create the RX thread\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -302,8 +794,24 @@ void initializeHardware()
 //-----------------------------------------------------------------------------
 void finalizeHardware()
 {
+	/* run_openplc is cleared, the RX thread leaves after its current transfer */
+	pthread_join(rx_channels[0].tid, NULL);
+	char report[256];
+	ReleaseStats stats;
+	release_get_stats(&stats);
+	if (release_format_stats(report, sizeof(report), &stats) > 0) printf("%s", report);
+	workload_print_stats();
 	free(input_timestamp);
 	free(input_pkt_id);
+	delete[] rx_streams;
+	delete[] staleness;
+	for (size_t j = 0; j < plc_jobs.size(); j++) {
+		delete[] job_states[j].slot.tx_timestamp;
+		delete[] job_states[j].slot.pkt_id;
+		delete[] job_states[j].slot.payload;
+	}
+	delete[] job_states;
+	free(input_payload);
 }
 
 //-----------------------------------------------------------------------------
@@ -313,8 +821,6 @@ void finalizeHardware()
 //-----------------------------------------------------------------------------
 void updateBuffersIn()
 {
-	pthread_mutex_lock(&bufferLock); //lock mutex
-
 	/*********READING AND WRITING TO I/O**************
 
 	*bool_input[0][0] = read_digital_input(0);
@@ -325,116 +831,87 @@ void updateBuffersIn()
 
 	**************************************************/
 	//INPUT
-	for (int i = 0; i < MAX_INPUT; i++)
-	{
-		if (bool_input[i / 8][i % 8] != NULL)
-		{
-			int value;
-            int count = 0;
-            while (1) {
-                // wait for packet
-                // dma rx
-                int in_progress_count = 0, buffer_id = 0;
-                int rx_counter = 0;
-                rx_channels[0].buf_ptr[buffer_id].length = PACKET_HEADER_SIZE + PACKET_PAYLOAD_SIZE + 2000; // make buffer a little more
-                // Poll the status of current RX transfer
-                ioctl(rx_channels[0].fd, START_XFER, &buffer_id);
-                ioctl(rx_channels[0].fd, FINISH_XFER, &buffer_id);
-                if (rx_channels[0].buf_ptr[buffer_id].status == PROXY_NO_ERROR)
-                {
-                    value = 1;
-                    uint8_t *RxBufferPtr;
-                    RxBufferPtr = (uint8_t *)rx_channels[0].buf_ptr[buffer_id].buffer;
-                    uint16_t seq_id = ((uint64_t)(RxBufferPtr[36]) << 8) |
-                                    ((uint64_t)(RxBufferPtr[37]) << 0);
-                    uint32_t pkt_id = ((uint64_t)(RxBufferPtr[38]) << 24) | 
-                                    ((uint64_t)(RxBufferPtr[39]) << 16) |
-                                    ((uint64_t)(RxBufferPtr[40]) <<  8) |
-                                    ((uint64_t)(RxBufferPtr[41]) <<  0);
-                    
-                    uint64_t tx_timestamp = ((uint64_t)(RxBufferPtr[20]) << 56) | 
-                                            ((uint64_t)(RxBufferPtr[21]) << 48) |
-                                            ((uint64_t)(RxBufferPtr[22]) << 40) |
-                                            ((uint64_t)(RxBufferPtr[23]) << 32) |
-                                            ((uint64_t)(RxBufferPtr[24]) << 24) |
-                                            ((uint64_t)(RxBufferPtr[25]) << 16) |
-                                            ((uint64_t)(RxBufferPtr[26]) <<  8) |
-                                            ((uint64_t)(RxBufferPtr[27]) <<  0);
-                    UScaledNs tmp, current_ts;
-                    get_current_local_sync_ts(&tmp, &current_ts);
-                    if (DEBUG_ENABLE) {
-                        printf("[%" PRIu64 " ns]{%" PRIu64 "} receive packet. packet's tx_timestamp is %" PRIu64 "{%" PRIu64 "}. d2s latency: %" PRIu64 ". \n", current_ts.nsec, current_ts.nsec / (uint64_t)(CYCLE_TIME), tx_timestamp, tx_timestamp / (uint64_t)(CYCLE_TIME), current_ts.nsec - tx_timestamp);
-						printf("<--RX: seq_id: 0x%04x, pkt_id: %" PRIu32 ", timestamp: %" PRIu64 "\n", (unsigned long)seq_id, pkt_id, tx_timestamp);
-                    }
-
-                    /* get nearest timestamp to compute task */
-                    
-                    uint64_t past_cycles = tx_timestamp / (uint64_t)CYCLE_TIME;
-                    
-                    if ((past_cycles * (uint64_t)CYCLE_TIME + (uint64_t)COMPUTE_OFFSET >= current_ts.nsec)) {
-                        next_compute_ts.nsec = past_cycles * (uint64_t)CYCLE_TIME + (uint64_t)COMPUTE_OFFSET;
-                    } else if ((uint64_t)COMPUTE_OFFSET <= (tx_timestamp % (uint64_t)CYCLE_TIME)){
-                        next_compute_ts.nsec = (past_cycles + 1) * (uint64_t)CYCLE_TIME + (uint64_t)COMPUTE_OFFSET;
-					} else {
-                        dropped += 1;
-                        printf("**** Drop off late packet.[%d]\n", dropped);
-                        continue;
-                    }
-                
-                    uint64_t to_next_compute_interval = next_compute_ts.nsec - current_ts.nsec;
-
-                    
-
-                    input_timestamp[seqid_index[seq_id]] = tx_timestamp;
-                    input_pkt_id[seqid_index[seq_id]] = pkt_id;
-                    bool send_packet = true;
-               
-					send_timestamp = input_timestamp[0]; 
-					send_pkt_id = input_pkt_id[0];
-
-					/* Only send when receive packets of the same time cycle*/
-					for (int i = 0; i < INPUT_STREAM_NUM; i++) {
-						send_packet = send_packet && ((input_timestamp[i] >= next_compute_ts.nsec - (uint64_t)(CYCLE_TIME))) && (input_timestamp[0] != 0);
-						/* send minimum timestamp of streams */
-						if (send_timestamp > input_timestamp[i]) {
-							send_timestamp = input_timestamp[i];
-						}
-						/* select maximum packet id of streams */
-						if (send_pkt_id < input_pkt_id[i]) { 
-							send_pkt_id = input_pkt_id[i];
-						}
-					}
-					if (send_packet) {
-                        if (DEBUG_ENABLE) {
-                            printf("should sleep [%d] ns until [%" PRIu64 "] \n", (int)to_next_compute_interval, next_compute_ts.nsec);
-                        }
-                        /* Deterministic send and compute*/
-
-                        // cpu sleep 
-                        // sleep_until(&tmp_timer, (int)to_next_compute_interval);
-                        // get_current_local_sync_ts(&tmp, &current_ts);
-                        
-                        // wait for the compute time coming up
-                        while (1) {
-                            get_current_local_sync_ts(&tmp, &current_ts);
-                            if (current_ts.nsec >= next_compute_ts.nsec) {
-                                // output sync time
-                                if (DEBUG_ENABLE) {
-                                    printf("[%" PRIu64 " ns] start to execute tasks.\n", current_ts.nsec);
-                                }
-                                break;
-                            }
-                        }
-						value = 1;  
-                    	break;
-					}
-                    
-                }
-            }   
-			*bool_input[i / 8][i % 8] = value;
+	uint64_t mask;
+	const JobConfig *job;
+	JobState *js;
+	UScaledNs tmp, scan_ts;
+	get_current_local_sync_ts(&tmp, &scan_ts); // the previous cycle is done
+	/* wait for the RX thread to publish a cycle we have not run yet, skipped cycles are not run */
+	do {
+		next_compute_ts.nsec = waitCycle(&current_job, &mask);
+		if (next_compute_ts.nsec == 0)
+			return;
+		job = &plc_jobs[current_job];
+		js = &job_states[current_job];
+		if (js->consumed_compute_ts != 0 && next_compute_ts.nsec > js->consumed_compute_ts + job->cycle_time)
+			missed_releases += (next_compute_ts.nsec - js->consumed_compute_ts) / job->cycle_time - 1;
+		js->consumed_compute_ts = next_compute_ts.nsec;
+		for (int k: job->inputs) {
+			staleness[k] = (mask & ((uint64_t)1 << k)) ? 0 : staleness[k] + 1;
+		}
+		if (mask != js->complete_mask) {
+			partial_cycles++;
+			if (DEBUG_ENABLE) {
+				printf("[%" PRIu64 " ns] job %" PRIu32 ": inputs 0x%" PRIx64 " of 0x%" PRIx64 " arrived.\n", next_compute_ts.nsec, job->job_id, mask, js->complete_mask);
+			}
+		}
+	} while (mask != js->complete_mask && job->input_policy == INPUT_POLICY_SKIP);
+
+	/* the previous cycle ran past the release of this one */
+	if (scan_ts.nsec > next_compute_ts.nsec) {
+		overrun_cycles++;
+		if ((overrun_cycles & (overrun_cycles - 1)) == 0) {
+			unsigned char log_msg[200];
+			sprintf(log_msg, "Scan cycle overrun: job %" PRIu32 " reached %" PRIu64 " ns after its release (%" PRIu64 " overruns, %" PRIu64 " releases missed)\n",
+				job->job_id, scan_ts.nsec - next_compute_ts.nsec, overrun_cycles, missed_releases);
+			log(SEV_WARNING, log_msg);
 		}
 	}
 
+	/* Deterministic send and compute*/
+	// wait for the compute time coming up
+	int64_t jitter = release_at(next_compute_ts.nsec);
+	cycle_rec.cycle = cycle_count++;
+	cycle_rec.job = current_job;
+	cycle_rec.compute_ts = next_compute_ts.nsec;
+	cycle_rec.send_timestamp = send_timestamp;
+	cycle_rec.release = next_compute_ts.nsec + jitter;
+	if (DEBUG_ENABLE) {
+		printf("[%" PRIu64 " ns] start to execute tasks.\n", next_compute_ts.nsec + jitter);
+	}
+	ReleaseStats stats;
+	release_get_stats(&stats);
+	if (RELEASE_REPORT_CYCLES && stats.count % RELEASE_REPORT_CYCLES == 0) {
+		/* never waits: while a reader holds the report, this one is dropped */
+		if (pthread_mutex_trylock(&report_lock) == 0) {
+			report_release = stats;
+			workload_get_stats(&report_workload);
+			pthread_mutex_unlock(&report_lock);
+		}
+		release_reset_stats();
+		workload_reset_stats();
+	}
+
+	pthread_mutex_lock(&bufferLock); //lock mutex
+	setSyncTime(next_compute_ts.nsec); //IEC TIME of the cycle is its release
+	/* %IX0.0 tells the program that a cycle was released, payload points cannot map it */
+	if (bool_input[0][0] != NULL) *bool_input[0][0] = 1;
+	for (int k: job->inputs) {
+		/* with INPUT_POLICY_HOLD the points of a missing stream keep their last value */
+		if (mask & ((uint64_t)1 << k))
+			payload_decode(input_plans[k], &input_payload[k * PACKET_PAYLOAD_MAX]);
+		else if (job->input_policy == INPUT_POLICY_DEFAULT)
+			payload_decode(input_plans[k], default_payload);
+	}
+	if (special_functions[JOB_SPECIAL] != NULL) *special_functions[JOB_SPECIAL] = job->job_id;
+	if (special_functions[STALENESS_SPECIAL_BASE] != NULL) *special_functions[STALENESS_SPECIAL_BASE] = partial_cycles;
+	for (int k = 0; k < INPUT_STREAM_NUM && STALENESS_SPECIAL_BASE + 1 + k < SPECIAL_FUNCTIONS_SIZE; k++) {
+		if (special_functions[STALENESS_SPECIAL_BASE + 1 + k] != NULL) *special_functions[STALENESS_SPECIAL_BASE + 1 + k] = staleness[k];
+	}
+	if (OVERRUN_SPECIAL + 1 < SPECIAL_FUNCTIONS_SIZE) {
+		if (special_functions[OVERRUN_SPECIAL] != NULL) *special_functions[OVERRUN_SPECIAL] = overrun_cycles;
+		if (special_functions[OVERRUN_SPECIAL + 1] != NULL) *special_functions[OVERRUN_SPECIAL + 1] = missed_releases;
+	}
 	pthread_mutex_unlock(&bufferLock); //unlock mutex
 }
 
@@ -456,42 +933,44 @@ void updateBuffersOut()
 	write_analog_output(0, *int_output[0]);
 
 	**************************************************/
-	for (int i = 0; i < MAX_OUTPUT; i++)
-	{
-		if (bool_output[i / 8][i % 8] != NULL)
-		{
-			int value = *bool_output[i / 8][i % 8];
-			// transfer packet
-			// dma tx
-			if (value == 1)
-			{
-                UScaledNs tmp, current_ts;
-                get_current_local_sync_ts(&tmp, &current_ts);
-                
-                /* simulate complex control logic */ 
-                UScaledNs send_ts;
-                send_ts.nsec = current_ts.nsec + (uint64_t)COMPUTE_TIME;
-                uint64_t product = 1;
-                int count = 0;
-                
-                // 6553600ns run 1870 times in loop, 6553600 / 1870 = 3504
-                uint64_t compute_times = (uint64_t)(COMPUTE_TIME-200000) / (uint64_t)3504;
-                for (int k = 0; k < compute_times; k++) {
-                    get_current_local_sync_ts(&tmp, &current_ts);
-                }
-
-                
-                if (DEBUG_ENABLE) {
-                    printf("[%" PRIu64 " ns] start to send task. count = %d.\n", current_ts.nsec, count);
-                }
-                for (int i = 0; i < OUTPUT_STREAM_NUM; i++) {
-                    sendFrame((uint32_t)output_seq_ids[i], send_timestamp, send_pkt_id, output_src_address, output_dst_addresses[i]);
-                }
-				
-				
-			}
-		}
+	/* every released cycle computes and sends the outputs of its job */
+	UScaledNs tmp, current_ts;
+	const JobConfig &job = plc_jobs[current_job];
+
+	/* simulate complex control logic, sized to the compute window of the job */ 
+	if (plc_jobs.size() > 1)
+		workload_set_target(job.compute_time > WORKLOAD_SLACK_NS ? job.compute_time - WORKLOAD_SLACK_NS : 0);
+	uint64_t compute_ns = workload_run();
+
+	get_current_local_sync_ts(&tmp, &current_ts);
+	cycle_rec.logic_end = current_ts.nsec;
+	if (DEBUG_ENABLE) {
+		printf("[%" PRIu64 " ns] start to send task. compute took %" PRIu64 " ns.\n", current_ts.nsec, compute_ns);
+	}
+	for (int k: job.outputs) {
+		payload_encode(output_plans[k], (uint8_t *)tx_channels[0].buf_ptr[k].buffer + PACKET_HEADER_SIZE);
 	}
+	sendOutputFrames(job, send_timestamp, send_pkt_id);
+	job_states[current_job].sent_pkt_id = send_pkt_id;
+	get_current_local_sync_ts(&tmp, &current_ts);
+	cycle_rec.tx_done = current_ts.nsec;
+	trace_record(&cycle_rec);
 
 	pthread_mutex_unlock(&bufferLock); //unlock mutex
 }
+
+//-----------------------------------------------------------------------------
+// Formats the release jitter and workload statistics of the last
+// RELEASE_REPORT_CYCLES cycles for the interactive server. Returns the bytes
+// written.
+//-----------------------------------------------------------------------------
+int formatCycleReport(char *buf, int size)
+{
+	pthread_mutex_lock(&report_lock);
+	ReleaseStats release = report_release;
+	WorkloadStats workload = report_workload;
+	pthread_mutex_unlock(&report_lock);
+
+	int len = release_format_stats(buf, size, &release);
+	return len + workload_format_stats(buf + len, size - len, &workload);
+}
@@ -35,7 +35,12 @@
 #include <fcntl.h>
 #include <time.h>
 
+#include <vector>
+
 #include "ladder.h"
+#include "cycle_trace.h"
+#include "seq_recovery.h"
+#include "config.h"
 
 //Global Variables
 bool run_modbus = 0;
@@ -63,6 +68,7 @@ pthread_t pstorage_thread;
 //-----------------------------------------------------------------------------
 void *modbusThread(void *arg)
 {
+    thread_policy_apply("modbus_server");
     startServer(modbus_port, MODBUS_PROTOCOL);
 }
 
@@ -71,6 +77,7 @@ void *modbusThread(void *arg)
 //-----------------------------------------------------------------------------
 void *dnp3Thread(void *arg)
 {
+    thread_policy_apply("dnp3_server");
     dnp3StartServer(dnp3_port);
 }
 
@@ -79,6 +86,7 @@ void *dnp3Thread(void *arg)
 //-----------------------------------------------------------------------------
 void *enipThread(void *arg)
 {
+    thread_policy_apply("enip_server");
     startServer(enip_port, ENIP_PROTOCOL);
 }
 
@@ -87,6 +95,7 @@ void *enipThread(void *arg)
 //-----------------------------------------------------------------------------
 void *pstorageThread(void *arg)
 {
+    thread_policy_apply("pstorage");
     startPstorage();
 }
 
@@ -127,7 +136,7 @@ int createSocket_interactive(int port)
     if (socket_fd<0)
     {
         sprintf(log_msg, "Interactive Server: error creating stream socket => %s\n", strerror(errno));
-        log(log_msg);
+        log(SEV_ERROR, log_msg);
         exit(1);
     }
     
@@ -148,7 +157,7 @@ int createSocket_interactive(int port)
     if (bind(socket_fd,(struct sockaddr *)&server_addr,sizeof(server_addr)) < 0)
     {
         sprintf(log_msg, "Interactive Server: error binding socket => %s\n", strerror(errno));
-        log(log_msg);
+        log(SEV_ERROR, log_msg);
         exit(1);
     }
     // we accept max 5 pending connections
@@ -373,7 +382,83 @@ void processCommand(unsigned char *buffer, int client_fd)
     {
         processing_command = true;
         printf("Issued runtime_logs() command\n");
-        write(client_fd, log_buffer, log_index);
+        //response buffers are per call: every client has its own thread
+        std::vector<char> log_buffer(LOG_RING_SIZE * 64);
+        uint64_t seq = log_oldest_seq();
+        while ((count_char = log_format(log_buffer.data(), log_buffer.size(), &seq, false)) > 0)
+        {
+            write(client_fd, log_buffer.data(), count_char);
+        }
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "runtime_logs_since(", 19) == 0)
+    {
+        processing_command = true;
+        std::vector<char> log_buffer(LOG_RING_SIZE * 64);
+        uint64_t seq = strtoull((char *)buffer + 19, NULL, 10);
+        count_char = log_format(log_buffer.data(), log_buffer.size() - 128, &seq, true);
+        LogStats stats;
+        log_get_stats(&stats);
+        count_char += sprintf(log_buffer.data() + count_char, "next_seq: %llu dropped: %llu truncated: %llu\n",
+                              (unsigned long long)seq, (unsigned long long)stats.dropped, (unsigned long long)stats.truncated);
+        write(client_fd, log_buffer.data(), count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "cycle_stats()", 13) == 0)
+    {
+        processing_command = true;
+        std::vector<char> trace_buffer(8192);
+        count_char = trace_format_stats(trace_buffer.data(), trace_buffer.size());
+        write(client_fd, trace_buffer.data(), count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "cycle_trace(", 12) == 0)
+    {
+        processing_command = true;
+        std::vector<char> trace_buffer(TRACE_RING_SIZE * 200);
+        count_char = trace_format_recent(trace_buffer.data(), trace_buffer.size(), readCommandArgument(buffer));
+        write(client_fd, trace_buffer.data(), count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "release_stats()", 15) == 0)
+    {
+        processing_command = true;
+        std::vector<char> report_buffer(1024);
+        count_char = formatCycleReport(report_buffer.data(), report_buffer.size());
+        write(client_fd, report_buffer.data(), count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "frer_stats()", 12) == 0)
+    {
+        processing_command = true;
+        std::vector<char> recovery_buffer(INPUT_STREAM_MAX * 256);
+        count_char = 0;
+        if (rx_recovery != NULL)
+            count_char = recovery_format_stats(recovery_buffer.data(), recovery_buffer.size(), rx_recovery, INPUT_STREAM_NUM);
+        write(client_fd, recovery_buffer.data(), count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "thread_policy()", 15) == 0)
+    {
+        processing_command = true;
+        std::vector<char> policy_buffer(THREAD_POLICY_MAX_ROLES * 120);
+        count_char = thread_policy_format(policy_buffer.data(), policy_buffer.size());
+        write(client_fd, policy_buffer.data(), count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "mb_stats()", 10) == 0)
+    {
+        processing_command = true;
+        std::vector<char> mb_buffer(256 * 200);
+        count_char = mb_format_stats(mb_buffer.data(), mb_buffer.size());
+        write(client_fd, mb_buffer.data(), count_char);
         processing_command = false;
         return;
     }
@@ -427,6 +512,7 @@ void *handleConnections_interactive(void *arguments)
     unsigned char buffer[1024];
     int messageSize;
 
+    thread_policy_apply("interactive");
     printf("Interactive Server: Thread created for client ID: %d\n", client_fd);
 
     while(run_openplc)
@@ -474,7 +560,7 @@ void startInteractiveServer(int port)
         if (client_fd < 0)
         {
             sprintf(log_msg, "Interactive Server: Error accepting client!\n");
-            log(log_msg);
+            log(SEV_ERROR, log_msg);
         }
 
         else
@@ -27,6 +27,8 @@
 #include <stdint.h>
 
 #include "tsn_drivers/ptp_types.h"
+#include "runtime_log.h"
+#include "tsn_drivers/thread_policy.h"
 
 #define MODBUS_PROTOCOL     0
 #define DNP3_PROTOCOL       1
@@ -78,6 +80,8 @@ extern IEC_LINT *lint_memory[BUFFER_SIZE];
 
 //Special Functions
 extern IEC_LINT *special_functions[BUFFER_SIZE];
+//taken from the array, not from BUFFER_SIZE, which dma-proxy-plc.h redefines in the hardware layer
+#define SPECIAL_FUNCTIONS_SIZE	((int)(sizeof(special_functions) / sizeof(special_functions[0])))
 
 //lock for the buffer
 extern pthread_mutex_t bufferLock;
@@ -102,6 +106,7 @@ void initializeHardware();
 void finalizeHardware();
 void updateBuffersIn();
 void updateBuffersOut();
+int formatCycleReport(char *buf, int size);
 
 //custom_layer.h
 void initCustomLayer();
@@ -116,11 +121,11 @@ extern int ignored_int_outputs[];
 void sleep_until(struct timespec *ts, int delay);
 void sleepms(int milliseconds);
 void log(unsigned char *logmsg);
+void log(int severity, unsigned char *logmsg);
 bool pinNotPresent(int *ignored_vector, int vector_size, int pinNumber);
 extern uint8_t run_openplc;
-extern unsigned char log_buffer[1000000];
-extern int log_index;
 void handleSpecialFunctions();
+void setSyncTime(uint64_t sync_ns);
 
 //server.cpp
 void startServer(uint16_t port, int protocol_type);
@@ -150,7 +155,8 @@ uint16_t processPCCCMessage(unsigned char *buffer, int buffer_size);
 
 //modbus_master.cpp
 void initializeMB();
-void *querySlaveDevices(void *arg);
+void *pollDevices(void *arg);
+int mb_format_stats(char *buf, int size);
 void updateBuffersIn_MB();
 void updateBuffersOut_MB();
 
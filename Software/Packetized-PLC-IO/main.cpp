@@ -34,26 +34,28 @@
 
 #include "iec_types.h"
 #include "ladder.h"
+#include "process_image.h"
 #include "tsn_drivers/uio.h"
 #include "tsn_drivers/rtc.h"
 #include "tsn_drivers/ptp_types.h"
 
 
 #define OPLC_CYCLE          50000000
+#define LOG_CONSOLE_POLL_MS 100
 
 extern int opterr;
 //extern int common_ticktime__;
 IEC_BOOL __DEBUG;
 
 IEC_LINT cycle_counter = 0;
+extern IEC_TIME __CURRENT_TIME;
+bool sync_time = false; //__CURRENT_TIME follows the synchronized clock, see setSyncTime()
 
 unsigned long __tick = 0;
 pthread_mutex_t bufferLock; //mutex for the internal buffers
-pthread_mutex_t logLock; //mutex for the internal log
+pthread_mutex_t consoleLock; //mutex for printing the log on the console
 uint8_t run_openplc = 1; //Variable to control OpenPLC Runtime execution
-unsigned char log_buffer[1000000]; //A very large buffer to store all logs
-int log_index = 0;
-int log_counter = 0;
+uint64_t console_log_seq = 0; //next log record to print on the console
 
 //-----------------------------------------------------------------------------
 // Helper function - Makes the running thread sleep for the ammount of time
@@ -97,27 +99,66 @@ void sleepns(uint64_t nanoseconds)
 }
 
 //-----------------------------------------------------------------------------
-// Helper function - Logs messages and print them on the console
+// Sets the IEC current time, which TON, TOF and TP time with, to the
+// synchronized release time of the cycle about to run. Every node then sees
+// the same TIME for the same cycle. Cycles of several jobs may run out of
+// release order, so the time never goes backwards.
+//-----------------------------------------------------------------------------
+void setSyncTime(uint64_t sync_ns)
+{
+    uint64_t now = (uint64_t)__CURRENT_TIME.tv_sec * 1000000000ULL + __CURRENT_TIME.tv_nsec;
+    sync_time = true;
+    if (sync_ns <= now)
+        return;
+    __CURRENT_TIME.tv_sec = sync_ns / 1000000000ULL;
+    __CURRENT_TIME.tv_nsec = sync_ns % 1000000000ULL;
+}
+
+//-----------------------------------------------------------------------------
+// Helper function - Logs messages. They are stored in the log ring without
+// blocking and printed on the console by the log console thread
 //-----------------------------------------------------------------------------
 void log(unsigned char *logmsg)
 {
-    pthread_mutex_lock(&logLock); //lock mutex
-    printf("%s", logmsg);
-    for (int i = 0; logmsg[i] != '\0'; i++)
+    log_write(SEV_INFO, (const char *)logmsg);
+}
+
+void log(int severity, unsigned char *logmsg)
+{
+    log_write(severity, (const char *)logmsg);
+}
+
+//-----------------------------------------------------------------------------
+// Prints the log records the console has not shown yet
+//-----------------------------------------------------------------------------
+void printLogs()
+{
+    static char console_buffer[LOG_RING_SIZE * 64];
+    int count;
+
+    pthread_mutex_lock(&consoleLock);
+    while ((count = log_format(console_buffer, sizeof(console_buffer), &console_log_seq, false)) > 0)
     {
-        log_buffer[log_index] = logmsg[i];
-        log_index++;
-        log_buffer[log_index] = '\0';
+        fwrite(console_buffer, 1, count, stdout);
     }
-    
-    log_counter++;
-    if (log_counter >= 1000)
+    fflush(stdout);
+    pthread_mutex_unlock(&consoleLock);
+}
+
+//-----------------------------------------------------------------------------
+// Log Console Thread. Prints new log records on the console, so that a slow
+// console never stalls the threads that log
+//-----------------------------------------------------------------------------
+void *logConsoleThread(void *arg)
+{
+    thread_policy_apply("log");
+    while (run_openplc)
     {
-        /*Store current log on a file*/
-        log_counter = 0;
-        log_index = 0;
+        printLogs();
+        sleepms(LOG_CONSOLE_POLL_MS);
     }
-    pthread_mutex_unlock(&logLock); //unlock mutex
+    printLogs();
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -126,6 +167,7 @@ void log(unsigned char *logmsg)
 //-----------------------------------------------------------------------------
 void *interactiveServerThread(void *arg)
 {
+    thread_policy_apply("interactive");
     startInteractiveServer(43628);
 }
 
@@ -148,26 +190,10 @@ bool pinNotPresent(int *ignored_vector, int vector_size, int pinNumber)
 //-----------------------------------------------------------------------------
 void disableOutputs()
 {
-    //Disable digital outputs
-    for (int i = 0; i < BUFFER_SIZE; i++)
-    {
-        for (int j = 0; j < 8; j++)
-        {
-            if (bool_output[i][j] != NULL) *bool_output[i][j] = 0;
-        }
-    }
-    
-    //Disable byte outputs
-    for (int i = 0; i < BUFFER_SIZE; i++)
-    {
-        if (byte_output[i] != NULL) *byte_output[i] = 0;
-    }
-    
-    //Disable analog outputs
-    for (int i = 0; i < BUFFER_SIZE; i++)
-    {
-        if (int_output[i] != NULL) *int_output[i] = 0;
-    }
+    //Disable digital, byte and analog outputs
+    memset(plc_image.bool_output, 0, sizeof(plc_image.bool_output));
+    memset(plc_image.byte_output, 0, sizeof(plc_image.byte_output));
+    memset(plc_image.int_output, 0, sizeof(plc_image.int_output));
 }
 
 //-----------------------------------------------------------------------------
@@ -203,6 +229,11 @@ void handleSpecialFunctions()
 int main(int argc,char **argv)
 {
     unsigned char log_msg[1000];
+    thread_policy_load(THREAD_POLICY_FILE); //before any thread is created
+    pthread_mutex_init(&consoleLock, NULL);
+    pthread_t log_thread;
+    pthread_create(&log_thread, NULL, logConsoleThread, NULL);
+    atexit(printLogs); //messages logged right before an exit()
     sprintf(log_msg, "OpenPLC Runtime starting...\n");
     log(log_msg);
 
@@ -221,6 +252,7 @@ int main(int argc,char **argv)
     time(&start_time);
     pthread_t interactive_thread;
     pthread_create(&interactive_thread, NULL, interactiveServerThread, NULL);
+    image_init(); //the program instances copy the located pointers in config_init__()
     config_init__();
     glueVars();
 
@@ -251,6 +283,7 @@ int main(int argc,char **argv)
     glueVars();
     mapUnusedIO();
     readPersistentStorage();
+    image_publish();
     //pthread_t persistentThread;
     //pthread_create(&persistentThread, NULL, persistentStorage, NULL);
 
@@ -258,15 +291,6 @@ int main(int argc,char **argv)
     //======================================================
     //              REAL-TIME INITIALIZATION
     //======================================================
-    // Set our thread to real time priority
-    // struct sched_param sp;
-    // sp.sched_priority = 30;
-    // printf("Setting main thread priority to RT\n");
-    // if(pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp))
-    // {
-    //     printf("WARNING: Failed to set main thread to real-time priority\n");
-    // }
-
     // Lock memory to ensure no swapping is done.
     printf("Locking main thread memory\n");
     if(mlockall(MCL_FUTURE|MCL_CURRENT))
@@ -274,6 +298,8 @@ int main(int argc,char **argv)
         printf("WARNING: Failed to lock memory\n");
     }
 #endif
+    // Scheduling class, priority and CPUs of the scan cycle from threads.conf
+    thread_policy_apply("scan");
 
 	//gets the starting point for the clock
 	printf("Getting current time\n");
@@ -314,6 +340,7 @@ int main(int argc,char **argv)
 		updateBuffersIn(); //read input image
 
 		pthread_mutex_lock(&bufferLock); //lock mutex
+		image_apply_writes(); //writes queued by the protocol servers
         
 		updateCustomIn();
         updateBuffersIn_MB(); //update input image table with data from slave devices
@@ -325,8 +352,9 @@ int main(int argc,char **argv)
 		pthread_mutex_unlock(&bufferLock); //unlock mutex
 
 		updateBuffersOut(); //write output image
+		image_publish(); //snapshot read by the protocol servers, taken once the outputs are sent
         
-		updateTime();
+		if (!sync_time) updateTime(); //free running time of the hardware layers without a synchronized clock
         // char tmp[100];
         // sprintf(tmp, "common_ticktime is %llu\n", common_ticktime__);
         // log(tmp); 
@@ -337,6 +365,7 @@ int main(int argc,char **argv)
 	//             SHUTTING DOWN OPENPLC RUNTIME
 	//======================================================
     pthread_join(interactive_thread, NULL);
+    pthread_join(log_thread, NULL);
     printf("Disabling outputs\n");
     disableOutputs();
     updateCustomOut();
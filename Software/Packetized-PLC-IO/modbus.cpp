@@ -27,8 +27,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <string.h>
 
 #include "ladder.h"
+#include "process_image.h"
 
 #define MAX_DISCRETE_INPUT              8192
 #define MAX_COILS                       8192
@@ -51,6 +53,7 @@
 #define MB_FC_WRITE_REGISTER            6
 #define MB_FC_WRITE_MULTIPLE_COILS      15
 #define MB_FC_WRITE_MULTIPLE_REGISTERS  16
+#define MB_FC_READ_WRITE_MULTIPLE_REGISTERS 23
 #define MB_FC_ERROR                     255
 
 #define ERR_NONE                        0
@@ -69,11 +72,6 @@
 #define lowByte(w) ((unsigned char) ((w) & 0xff))
 #define highByte(w) ((unsigned char) ((w) >> 8))
 
-IEC_BOOL mb_discrete_input[MAX_DISCRETE_INPUT];
-IEC_BOOL mb_coils[MAX_COILS];
-IEC_UINT mb_input_regs[MAX_INP_REGS];
-IEC_UINT mb_holding_regs[MAX_HOLD_REGS];
-
 int MessageLength;
 
 
@@ -91,47 +89,125 @@ int word(unsigned char byte1, unsigned char byte2)
 
 //-----------------------------------------------------------------------------
 // This function sets the internal NULL OpenPLC buffers to point to valid
-// positions on the Modbus buffer
+// positions on the process image
 //-----------------------------------------------------------------------------
 void mapUnusedIO()
 {
 	pthread_mutex_lock(&bufferLock);
+	image_map_tables();
+	pthread_mutex_unlock(&bufferLock);
+}
+
+//-----------------------------------------------------------------------------
+// A run of holding registers that lies in one area of the process image
+//-----------------------------------------------------------------------------
+struct HoldingSegment
+{
+	int area;
+	int word;       // first word in the area, counted in 16 bit words
+	int count;
+};
 
-	for(int i = 0; i < MAX_DISCRETE_INPUT; i++)
+//-----------------------------------------------------------------------------
+// Split count holding registers from Start where they cross from %QW (below
+// MIN_16B_RANGE) into %MW, %MD (high word first) and %ML (highest word
+// first). Returns the number of segments, at most four, or -1 if part of the
+// range is not a valid address
+//-----------------------------------------------------------------------------
+int resolveHoldingRegisters(int Start, int count, HoldingSegment *segments)
+{
+	static const int area[4] = {AREA_INT_OUTPUT, AREA_INT_MEMORY, AREA_DINT_MEMORY, AREA_LINT_MEMORY};
+	static const int first[4] = {0, MIN_16B_RANGE, MIN_32B_RANGE, MIN_64B_RANGE};
+	static const int last[4] = {MIN_16B_RANGE - 1, MAX_16B_RANGE, MAX_32B_RANGE, MAX_64B_RANGE};
+	int end = Start + count - 1;
+	int n = 0;
+
+	if (end > MAX_64B_RANGE)
 	{
-		if (bool_input[i/8][i%8] == NULL) bool_input[i/8][i%8] = &mb_discrete_input[i];
+		return -1;
 	}
-
-	for(int i = 0; i < MAX_COILS; i++)
+	for (int i = 0; i < 4; i++)
 	{
-		if (bool_output[i/8][i%8] == NULL) bool_output[i/8][i%8] = &mb_coils[i];
+		int from = (Start > first[i]) ? Start : first[i];
+		int to = (end < last[i]) ? end : last[i];
+		if (from <= to)
+		{
+			segments[n].area = area[i];
+			segments[n].word = from - first[i];
+			segments[n].count = to - from + 1;
+			n++;
+		}
 	}
+	return n;
+}
 
-	for (int i = 0; i < MAX_INP_REGS; i++)
+//-----------------------------------------------------------------------------
+// Copy one segment of holding registers out of the image, big endian
+//-----------------------------------------------------------------------------
+void readHoldingSegment(const ProcessImage *image, const HoldingSegment *segment, unsigned char *data)
+{
+	if (segment->area == AREA_DINT_MEMORY)
 	{
-		if (int_input[i] == NULL) int_input[i] = &mb_input_regs[i];
+		for (int i = 0; i < segment->count; i++)
+		{
+			int w = segment->word + i;
+			uint16_t value = (uint16_t)((uint32_t)image->dint_memory[w >> 1] >> (16 * (1 - (w & 1))));
+			data[i * 2] = highByte(value);
+			data[i * 2 + 1] = lowByte(value);
+		}
 	}
-
-	for (int i = 0; i <= MAX_16B_RANGE; i++)
+	else if (segment->area == AREA_LINT_MEMORY)
 	{
-		if (i < MIN_16B_RANGE)
-        {
-            if (int_output[i] == NULL)
-            {
-                int_output[i] = &mb_holding_regs[i];
-            }
-        }
+		for (int i = 0; i < segment->count; i++)
+		{
+			int w = segment->word + i;
+			uint16_t value = (uint16_t)((uint64_t)image->lint_memory[w >> 2] >> (16 * (3 - (w & 3))));
+			data[i * 2] = highByte(value);
+			data[i * 2 + 1] = lowByte(value);
+		}
+	}
+	else
+	{
+		const IEC_UINT *words = (segment->area == AREA_INT_OUTPUT) ? &image->int_output[segment->word] : &image->int_memory[segment->word];
+		for (int i = 0; i < segment->count; i++)
+		{
+			data[i * 2] = highByte(words[i]);
+			data[i * 2 + 1] = lowByte(words[i]);
+		}
+	}
+}
 
-		else if (i >= MIN_16B_RANGE && i <= MAX_16B_RANGE)
-        {
-			if (int_memory[i - MIN_16B_RANGE] == NULL)
-            {
-                int_memory[i - MIN_16B_RANGE] = &mb_holding_regs[i];
-            }
-        }
+//-----------------------------------------------------------------------------
+// Queue a write of count holding registers, big endian in data, one command
+// per segment. Returns a Modbus error code
+//-----------------------------------------------------------------------------
+int queueHoldingRegisters(int Start, int count, const unsigned char *data)
+{
+	HoldingSegment segments[4];
+	int nsegments = resolveHoldingRegisters(Start, count, segments);
+	if (nsegments < 0)
+	{
+		return ERR_ILLEGAL_DATA_ADDRESS;
+	}
+	if (count > IMAGE_WRITE_MAX_BYTES / 2)
+	{
+		return ERR_ILLEGAL_DATA_VALUE;
 	}
 
-	pthread_mutex_unlock(&bufferLock);
+	for (int s = 0; s < nsegments; s++)
+	{
+		uint16_t words[IMAGE_WRITE_MAX_BYTES / 2];
+		for (int k = 0; k < segments[s].count; k++)
+		{
+			words[k] = word(data[k * 2], data[k * 2 + 1]);
+		}
+		if (!image_queue_words(segments[s].area, segments[s].word, segments[s].count, words))
+		{
+			return ERR_SLAVE_DEVICE_BUSY;
+		}
+		data += segments[s].count * 2;
+	}
+	return ERR_NONE;
 }
 
 //-----------------------------------------------------------------------------
@@ -152,7 +228,6 @@ void ModbusError(unsigned char *buffer, int mb_error)
 void ReadCoils(unsigned char *buffer, int bufferSize)
 {
 	int Start, ByteDataLength, CoilDataLength;
-	int mb_error = ERR_NONE;
 
 	//this request must have at least 12 bytes. If it doesn't, it's a corrupted message
 	if (bufferSize < 12)
@@ -166,51 +241,31 @@ void ReadCoils(unsigned char *buffer, int bufferSize)
 	ByteDataLength = CoilDataLength / 8; //calculating the size of the message in bytes
 	if(ByteDataLength * 8 < CoilDataLength) ByteDataLength++;
 
-	//asked for too many coils
+	//asked for too many coils, or for invalid addresses
 	if (ByteDataLength > 255)
 	{
 		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
 		return;
 	}
+	if (Start + CoilDataLength > MAX_COILS)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
 
 	//preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < ByteDataLength ; i++)
-	{
-		for(int j = 0; j < 8; j++)
-		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_COILS)
-			{
-				if (bool_output[position/8][position%8] != NULL)
-				{
-					bitWrite(buffer[9 + i], j, *bool_output[position/8][position%8]);
-				}
-				else
-				{
-					bitWrite(buffer[9 + i], j, 0);
-				}
-			}
-			else //invalid address
-			{
-				mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-			}
-		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	uint32_t seq;
+	const ProcessImage *image;
+	do {
+		image = image_snapshot_begin(&seq);
+		image_pack_bits(&image->bool_output[Start], CoilDataLength, &buffer[9]);
+	} while (image_snapshot_retry(image, seq));
 
-	if (mb_error != ERR_NONE)
-	{
-		ModbusError(buffer, mb_error);
-	}
-	else
-	{
-		MessageLength = ByteDataLength + 9;
-	}
+	MessageLength = ByteDataLength + 9;
 }
 
 //-----------------------------------------------------------------------------
@@ -219,7 +274,6 @@ void ReadCoils(unsigned char *buffer, int bufferSize)
 void ReadDiscreteInputs(unsigned char *buffer, int bufferSize)
 {
 	int Start, ByteDataLength, InputDataLength;
-	int mb_error = ERR_NONE;
 
 	//this request must have at least 12 bytes. If it doesn't, it's a corrupted message
 	if (bufferSize < 12)
@@ -233,51 +287,31 @@ void ReadDiscreteInputs(unsigned char *buffer, int bufferSize)
 	ByteDataLength = InputDataLength / 8;
 	if(ByteDataLength * 8 < InputDataLength) ByteDataLength++;
 
-	//asked for too many inputs
+	//asked for too many inputs, or for invalid addresses
 	if (ByteDataLength > 255)
 	{
 		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
 		return;
 	}
+	if (Start + InputDataLength > MAX_DISCRETE_INPUT)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
 
 	//Preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < ByteDataLength ; i++)
-	{
-		for(int j = 0; j < 8; j++)
-		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_DISCRETE_INPUT)
-			{
-				if (bool_input[position/8][position%8] != NULL)
-				{
-					bitWrite(buffer[9 + i], j, *bool_input[position/8][position%8]);
-				}
-				else
-				{
-					bitWrite(buffer[9 + i], j, 0);
-				}
-			}
-			else //invalid address
-			{
-				mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-			}
-		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	uint32_t seq;
+	const ProcessImage *image;
+	do {
+		image = image_snapshot_begin(&seq);
+		image_pack_bits(&image->bool_input[Start], InputDataLength, &buffer[9]);
+	} while (image_snapshot_retry(image, seq));
 
-	if (mb_error != ERR_NONE)
-	{
-		ModbusError(buffer, mb_error);
-	}
-	else
-	{
-		MessageLength = ByteDataLength + 9;
-	}
+	MessageLength = ByteDataLength + 9;
 }
 
 //-----------------------------------------------------------------------------
@@ -286,7 +320,8 @@ void ReadDiscreteInputs(unsigned char *buffer, int bufferSize)
 void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 {
 	int Start, WordDataLength, ByteDataLength;
-	int mb_error = ERR_NONE;
+	HoldingSegment segments[4];
+	int nsegments;
 
 	//this request must have at least 12 bytes. If it doesn't, it's a corrupted message
 	if (bufferSize < 12)
@@ -299,8 +334,9 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 	WordDataLength = word(buffer[10],buffer[11]);
 	ByteDataLength = WordDataLength * 2;
 
-	//asked for too many registers
-	if (ByteDataLength > 255)
+	//asked for too many registers, or for invalid addresses
+	nsegments = resolveHoldingRegisters(Start, WordDataLength, segments);
+	if (ByteDataLength > 255 || nsegments < 0)
 	{
 		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
 		return;
@@ -311,114 +347,19 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < WordDataLength; i++)
-	{
-		int position = Start + i;
-		if (position <= MIN_16B_RANGE)
+	uint32_t seq;
+	const ProcessImage *image;
+	do {
+		image = image_snapshot_begin(&seq);
+		unsigned char *data = &buffer[9];
+		for (int s = 0; s < nsegments; s++)
 		{
-			if (int_output[position] != NULL)
-			{
-				buffer[ 9 + i * 2] = highByte(*int_output[position]);
-				buffer[10 + i * 2] = lowByte(*int_output[position]);
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = 0;
-				buffer[10 + i * 2] = 0;
-			}
+			readHoldingSegment(image, &segments[s], data);
+			data += segments[s].count * 2;
 		}
-		//accessing memory
-		//16-bit registers
-		else if (position >= MIN_16B_RANGE && position <= MAX_16B_RANGE)
-		{
-			if (int_memory[position - MIN_16B_RANGE] != NULL)
-			{
-				buffer[ 9 + i * 2] = highByte(*int_memory[position - MIN_16B_RANGE]);
-				buffer[10 + i * 2] = lowByte(*int_memory[position - MIN_16B_RANGE]);
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = 0;
-				buffer[10 + i * 2] = 0;
-			}
-		}
-		//32-bit registers
-		else if (position >= MIN_32B_RANGE && position <= MAX_32B_RANGE)
-		{
-			if (dint_memory[(position - MIN_32B_RANGE)/2] != NULL)
-			{
-				if ((position - MIN_32B_RANGE) % 2 == 0) //first word
-				{
-					uint16_t tempValue = (uint16_t)(*dint_memory[(position - MIN_32B_RANGE)/2] >> 16);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else //second word
-				{
-					uint16_t tempValue = (uint16_t)(*dint_memory[(position - MIN_32B_RANGE)/2] & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = mb_holding_regs[position];
-				buffer[10 + i * 2] = mb_holding_regs[position];
-			}
-		}
-		//64-bit registers
-		else if (position >= MIN_64B_RANGE && position <= MAX_64B_RANGE)
-		{
-			if (lint_memory[(position - MIN_64B_RANGE)/4] != NULL)
-			{
-				if ((position - MIN_64B_RANGE) % 4 == 0) //first word
-				{
-					uint16_t tempValue = (uint16_t)(*lint_memory[(position - MIN_64B_RANGE)/4] >> 48);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else if ((position - MIN_64B_RANGE) % 4 == 1)//second word
-				{
-					uint16_t tempValue = (uint16_t)((*lint_memory[(position - MIN_64B_RANGE)/4] >> 32) & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else if ((position - MIN_64B_RANGE) % 4 == 2)//third word
-				{
-					uint16_t tempValue = (uint16_t)((*lint_memory[(position - MIN_64B_RANGE)/4] >> 16) & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else if ((position - MIN_64B_RANGE) % 4 == 3)//fourth word
-				{
-					uint16_t tempValue = (uint16_t)(*lint_memory[(position - MIN_64B_RANGE)/4] & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = mb_holding_regs[position];
-				buffer[10 + i * 2] = mb_holding_regs[position];
-			}
-		}
-		//invalid address
-		else
-		{
-			mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	} while (image_snapshot_retry(image, seq));
 
-	if (mb_error != ERR_NONE)
-	{
-		ModbusError(buffer, mb_error);
-	}
-	else
-	{
-		MessageLength = ByteDataLength + 9;
-	}
+	MessageLength = ByteDataLength + 9;
 }
 
 //-----------------------------------------------------------------------------
@@ -427,7 +368,6 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 void ReadInputRegisters(unsigned char *buffer, int bufferSize)
 {
 	int Start, WordDataLength, ByteDataLength;
-	int mb_error = ERR_NONE;
 
 	//this request must have at least 12 bytes. If it doesn't, it's a corrupted message
 	if (bufferSize < 12)
@@ -440,50 +380,35 @@ void ReadInputRegisters(unsigned char *buffer, int bufferSize)
 	WordDataLength = word(buffer[10],buffer[11]);
 	ByteDataLength = WordDataLength * 2;
 
-	//asked for too many registers
+	//asked for too many registers, or for invalid addresses
 	if (ByteDataLength > 255)
 	{
 		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
 		return;
 	}
+	if (Start + WordDataLength > MAX_INP_REGS)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
 
 	//preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < WordDataLength; i++)
-	{
-		int position = Start + i;
-		if (position < MAX_INP_REGS)
+	uint32_t seq;
+	const ProcessImage *image;
+	do {
+		image = image_snapshot_begin(&seq);
+		for(int i = 0; i < WordDataLength; i++)
 		{
-			if (int_input[position] != NULL)
-			{
-				buffer[ 9 + i * 2] = highByte(*int_input[position]);
-				buffer[10 + i * 2] = lowByte(*int_input[position]);
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = 0;
-				buffer[10 + i * 2] = 0;
-			}
+			buffer[ 9 + i * 2] = highByte(image->int_input[Start + i]);
+			buffer[10 + i * 2] = lowByte(image->int_input[Start + i]);
 		}
-		else //invalid address
-		{
-			mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	} while (image_snapshot_retry(image, seq));
 
-	if (mb_error != ERR_NONE)
-	{
-		ModbusError(buffer, mb_error);
-	}
-	else
-	{
-		MessageLength = ByteDataLength + 9;
-	}
+	MessageLength = ByteDataLength + 9;
 }
 
 //-----------------------------------------------------------------------------
@@ -515,12 +440,10 @@ void WriteCoil(unsigned char *buffer, int bufferSize)
 			value = 0;
 		}
 
-		pthread_mutex_lock(&bufferLock);
-		if (bool_output[Start/8][Start%8] != NULL)
+		if (!image_queue_bits(AREA_BOOL_OUTPUT, Start, 1, &value))
 		{
-			*bool_output[Start/8][Start%8] = value;
+			mb_error = ERR_SLAVE_DEVICE_BUSY;
 		}
-		pthread_mutex_unlock(&bufferLock);
 	}
 
 	else //invalid address
@@ -556,86 +479,7 @@ void WriteRegister(unsigned char *buffer, int bufferSize)
 	}
 
 	Start = word(buffer[8],buffer[9]);
-
-	pthread_mutex_lock(&bufferLock);
-	//analog outputs
-	if (Start <= MIN_16B_RANGE)
-	{
-		if (int_output[Start] != NULL)
-		{
-			*int_output[Start] = word(buffer[10],buffer[11]);
-		}
-	}
-	//accessing memory
-	//16-bit registers
-	else if (Start >= MIN_16B_RANGE && Start <= MAX_16B_RANGE)
-	{
-		if (int_memory[Start - MIN_16B_RANGE] != NULL)
-		{
-			*int_memory[Start - MIN_16B_RANGE] = word(buffer[10],buffer[11]);
-		}
-	}
-	//32-bit registers
-	else if (Start >= MIN_32B_RANGE && Start <= MAX_32B_RANGE)
-	{
-		if (dint_memory[(Start - MIN_32B_RANGE)/2] != NULL)
-		{
-			uint32_t tempValue = (uint32_t)word(buffer[10],buffer[11]);
-
-			if ((Start - MIN_32B_RANGE) % 2 == 0) //first word
-			{
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] & 0x0000ffff;
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] | (tempValue << 16);
-			}
-			else //second word
-			{
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] & 0xffff0000;
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] | tempValue;
-			}
-		}
-		else
-		{
-			mb_holding_regs[Start] = word(buffer[10],buffer[11]);
-		}
-	}
-	//64-bit registers
-	else if (Start >= MIN_64B_RANGE && Start <= MAX_64B_RANGE)
-	{
-		if (lint_memory[(Start - MIN_64B_RANGE)/4] != NULL)
-		{
-			uint64_t tempValue = (uint64_t)word(buffer[10],buffer[11]);
-
-			if ((Start - MIN_64B_RANGE) % 4 == 0) //first word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0x0000ffffffffffff;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | (tempValue << 48);
-			}
-			else if ((Start - MIN_64B_RANGE) % 4 == 1) //second word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0xffff0000ffffffff;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | (tempValue << 32);
-			}
-			else if ((Start - MIN_64B_RANGE) % 4 == 2) //third word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0xffffffff0000ffff;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | (tempValue << 16);
-			}
-			else if ((Start - MIN_64B_RANGE) % 4 == 3) //fourth word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0xffffffffffff0000;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | tempValue;
-			}
-		}
-		else
-		{
-			mb_holding_regs[Start] = word(buffer[10],buffer[11]);
-		}
-	}
-	else //invalid address
-	{
-		mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-	}
-	pthread_mutex_unlock(&bufferLock);
+	mb_error = queueHoldingRegisters(Start, 1, &buffer[10]);
 
 	if (mb_error != ERR_NONE)
 	{
@@ -655,7 +499,6 @@ void WriteRegister(unsigned char *buffer, int bufferSize)
 void WriteMultipleCoils(unsigned char *buffer, int bufferSize)
 {
 	int Start, ByteDataLength, CoilDataLength;
-	int mb_error = ERR_NONE;
 
 	//this request must have at least 12 bytes. If it doesn't, it's a corrupted message
 	if (bufferSize < 12)
@@ -676,36 +519,23 @@ void WriteMultipleCoils(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
-	//preparing response
-	buffer[4] = 0;
-	buffer[5] = 6; //Number of bytes after this one.
-
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < ByteDataLength ; i++)
+	//invalid address
+	if (Start + CoilDataLength > MAX_COILS)
 	{
-		for(int j = 0; j < 8; j++)
-		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_COILS)
-			{
-				if (bool_output[position/8][position%8] != NULL) *bool_output[position/8][position%8] = bitRead(buffer[13 + i], j);
-			}
-			else //invalid address
-			{
-				mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-			}
-		}
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
 	}
-	pthread_mutex_unlock(&bufferLock);
 
-	if (mb_error != ERR_NONE)
+	if (!image_queue_bits(AREA_BOOL_OUTPUT, Start, CoilDataLength, &buffer[13]))
 	{
-		ModbusError(buffer, mb_error);
-	}
-	else
-	{
-		MessageLength = 12;
+		ModbusError(buffer, ERR_SLAVE_DEVICE_BUSY);
+		return;
 	}
+
+	//preparing response
+	buffer[4] = 0;
+	buffer[5] = 6; //Number of bytes after this one.
+	MessageLength = 12;
 }
 
 //-----------------------------------------------------------------------------
@@ -738,83 +568,7 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
 	buffer[4] = 0;
 	buffer[5] = 6; //Number of bytes after this one.
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < WordDataLength; i++)
-	{
-		int position = Start + i;
-		//analog outputs
-		if (position <= MIN_16B_RANGE)
-		{
-			if (int_output[position] != NULL) *int_output[position] =  word(buffer[13 + i * 2], buffer[14 + i * 2]);
-		}
-		//accessing memory
-		//16-bit registers
-		else if (position >= MIN_16B_RANGE && position <= MAX_16B_RANGE)
-		{
-			if (int_memory[position - MIN_16B_RANGE] != NULL) *int_memory[position - MIN_16B_RANGE] = word(buffer[13 + i * 2], buffer[14 + i * 2]);
-		}
-		//32-bit registers
-		else if (position >= MIN_32B_RANGE && position <= MAX_32B_RANGE)
-		{
-			if (dint_memory[(Start - MIN_32B_RANGE)/2] != NULL)
-			{
-				uint32_t tempValue = (uint32_t)word(buffer[13 + i * 2], buffer[14 + i * 2]);
-
-				if ((position - MIN_32B_RANGE) % 2 == 0) //first word
-				{
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] & 0x0000ffff;
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] | (tempValue << 16);
-				}
-				else //second word
-				{
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] & 0xffff0000;
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] | tempValue;
-				}
-			}
-			else
-			{
-				mb_holding_regs[position] = word(buffer[13 + i * 2], buffer[14 + i * 2]);
-			}
-		}
-		//64-bit registers
-		else if (position >= MIN_64B_RANGE && position <= MAX_64B_RANGE)
-		{
-			if (lint_memory[(position - MIN_64B_RANGE)/4] != NULL)
-			{
-				uint64_t tempValue = (uint64_t)word(buffer[13 + i * 2], buffer[14 + i * 2]);
-
-				if ((position - MIN_64B_RANGE) % 4 == 0) //first word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0x0000ffffffffffff;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | (tempValue << 48);
-				}
-				else if ((Start - MIN_64B_RANGE) % 4 == 1) //second word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0xffff0000ffffffff;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | (tempValue << 32);
-				}
-				else if ((Start - MIN_64B_RANGE) % 4 == 2) //third word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0xffffffff0000ffff;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | (tempValue << 16);
-				}
-				else if ((Start - MIN_64B_RANGE) % 4 == 3) //fourth word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0xffffffffffff0000;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | tempValue;
-				}
-			}
-			else
-			{
-				mb_holding_regs[Start] = word(buffer[10],buffer[11]);
-			}
-		}
-		else //invalid address
-		{
-			mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	mb_error = queueHoldingRegisters(Start, WordDataLength, &buffer[13]);
 
 	if (mb_error != ERR_NONE)
 	{
@@ -826,6 +580,81 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Implementation of Modbus/TCP Read/Write Multiple Registers. The write is
+// queued for the next scan cycle, so the registers it covers are answered
+// with the written values rather than from the snapshot
+//-----------------------------------------------------------------------------
+void ReadWriteMultipleRegisters(unsigned char *buffer, int bufferSize)
+{
+	int ReadStart, ReadLength, WriteStart, WriteLength;
+	HoldingSegment segments[4];
+	int nsegments, mb_error;
+	unsigned char values[250];
+
+	//this request must have at least 17 bytes. If it doesn't, it's a corrupted message
+	if (bufferSize < 17)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	ReadStart = word(buffer[8], buffer[9]);
+	ReadLength = word(buffer[10], buffer[11]);
+	WriteStart = word(buffer[12], buffer[13]);
+	WriteLength = word(buffer[14], buffer[15]);
+
+	//quantities out of range, or not all the bytes it wants to write
+	if (ReadLength < 1 || ReadLength > 125 || WriteLength < 1 || WriteLength > 121 ||
+		buffer[16] != WriteLength * 2 || bufferSize < 17 + WriteLength * 2)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	nsegments = resolveHoldingRegisters(ReadStart, ReadLength, segments);
+	if (nsegments < 0)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
+	//the write comes first
+	mb_error = queueHoldingRegisters(WriteStart, WriteLength, &buffer[17]);
+	if (mb_error != ERR_NONE)
+	{
+		ModbusError(buffer, mb_error);
+		return;
+	}
+
+	uint32_t seq;
+	const ProcessImage *image;
+	do {
+		image = image_snapshot_begin(&seq);
+		unsigned char *data = values;
+		for (int s = 0; s < nsegments; s++)
+		{
+			readHoldingSegment(image, &segments[s], data);
+			data += segments[s].count * 2;
+		}
+	} while (image_snapshot_retry(image, seq));
+
+	//registers both written and read
+	int from = (ReadStart > WriteStart) ? ReadStart : WriteStart;
+	int to = (ReadStart + ReadLength < WriteStart + WriteLength) ? ReadStart + ReadLength : WriteStart + WriteLength;
+	if (from < to)
+	{
+		memcpy(&values[(from - ReadStart) * 2], &buffer[17 + (from - WriteStart) * 2], (to - from) * 2);
+	}
+
+	//preparing response
+	buffer[4] = highByte(ReadLength * 2 + 3);
+	buffer[5] = lowByte(ReadLength * 2 + 3); //Number of bytes after this one
+	buffer[8] = ReadLength * 2;     //Number of bytes of data
+	memcpy(&buffer[9], values, ReadLength * 2);
+	MessageLength = ReadLength * 2 + 9;
+}
+
 //-----------------------------------------------------------------------------
 // This function must parse and process the client request and write back the
 // response for it. The return value is the size of the response message in
@@ -889,6 +718,12 @@ int processModbusMessage(unsigned char *buffer, int bufferSize)
 		WriteMultipleRegisters(buffer, bufferSize);
 	}
 
+	//************ Read/Write Multiple Registers ************
+	else if(buffer[7] == MB_FC_READ_WRITE_MULTIPLE_REGISTERS)
+	{
+		ReadWriteMultipleRegisters(buffer, bufferSize);
+	}
+
 	//****************** Function Code Error ******************
 	else
 	{
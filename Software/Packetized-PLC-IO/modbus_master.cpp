@@ -31,31 +31,82 @@
 #include <modbus.h>
 #include <errno.h>
 #include <string.h>
-#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
 
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "ladder.h"
+#include "process_image.h"
 
 #define MB_TCP                1
 #define MB_RTU                2
 #define MAX_MB_IO            400
+#define MAX_MB_BLOCKS          8    // address ranges per function and device
+#define MAX_MB_REQUESTS       64    // requests per device and poll
 
-using namespace std;
+#define MB_BOOL_BASE   (100 * 8)    // slave I/O starts at %IX100.0 / %QX100.0
+#define MB_INT_BASE          100    // and at %IW100 / %QW100
+
+//request sizes allowed by the Modbus specification
+#define MB_MAX_READ_BITS    2000
+#define MB_MAX_WRITE_BITS   1968
+#define MB_MAX_READ_REGS     125
+#define MB_MAX_WRITE_REGS    123
 
-uint8_t bool_input_buf[MAX_MB_IO];
-uint8_t bool_output_buf[MAX_MB_IO];
-uint16_t int_input_buf[MAX_MB_IO];
-uint16_t int_output_buf[MAX_MB_IO];
+#define MB_FRESH               4    // flag in MB_exchange::middle
 
-pthread_mutex_t ioLock;
+using namespace std;
 
+//list of address ranges, as in Input_Registers_Start = "0,20" with Input_Registers_Size = "10,4"
 struct MB_address
 {
+    uint16_t start_address[MAX_MB_BLOCKS];
+    uint16_t num_regs[MAX_MB_BLOCKS];
+    int num_starts;
+    int num_sizes;
+};
+
+//one Modbus request of a poll, reading or writing values[offset..offset+count)
+struct MB_request
+{
+    uint8_t function;
     uint16_t start_address;
     uint16_t num_regs;
+    uint16_t offset;
+};
+
+struct MB_values
+{
+    uint8_t bits[MAX_MB_IO];
+    uint16_t words[MAX_MB_IO];
+};
+
+//-----------------------------------------------------------------------------
+// Triple buffer between a polling worker and the scan. The writer fills its
+// back buffer and swaps it with the middle one; the reader swaps the middle
+// one with its front buffer when it holds something new. Neither side waits
+//-----------------------------------------------------------------------------
+struct MB_exchange
+{
+    MB_values buffer[3];
+    atomic<uint8_t> middle;
+    uint8_t back;
+    uint8_t front;
+};
+
+struct MB_stats
+{
+    atomic<uint64_t> polls;
+    atomic<uint64_t> errors;
+    atomic<uint64_t> reconnects;
+    atomic<uint64_t> latency_sum_us;
+    atomic<uint32_t> latency_last_us;
+    atomic<uint32_t> latency_max_us;
 };
 
 struct MB_device
@@ -71,19 +122,43 @@ struct MB_device
     int rtu_stop_bit;
     int rtu_tx_pause;
     uint8_t dev_id;
-    bool isConnected;
+    uint16_t poll_period;       // ms, the global Polling_Period unless set for the device
 
     struct MB_address discrete_inputs;
     struct MB_address coils;
     struct MB_address input_registers;
     struct MB_address holding_read_registers;
     struct MB_address holding_registers;
+
+    //where the device's values start in the slave I/O area, and how many
+    uint16_t bool_input_offset, bool_input_count;
+    uint16_t bool_output_offset, bool_output_count;
+    uint16_t int_input_offset, int_input_count;
+    uint16_t int_output_offset, int_output_count;
+
+    struct MB_request requests[MAX_MB_REQUESTS];
+    int num_requests;
+    uint64_t next_poll_ns;
+
+    struct MB_values inputs;        // latest values read, owned by the worker
+    struct MB_exchange to_scan;
+    struct MB_exchange from_scan;
+    struct MB_stats stats;
+};
+
+//a polling thread: one per TCP device, one per RTU port shared by its devices
+struct MB_worker
+{
+    vector<int> devices;
+    modbus_t *mb_ctx;
+    bool isConnected;
 };
 
 struct MB_device *mb_devices;
 uint8_t num_devices;
 uint16_t polling_period = 100;
 uint16_t timeout = 1000;
+vector<MB_worker *> mb_workers;
 
 //-----------------------------------------------------------------------------
 // Finds the data between the separators on the line provided
@@ -149,6 +224,36 @@ void getFunction(char *line, char *parameter)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Get a comma separated list of numbers between quotes, as in "0,100".
+// Returns how many were found
+//-----------------------------------------------------------------------------
+int getList(char *line, uint16_t *values, int max_values)
+{
+    char temp_buffer[100];
+    getData(line, temp_buffer, '"', '"');
+
+    int n = 0;
+    char *p = temp_buffer;
+    while (*p != '\0' && n < max_values)
+    {
+        values[n++] = atoi(p);
+        while (*p != ',' && *p != '\0') p++;
+        if (*p == ',') p++;
+    }
+    return n;
+}
+
+void printAddress(const char *name, struct MB_address *address)
+{
+    printf("%s:", name);
+    for (int i = 0; i < address->num_starts && i < address->num_sizes; i++)
+    {
+        printf(" %d+%d", address->start_address[i], address->num_regs[i]);
+    }
+    printf("\n");
+}
+
 void parseConfig()
 {
     string line;
@@ -168,7 +273,7 @@ void parseConfig()
                     getData(line_str, temp_buffer, '"', '"');
                     num_devices = atoi(temp_buffer);
                     //initializes the allocated memory to zero
-                    mb_devices = calloc(num_devices, sizeof(struct MB_device));
+                    mb_devices = new MB_device[num_devices]();
                 }
                 else if (!strncmp(line_str, "Polling_Period", 14))
                 {
@@ -197,7 +302,6 @@ void parseConfig()
                     {
                         char temp_buffer[5];
                         getData(line_str, temp_buffer, '"', '"');
-
                         if (!strncmp(temp_buffer, "TCP", 3))
                             mb_devices[deviceNumber].protocol = MB_TCP;
                         else if (!strncmp(temp_buffer, "RTU", 3))
@@ -249,65 +353,61 @@ void parseConfig()
                         getData(line_str, temp_buffer, '"', '"');
                         mb_devices[deviceNumber].rtu_tx_pause = atoi(temp_buffer);
                     }
-                    else if (!strncmp(functionType, "Discrete_Inputs_Start", 21))
+                    else if (!strncmp(functionType, "Polling_Period", 14))
                     {
                         char temp_buffer[10];
                         getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].discrete_inputs.start_address = atoi(temp_buffer);
+                        mb_devices[deviceNumber].poll_period = atoi(temp_buffer);
+                    }
+                    else if (!strncmp(functionType, "Discrete_Inputs_Start", 21))
+                    {
+                        struct MB_address *address = &mb_devices[deviceNumber].discrete_inputs;
+                        address->num_starts = getList(line_str, address->start_address, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Discrete_Inputs_Size", 20))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].discrete_inputs.num_regs = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].discrete_inputs;
+                        address->num_sizes = getList(line_str, address->num_regs, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Coils_Start", 11))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].coils.start_address = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].coils;
+                        address->num_starts = getList(line_str, address->start_address, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Coils_Size", 10))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].coils.num_regs = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].coils;
+                        address->num_sizes = getList(line_str, address->num_regs, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Input_Registers_Start", 21))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].input_registers.start_address = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].input_registers;
+                        address->num_starts = getList(line_str, address->start_address, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Input_Registers_Size", 20))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].input_registers.num_regs = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].input_registers;
+                        address->num_sizes = getList(line_str, address->num_regs, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Read_Start", 28))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_read_registers.start_address = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].holding_read_registers;
+                        address->num_starts = getList(line_str, address->start_address, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Read_Size", 27))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_read_registers.num_regs = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].holding_read_registers;
+                        address->num_sizes = getList(line_str, address->num_regs, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Start", 23))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_registers.start_address = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].holding_registers;
+                        address->num_starts = getList(line_str, address->start_address, MAX_MB_BLOCKS);
                     }
                     else if (!strncmp(functionType, "Holding_Registers_Size", 22))
                     {
-                        char temp_buffer[10];
-                        getData(line_str, temp_buffer, '"', '"');
-                        mb_devices[deviceNumber].holding_registers.num_regs = atoi(temp_buffer);
+                        struct MB_address *address = &mb_devices[deviceNumber].holding_registers;
+                        address->num_sizes = getList(line_str, address->num_regs, MAX_MB_BLOCKS);
                     }
                 }
             }
@@ -333,270 +433,252 @@ void parseConfig()
         printf("Parity: %c\n", mb_devices[i].rtu_parity);
         printf("Data Bits: %d\n", mb_devices[i].rtu_data_bit);
         printf("Stop Bits: %d\n", mb_devices[i].rtu_stop_bit);
-        printf("DI Start: %d\n", mb_devices[i].discrete_inputs.start_address);
-        printf("DI Size: %d\n", mb_devices[i].discrete_inputs.num_regs);
-        printf("Coils Start: %d\n", mb_devices[i].coils.start_address);
-        printf("Coils Size: %d\n", mb_devices[i].coils.num_regs);
-        printf("IR Start: %d\n", mb_devices[i].input_registers.start_address);
-        printf("IR Size: %d\n", mb_devices[i].input_registers.num_regs);
-        printf("HR Start: %d\n", mb_devices[i].holding_registers.start_address);
-        printf("HR Size: %d\n", mb_devices[i].holding_registers.num_regs);
+        printf("Polling Period: %d\n", mb_devices[i].poll_period);
+        printAddress("DI", &mb_devices[i].discrete_inputs);
+        printAddress("Coils", &mb_devices[i].coils);
+        printAddress("IR", &mb_devices[i].input_registers);
+        printAddress("HR Read", &mb_devices[i].holding_read_registers);
+        printAddress("HR", &mb_devices[i].holding_registers);
         printf("\n\n");
     }
     //*/
 }
 
-
 //-----------------------------------------------------------------------------
-// Thread to poll each slave device
+// Triple buffer operations. The writer fills exchangeBack() and calls
+// exchangePublish(); the reader calls exchangeTake() and reads the buffer it
+// returns, which holds the latest published values
 //-----------------------------------------------------------------------------
-void *querySlaveDevices(void *arg)
+void exchangeInit(struct MB_exchange *exchange)
 {
-    while (run_openplc)
+    exchange->back = 0;
+    exchange->middle.store(1);
+    exchange->front = 2;
+}
+
+struct MB_values *exchangeBack(struct MB_exchange *exchange)
+{
+    return &exchange->buffer[exchange->back];
+}
+
+void exchangePublish(struct MB_exchange *exchange)
+{
+    exchange->back = exchange->middle.exchange(exchange->back | MB_FRESH, memory_order_acq_rel) & 3;
+}
+
+struct MB_values *exchangeTake(struct MB_exchange *exchange, bool *fresh)
+{
+    *fresh = (exchange->middle.load(memory_order_relaxed) & MB_FRESH) != 0;
+    if (*fresh)
     {
-        unsigned char log_msg[1000];
-        
-        uint16_t bool_input_index = 0;
-        uint16_t bool_output_index = 0;
-        uint16_t int_input_index = 0;
-        uint16_t int_output_index = 0;
+        exchange->front = exchange->middle.exchange(exchange->front, memory_order_acq_rel) & 3;
+    }
+    return &exchange->buffer[exchange->front];
+}
+
+uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-        for (int i = 0; i < num_devices; i++)
+//-----------------------------------------------------------------------------
+// Turn the configured ranges of one function into requests. Ranges that
+// continue each other on the slave are merged, and the result is split at
+// the largest request the function allows. Values are laid out in the slave
+// I/O area in the configured order, from *offset on
+//-----------------------------------------------------------------------------
+void planRequests(struct MB_device *device, struct MB_address *address, uint8_t function, int limit, uint16_t *offset)
+{
+    unsigned char log_msg[1000];
+    int num_blocks = (address->num_starts < address->num_sizes) ? address->num_starts : address->num_sizes;
+
+    for (int i = 0; i < num_blocks;)
+    {
+        int start = address->start_address[i];
+        int count = address->num_regs[i];
+        for (i++; i < num_blocks && address->start_address[i] == start + count; i++)
         {
-            //Check if there is a connected RTU device using the same port
-            bool found_sharing = false;
-            bool rtu_port_connected = false;
-            if (mb_devices[i].protocol == MB_RTU)
-            {
-                for (int a = 0; a < num_devices; a++)
-                {
-                    if (a != i && !strcmp(mb_devices[i].dev_address, mb_devices[a].dev_address))
-                    {
-                        found_sharing = true;
-                        if (mb_devices[a].isConnected)
-                        {
-                            rtu_port_connected = true;
-                        }
-                    }
-                }
-                if (found_sharing)
-                {
-                    //Must reset mb context to current device's slave id
-                    modbus_set_slave(mb_devices[i].mb_ctx, mb_devices[i].dev_id);
-                }
-            }
+            count += address->num_regs[i];
+        }
 
-            //Verify if device is connected
-            if (!mb_devices[i].isConnected && !rtu_port_connected)
+        for (int done = 0; done < count;)
+        {
+            int n = (count - done < limit) ? count - done : limit;
+            if (*offset + n > MAX_MB_IO || device->num_requests == MAX_MB_REQUESTS)
             {
-                sprintf(log_msg, "Device %s is disconnected. Attempting to reconnect...\n", mb_devices[i].dev_name);
+                sprintf(log_msg, "MB device %s: registers from %d on do not fit in the slave I/O area and are not polled\n", device->dev_name, start + done);
                 log(log_msg);
-                if (modbus_connect(mb_devices[i].mb_ctx) == -1)
-                {
-
-                    sprintf(log_msg, "Connection failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                    log(log_msg);
-                    
-                    if (special_functions[2] != NULL) *special_functions[2]++;
-                    
-                    // Because this device is not connected, we skip those input registers
-                    bool_input_index += (mb_devices[i].discrete_inputs.num_regs);
-                    int_input_index += (mb_devices[i].input_registers.num_regs);
-                    int_input_index += (mb_devices[i].holding_read_registers.num_regs);
-                    bool_output_index += (mb_devices[i].coils.num_regs);
-                    int_output_index += (mb_devices[i].holding_registers.num_regs);
-                }
-                else
-                {
-                    sprintf(log_msg, "Connected to MB device %s\n", mb_devices[i].dev_name);
-                    log(log_msg);
-                    mb_devices[i].isConnected = true;
-                }
+                return;
             }
-            if (mb_devices[i].isConnected || rtu_port_connected)
-            {
-
-                struct timespec ts;
-                ts.tv_sec = 0;
-                ts.tv_nsec = (1000*1000*1000*28)/mb_devices[i].rtu_baud;
-
-                //Read discrete inputs
-                if (mb_devices[i].discrete_inputs.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint8_t *tempBuff;
-                    tempBuff = (uint8_t *)malloc(mb_devices[i].discrete_inputs.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_input_bits(mb_devices[i].mb_ctx, mb_devices[i].discrete_inputs.start_address,
-                                                            mb_devices[i].discrete_inputs.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Read Discrete Input Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        bool_input_index += (mb_devices[i].discrete_inputs.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            bool_input_buf[bool_input_index] = tempBuff[j];
-                            bool_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
+            struct MB_request *request = &device->requests[device->num_requests++];
+            request->function = function;
+            request->start_address = start + done;
+            request->num_regs = n;
+            request->offset = *offset;
+            *offset += n;
+            done += n;
+        }
+    }
+}
 
-                    free(tempBuff);
-                }
+//-----------------------------------------------------------------------------
+// Poll one device: run its requests in order, hand the inputs read to the
+// scan and record the latency. A failed TCP request drops the connection and
+// ends the poll, since the following requests would fail too
+//-----------------------------------------------------------------------------
+void pollDevice(struct MB_worker *worker, struct MB_device *device)
+{
+    unsigned char log_msg[1000];
 
-                //Write coils
-                if (mb_devices[i].coils.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint8_t *tempBuff;
-                    tempBuff = (uint8_t *)malloc(mb_devices[i].coils.num_regs);
+    if (device->protocol == MB_RTU)
+    {
+        //the port may be shared with other slaves
+        modbus_set_slave(worker->mb_ctx, device->dev_id);
+    }
 
-                    pthread_mutex_lock(&ioLock);
-                    for (int j = 0; j < mb_devices[i].coils.num_regs; j++)
-                    {
-                        tempBuff[j] = bool_output_buf[bool_output_index];
-                        bool_output_index++;
-                    }
-                    pthread_mutex_unlock(&ioLock);
+    //Verify if device is connected
+    if (!worker->isConnected)
+    {
+        sprintf(log_msg, "Device %s is disconnected. Attempting to reconnect...\n", device->dev_name);
+        log(log_msg);
+        if (modbus_connect(worker->mb_ctx) == -1)
+        {
+            sprintf(log_msg, "Connection failed on MB device %s: %s\n", device->dev_name, modbus_strerror(errno));
+            log(SEV_ERROR, log_msg);
+            device->stats.errors++;
+            return;
+        }
+        sprintf(log_msg, "Connected to MB device %s\n", device->dev_name);
+        log(log_msg);
+        device->stats.reconnects++;
+        worker->isConnected = true;
+    }
 
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_write_bits(mb_devices[i].mb_ctx, mb_devices[i].coils.start_address, mb_devices[i].coils.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-
-                        sprintf(log_msg, "Modbus Write Coils failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    
-                    free(tempBuff);
-                }
+    bool fresh;
+    struct MB_values *outputs = exchangeTake(&device->from_scan, &fresh);
+    struct timespec silence;
+    silence.tv_sec = 0;
+    silence.tv_nsec = (device->protocol == MB_RTU && device->rtu_baud > 0) ? 28000000000LL / device->rtu_baud : 0;
+    uint64_t started = monotonicNs();
 
-                //Read input registers
-                if (mb_devices[i].input_registers.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].input_registers.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_input_registers(    mb_devices[i].mb_ctx, mb_devices[i].input_registers.start_address,
-                                                                    mb_devices[i].input_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Read Input Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        int_input_index += (mb_devices[i].input_registers.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            int_input_buf[int_input_index] = tempBuff[j];
-                            int_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
+    for (int r = 0; r < device->num_requests; r++)
+    {
+        struct MB_request *request = &device->requests[r];
+        const char *name;
+        int return_val;
 
-                    free(tempBuff);
-                }
+        if (device->protocol == MB_RTU)
+        {
+            sleepms(device->rtu_tx_pause);
+            nanosleep(&silence, NULL);
+        }
 
-                //Read holding registers
-                if (mb_devices[i].holding_read_registers.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].holding_read_registers.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_registers(mb_devices[i].mb_ctx, mb_devices[i].holding_read_registers.start_address,
-                                                           mb_devices[i].holding_read_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        sprintf(log_msg, "Modbus Read Holding Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        int_input_index += (mb_devices[i].holding_read_registers.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            int_input_buf[int_input_index] = tempBuff[j];
-                            int_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
+        switch (request->function)
+        {
+            case MODBUS_FC_READ_DISCRETE_INPUTS:
+                name = "Read Discrete Inputs";
+                return_val = modbus_read_input_bits(worker->mb_ctx, request->start_address, request->num_regs, &device->inputs.bits[request->offset]);
+                break;
+            case MODBUS_FC_WRITE_MULTIPLE_COILS:
+                name = "Write Coils";
+                return_val = modbus_write_bits(worker->mb_ctx, request->start_address, request->num_regs, &outputs->bits[request->offset]);
+                break;
+            case MODBUS_FC_READ_INPUT_REGISTERS:
+                name = "Read Input Registers";
+                return_val = modbus_read_input_registers(worker->mb_ctx, request->start_address, request->num_regs, &device->inputs.words[request->offset]);
+                break;
+            case MODBUS_FC_READ_HOLDING_REGISTERS:
+                name = "Read Holding Registers";
+                return_val = modbus_read_registers(worker->mb_ctx, request->start_address, request->num_regs, &device->inputs.words[request->offset]);
+                break;
+            default:
+                name = "Write Holding Registers";
+                return_val = modbus_write_registers(worker->mb_ctx, request->start_address, request->num_regs, &outputs->words[request->offset]);
+                break;
+        }
 
-                    free(tempBuff);
-                }
+        if (return_val == -1)
+        {
+            sprintf(log_msg, "Modbus %s failed on MB device %s: %s\n", name, device->dev_name, modbus_strerror(errno));
+            log(SEV_ERROR, log_msg);
+            device->stats.errors++;
+            if (device->protocol != MB_RTU)
+            {
+                modbus_close(worker->mb_ctx);
+                worker->isConnected = false;
+                break;
+            }
+        }
+    }
 
-                //Write holding registers
-                if (mb_devices[i].holding_registers.num_regs != 0)
-                {
-                    sleepms(mb_devices[i].rtu_tx_pause);
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].holding_registers.num_regs);
+    //hand the inputs to the scan, keeping the last good values of failed requests
+    struct MB_values *values = exchangeBack(&device->to_scan);
+    memcpy(&values->bits[device->bool_input_offset], &device->inputs.bits[device->bool_input_offset], device->bool_input_count);
+    memcpy(&values->words[device->int_input_offset], &device->inputs.words[device->int_input_offset], device->int_input_count * 2);
+    exchangePublish(&device->to_scan);
+
+    uint32_t latency_us = (uint32_t)((monotonicNs() - started) / 1000);
+    device->stats.polls++;
+    device->stats.latency_sum_us += latency_us;
+    device->stats.latency_last_us = latency_us;
+    if (latency_us > device->stats.latency_max_us) device->stats.latency_max_us = latency_us;
+}
 
-                    pthread_mutex_lock(&ioLock);
-                    for (int j = 0; j < mb_devices[i].holding_registers.num_regs; j++)
-                    {
-                        tempBuff[j] = int_output_buf[int_output_index];
-                        int_output_index++;
-                    }
-                    pthread_mutex_unlock(&ioLock);
+//-----------------------------------------------------------------------------
+// Thread of a worker. Polls each of its devices at the device's own period,
+// sleeping until the next one is due, so a slave that does not answer only
+// delays the devices on the same connection
+//-----------------------------------------------------------------------------
+void *pollDevices(void *arg)
+{
+    struct MB_worker *worker = (struct MB_worker *)arg;
 
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_write_registers(mb_devices[i].mb_ctx, mb_devices[i].holding_registers.start_address,
-                                                            mb_devices[i].holding_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Write Holding Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    
-                    free(tempBuff);
-                }
+    thread_policy_apply("modbus_master");
+    while (run_openplc)
+    {
+        uint64_t wake = UINT64_MAX;
+        for (size_t i = 0; i < worker->devices.size(); i++)
+        {
+            struct MB_device *device = &mb_devices[worker->devices[i]];
+            uint64_t now = monotonicNs();
+            if (now >= device->next_poll_ns)
+            {
+                pollDevice(worker, device);
+                device->next_poll_ns += device->poll_period * 1000000ULL;
+                now = monotonicNs();
+                if (device->next_poll_ns < now) device->next_poll_ns = now; //fell behind, do not try to catch up
             }
+            if (device->next_poll_ns < wake) wake = device->next_poll_ns;
         }
-        sleepms(polling_period);
+
+        struct timespec ts;
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Per device poll statistics, one line per device, for the interactive server
+//-----------------------------------------------------------------------------
+int mb_format_stats(char *buf, int size)
+{
+    int len = 0;
+    for (int i = 0; i < num_devices && len < size; i++)
+    {
+        struct MB_stats *stats = &mb_devices[i].stats;
+        uint64_t polls = stats->polls.load(memory_order_relaxed);
+        len += snprintf(buf + len, size - len, "device %s polls %" PRIu64 " errors %" PRIu64 " reconnects %" PRIu64
+            " latency_us last %u mean %" PRIu64 " max %u\n", mb_devices[i].dev_name, polls,
+            stats->errors.load(memory_order_relaxed), stats->reconnects.load(memory_order_relaxed),
+            stats->latency_last_us.load(memory_order_relaxed),
+            polls ? stats->latency_sum_us.load(memory_order_relaxed) / polls : 0,
+            stats->latency_max_us.load(memory_order_relaxed));
     }
+    return len < size ? len : size - 1;
 }
 
 //-----------------------------------------------------------------------------
@@ -607,62 +689,96 @@ void initializeMB()
 {
     parseConfig();
 
+    uint16_t bool_input_index = 0;
+    uint16_t bool_output_index = 0;
+    uint16_t int_input_index = 0;
+    uint16_t int_output_index = 0;
+
     for (int i = 0; i < num_devices; i++)
     {
-        if (mb_devices[i].protocol == MB_TCP)
+        struct MB_device *device = &mb_devices[i];
+        struct MB_worker *worker = NULL;
+
+        if (device->protocol == MB_TCP)
         {
-            mb_devices[i].mb_ctx = modbus_new_tcp(mb_devices[i].dev_address, mb_devices[i].ip_port);
+            device->mb_ctx = modbus_new_tcp(device->dev_address, device->ip_port);
         }
-        else if (mb_devices[i].protocol == MB_RTU)
+        else if (device->protocol == MB_RTU)
         {
             //Check if there is a device using the same port
-            int share_index = -1;
-            for (int a = 0; a < num_devices && a < i; a++)
+            for (size_t w = 0; w < mb_workers.size(); w++)
             {
-                if (strcmp(mb_devices[i].dev_address, mb_devices[a].dev_address) == 0)
+                struct MB_device *first = &mb_devices[mb_workers[w]->devices[0]];
+                if (first->protocol == MB_RTU && strcmp(device->dev_address, first->dev_address) == 0)
                 {
-                    share_index = a;
+                    worker = mb_workers[w];
                     break;
                 }
             }
-            if (share_index != -1)
+            if (worker != NULL)
             {
-                if (mb_devices[i].rtu_baud != mb_devices[share_index].rtu_baud || mb_devices[i].rtu_parity != mb_devices[share_index].rtu_parity || 
-                    mb_devices[i].rtu_data_bit != mb_devices[share_index].rtu_data_bit || mb_devices[i].rtu_stop_bit != mb_devices[share_index].rtu_stop_bit)
+                struct MB_device *first = &mb_devices[worker->devices[0]];
+                if (device->rtu_baud != first->rtu_baud || device->rtu_parity != first->rtu_parity ||
+                    device->rtu_data_bit != first->rtu_data_bit || device->rtu_stop_bit != first->rtu_stop_bit)
                 {
                     unsigned char log_msg[1000];
-                    sprintf(log_msg, "Warning MB device %s port setting missmatch\n", mb_devices[i].dev_name);
-                    log(log_msg);
+                    sprintf(log_msg, "Warning MB device %s port setting missmatch\n", device->dev_name);
+                    log(SEV_WARNING, log_msg);
                 }
-                mb_devices[i].mb_ctx = mb_devices[share_index].mb_ctx;
+                device->mb_ctx = worker->mb_ctx;
             }
             else
             {
-                mb_devices[i].mb_ctx = modbus_new_rtu(mb_devices[i].dev_address, mb_devices[i].rtu_baud,
-                                                mb_devices[i].rtu_parity, mb_devices[i].rtu_data_bit,
-                                                mb_devices[i].rtu_stop_bit);
+                device->mb_ctx = modbus_new_rtu(device->dev_address, device->rtu_baud,
+                                                device->rtu_parity, device->rtu_data_bit,
+                                                device->rtu_stop_bit);
             }
         }
-        
-        //slave id
 
-        modbus_set_slave(mb_devices[i].mb_ctx, mb_devices[i].dev_id);
+        if (worker == NULL)
+        {
+            worker = new MB_worker();
+            worker->mb_ctx = device->mb_ctx;
+            worker->isConnected = false;
+            mb_workers.push_back(worker);
+        }
+        worker->devices.push_back(i);
 
+        //slave id
+        modbus_set_slave(device->mb_ctx, device->dev_id);
 
         //timeout
         uint32_t to_sec = timeout / 1000;
         uint32_t to_usec = (timeout % 1000) * 1000;
-        modbus_set_response_timeout(mb_devices[i].mb_ctx, to_sec, to_usec);
-        
+        modbus_set_response_timeout(device->mb_ctx, to_sec, to_usec);
+
+        //requests, in the order the slave I/O area has always been laid out
+        device->bool_input_offset = bool_input_index;
+        device->bool_output_offset = bool_output_index;
+        device->int_input_offset = int_input_index;
+        device->int_output_offset = int_output_index;
+        planRequests(device, &device->discrete_inputs, MODBUS_FC_READ_DISCRETE_INPUTS, MB_MAX_READ_BITS, &bool_input_index);
+        planRequests(device, &device->coils, MODBUS_FC_WRITE_MULTIPLE_COILS, MB_MAX_WRITE_BITS, &bool_output_index);
+        planRequests(device, &device->input_registers, MODBUS_FC_READ_INPUT_REGISTERS, MB_MAX_READ_REGS, &int_input_index);
+        planRequests(device, &device->holding_read_registers, MODBUS_FC_READ_HOLDING_REGISTERS, MB_MAX_READ_REGS, &int_input_index);
+        planRequests(device, &device->holding_registers, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, MB_MAX_WRITE_REGS, &int_output_index);
+        device->bool_input_count = bool_input_index - device->bool_input_offset;
+        device->bool_output_count = bool_output_index - device->bool_output_offset;
+        device->int_input_count = int_input_index - device->int_input_offset;
+        device->int_output_count = int_output_index - device->int_output_offset;
+
+        if (device->poll_period == 0) device->poll_period = polling_period;
+        exchangeInit(&device->to_scan);
+        exchangeInit(&device->from_scan);
     }
     
     //Initialize comm error counter
     if (special_functions[2] != NULL) *special_functions[2] = 0;
     
-    if (num_devices > 0)
+    for (size_t w = 0; w < mb_workers.size(); w++)
     {
         pthread_t thread;
-        int ret = pthread_create(&thread, NULL, querySlaveDevices, NULL);
+        int ret = pthread_create(&thread, NULL, pollDevices, mb_workers[w]);
         if (ret==0) 
         {
             pthread_detach(thread);
@@ -676,15 +792,22 @@ void initializeMB()
 //-----------------------------------------------------------------------------
 void updateBuffersIn_MB()
 {
-    pthread_mutex_lock(&ioLock);
+    uint64_t errors = 0;
 
-    for (int i = 0; i < MAX_MB_IO; i++)
+    for (int i = 0; i < num_devices; i++)
     {
-        if (bool_input[100+(i/8)][i%8] != NULL) *bool_input[100+(i/8)][i%8] = bool_input_buf[i];
-        if (int_input[100+i] != NULL) *int_input[100+i] = int_input_buf[i];
+        struct MB_device *device = &mb_devices[i];
+        errors += device->stats.errors.load(memory_order_relaxed);
+
+        bool fresh;
+        struct MB_values *values = exchangeTake(&device->to_scan, &fresh);
+        if (!fresh) continue;
+
+        memcpy(&plc_image.bool_input[MB_BOOL_BASE + device->bool_input_offset], &values->bits[device->bool_input_offset], device->bool_input_count);
+        memcpy(&plc_image.int_input[MB_INT_BASE + device->int_input_offset], &values->words[device->int_input_offset], device->int_input_count * 2);
     }
 
-    pthread_mutex_unlock(&ioLock);
+    if (num_devices > 0 && special_functions[2] != NULL) *special_functions[2] = errors;
 }
 
 
@@ -694,13 +817,14 @@ void updateBuffersIn_MB()
 //-----------------------------------------------------------------------------
 void updateBuffersOut_MB()
 {
-    pthread_mutex_lock(&ioLock);
-
-    for (int i = 0; i < MAX_MB_IO; i++)
+    for (int i = 0; i < num_devices; i++)
     {
-        if (bool_output[100+(i/8)][i%8] != NULL) bool_output_buf[i] = *bool_output[100+(i/8)][i%8];
-        if (int_output[100+i] != NULL) int_output_buf[i] = *int_output[100+i];
-    }
+        struct MB_device *device = &mb_devices[i];
+        if (device->bool_output_count == 0 && device->int_output_count == 0) continue;
 
-    pthread_mutex_unlock(&ioLock);
+        struct MB_values *values = exchangeBack(&device->from_scan);
+        memcpy(&values->bits[device->bool_output_offset], &plc_image.bool_output[MB_BOOL_BASE + device->bool_output_offset], device->bool_output_count);
+        memcpy(&values->words[device->int_output_offset], &plc_image.int_output[MB_INT_BASE + device->int_output_offset], device->int_output_count * 2);
+        exchangePublish(&device->from_scan);
+    }
 }
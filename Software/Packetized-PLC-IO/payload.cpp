@@ -0,0 +1,104 @@
+//-----------------------------------------------------------------------------
+// Process-image payload of packetized I/O streams. The payload points a flow
+// declares in schedule.json are turned at startup into a flat copy plan, so
+// per cycle a stream is decoded into the input image, or encoded from the
+// output image, by one pass over a short array of bit and word copies.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ladder.h"
+#include "payload.h"
+#include "process_image.h"
+
+bool payload_build_plan(const std::vector<PayloadPoint>& points, CopyPlan *plan)
+{
+	plan->ops.clear();
+	plan->bool_bytes = 0;
+	plan->size = 0;
+
+	int bools = 0;
+	for (size_t i = 0; i < points.size(); i++) {
+		if (points[i].type == PAYLOAD_BOOL) bools++;
+	}
+	plan->bool_bytes = (bools + 7) / 8;
+
+	int bit = 0, offset = plan->bool_bytes;
+	for (size_t i = 0; i < points.size(); i++) {
+		const PayloadPoint& point = points[i];
+		CopyOp op;
+		if (point.type == PAYLOAD_BOOL) {
+			if (point.index >= BUFFER_SIZE * 8) {
+				printf("Payload bool point %%X%d.%d is out of the process image\n", point.index / 8, point.index % 8);
+				return false;
+			}
+			if (point.index == PAYLOAD_RESERVED_BIT) {
+				printf("Payload bool point %%X0.0 is reserved for the cycle release\n");
+				return false;
+			}
+			op.op = COPY_BIT;
+			op.offset = bit / 8;
+			op.bit = bit % 8;
+			op.index = point.index;
+			plan->ops.push_back(op);
+			bit++;
+			continue;
+		}
+
+		int words = (point.type == PAYLOAD_INT) ? 1 : 2;
+		if (point.index + words > BUFFER_SIZE) {
+			printf("Payload word point %%W%d is out of the process image\n", point.index);
+			return false;
+		}
+		for (int w = 0; w < words; w++) {
+			op.op = COPY_WORD;
+			op.bit = 0;
+			op.offset = offset;
+			op.index = point.index + w;
+			plan->ops.push_back(op);
+			offset += 2;
+		}
+	}
+
+	if (offset > PACKET_PAYLOAD_MAX) {
+		printf("Payload of %d bytes exceeds PACKET_PAYLOAD_MAX (%d)\n", offset, PACKET_PAYLOAD_MAX);
+		return false;
+	}
+	plan->size = offset;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Copy a received payload into the input image. Must be called with bufferLock
+//-----------------------------------------------------------------------------
+void payload_decode(const CopyPlan& plan, const uint8_t *payload)
+{
+	const CopyOp *op = plan.ops.data();
+	const CopyOp *end = op + plan.ops.size();
+	for (; op != end; op++) {
+		if (op->op == COPY_BIT)
+			plc_image.bool_input[op->index] = (payload[op->offset] >> op->bit) & 1;
+		else
+			plc_image.int_input[op->index] = ((IEC_UINT)payload[op->offset] << 8) | payload[op->offset + 1];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Fill a payload from the output image. Must be called with bufferLock
+//-----------------------------------------------------------------------------
+void payload_encode(const CopyPlan& plan, uint8_t *payload)
+{
+	memset(payload, 0, plan.bool_bytes);
+	const CopyOp *op = plan.ops.data();
+	const CopyOp *end = op + plan.ops.size();
+	for (; op != end; op++) {
+		if (op->op == COPY_BIT) {
+			if (plc_image.bool_output[op->index]) payload[op->offset] |= (uint8_t)(1 << op->bit);
+		} else {
+			IEC_UINT value = plc_image.int_output[op->index];
+			payload[op->offset] = (uint8_t)(value >> 8);
+			payload[op->offset + 1] = (uint8_t)value;
+		}
+	}
+}
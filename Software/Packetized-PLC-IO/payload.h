@@ -0,0 +1,38 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "config.h"
+
+/* payload bytes after the 42-byte packet header a stream may carry */
+#define PACKET_PAYLOAD_MAX 64
+
+/* %IX0.0 is set when a cycle is released, so no payload bool may map bit 0 */
+#define PAYLOAD_RESERVED_BIT 0
+
+#define COPY_BIT  0
+#define COPY_WORD 1
+
+/* One step of a copy plan: a bit, or a 16-bit big-endian word, between the payload and the process image */
+struct CopyOp {
+	uint8_t op;        // COPY_BIT or COPY_WORD
+	uint8_t bit;       // COPY_BIT: bit in the payload byte, LSB first
+	uint16_t offset;   // byte offset in the payload
+	uint16_t index;    // bool_input/bool_output bit address or int_input/int_output word address
+};
+
+/* Payload layout of a stream: its bools packed into bits in declaration order, then
+ * its INT words and DINT/REAL double words (high word first), big endian.
+ */
+struct CopyPlan {
+	std::vector<CopyOp> ops;
+	int bool_bytes;    // leading bytes holding the packed bools
+	int size;          // payload bytes, 0 for streams without payload points
+};
+
+bool payload_build_plan(const std::vector<PayloadPoint>& points, CopyPlan *plan);
+void payload_decode(const CopyPlan& plan, const uint8_t *payload);
+void payload_encode(const CopyPlan& plan, uint8_t *payload);
+#endif
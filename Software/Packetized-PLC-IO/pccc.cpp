@@ -31,6 +31,7 @@
 #include <math.h>
 
 #include "ladder.h"
+#include "process_image.h"
 
 //--------------------------------------------------------------Defines--------------------------------------------------------------------------------//
 
@@ -219,7 +220,7 @@ uint16_t Protected_Logical_Read_Reply(pccc_header header, unsigned char *buffer,
 		unsigned char log_msg[1000];
 		unsigned char *p = log_msg;
 		sprintf(log_msg, "PCCC: Error occured while processing Protected Logical Read\n");
-		log(log_msg); 
+		log(SEV_ERROR, log_msg); 
 		return -1;
 	}//return length as -1 to signify that the CMD Code/Function Code was not recognize
 	
@@ -309,32 +310,28 @@ void Pccc_ReadCoils(unsigned char *buffer, int buffer_size) //Working QX Read
 	Start = word_pccc(buffer[8],buffer[9]); //Start based on the Element and Subelemnt values in the Command Packet
 	Mask = log2( word_pccc(buffer[10],buffer[11]) ); //Save the byte size or byte data length to the variable from the command packet
 	ByteDataLength = buffer[5];
-	pthread_mutex_lock(&bufferLock);
+	uint32_t seq;
+	const ProcessImage *image;
 	
-	/*----Reading the values from the PLC bool_output buffer and writing to the PCCC buffer based on position----*/
-	for (int i = 0; i < ByteDataLength; i++)
-	{
-		for(int j = 0; j < 8; j++)
+	/*----Reading the values from the published bool_output image and writing to the PCCC buffer based on position----*/
+	do {
+		image = image_snapshot_begin(&seq);
+		for (int i = 0; i < ByteDataLength; i++)
 		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_COILS)
+			for(int j = 0; j < 8; j++)
 			{
-				if(bool_output[position/8][position%8] != NULL)
+				int position = Start + i * 8 + j;
+				if (position < MAX_COILS)
 				{
-					bitWrite(buffer[4+i], j, *bool_output[position/8][position%8]);
+					bitWrite(buffer[4+i], j, image->bool_output[position]);
 				}
 				else
 				{
-					bitWrite(buffer[4+i],j,0);
+					//PCCC Error Handling (Fill in?); If the position is greater than the MAX COILS, ERROR Overflow?
 				}
 			}
-			else
-			{
-				//PCCC Error Handling (Fill in?); If the position is greater than the MAX COILS, ERROR Overflow?
-			}
 		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	} while (image_snapshot_retry(image, seq));
 	
 	/*Left in for future error handling setup*/
 	/*if (pccc_error != ERR_NONE)
@@ -358,32 +355,28 @@ void Pccc_ReadDiscreteInputs(unsigned char *buffer, int buffer_size) //Working I
 	
 	Start = word_pccc(buffer[8],buffer[9]);//Start based on the Element and Subelemnt values in the Command Packet
 	ByteDataLength = buffer[5];//Save the byte size or byte data length to the variable from the command packet
-	pthread_mutex_lock(&bufferLock);
+	uint32_t seq;
+	const ProcessImage *image;
 	
-	/*--------Reading the values from the PLC bool_input buffer and writing to the PCCC buffer based on position--------*/
-	for (int i = 0; i < ByteDataLength; i++)
-	{
-		for(int j = 0; j < 8; j++)
+	/*--------Reading the values from the published bool_input image and writing to the PCCC buffer based on position--------*/
+	do {
+		image = image_snapshot_begin(&seq);
+		for (int i = 0; i < ByteDataLength; i++)
 		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_DISCRETE_INPUT)
+			for(int j = 0; j < 8; j++)
 			{
-				if(bool_input[position/8][position%8] != NULL)
+				int position = Start + i * 8 + j;
+				if (position < MAX_DISCRETE_INPUT)
 				{
-					bitWrite(buffer[4+i], j, *bool_input[position/8][position%8]);
+					bitWrite(buffer[4+i], j, image->bool_input[position]);
 				}
 				else
 				{
-					bitWrite(buffer[4+i],j,0);
+					//PCCC Error Handling (Fill in?); If the position is greater than the MAX, ERROR Overflow?
 				}
 			}
-			else
-			{
-				//PCCC Error Handling (Fill in?); If the position is greater than the MAX, ERROR Overflow?
-			}
 		}
-	}
-	pthread_mutex_unlock(&bufferLock);
+	} while (image_snapshot_retry(image, seq));
 	
 	/*Left in for future error handling setup*/
 	/*if (mb_error != ERR_NONE)
@@ -419,61 +412,47 @@ void Pccc_ReadHoldingRegisters(unsigned char *buffer, int buffer_size) // QW Rea
 		//return;
 	}*/
 
-	pthread_mutex_lock(&bufferLock);
-	/*--------Reading the values from the PLC int_output, int_memory, and dint_memory buffer and writing to the PCCC buffer based on position--------*/
-	for(int i = 0; i < WordDataLength; i++)
-	{
-		int position = Start + i;
-		//int an_position = an_Start + i;
-		if ((position <= MIN_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && Temp_FileT == PCCC_INTEGER))
+	uint32_t seq;
+	const ProcessImage *image;
+	/*--------Reading the values from the published int_output, int_memory, and dint_memory image and writing to the PCCC buffer based on position--------*/
+	do {
+		image = image_snapshot_begin(&seq);
+		for(int i = 0; i < WordDataLength; i++)
 		{
-			if (int_output[position] != NULL)
+			int position = Start + i;
+			//int an_position = an_Start + i;
+			if ((position < MIN_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && Temp_FileT == PCCC_INTEGER))
 			{
-				buffer[ 4 + position * 2] = lowByte(*int_output[position]);
-				buffer[5 + position * 2] = highByte(*int_output[position]);
+				buffer[ 4 + position * 2] = lowByte(image->int_output[position]);
+				buffer[5 + position * 2] = highByte(image->int_output[position]);
 			}
-			else
+			//accessing memory
+			//16-bit registers
+			else if ((position >= MIN_16B_RANGE && position <= MAX_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && Temp_FileT == PCCC_INTEGER))
 			{
-				buffer[ 4 + position * 2] = 0;
-				buffer[5 + position * 2] = 0;
+				buffer[ 4 + position * 2] = lowByte(image->int_memory[position - MIN_16B_RANGE]);
+				buffer[5 + position * 2] = highByte(image->int_memory[position - MIN_16B_RANGE]);
 			}
-		}
-		//accessing memory
-		//16-bit registers
-		else if ((position >= MIN_16B_RANGE && position <= MAX_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && Temp_FileT == PCCC_INTEGER))
-		{
-			if (int_memory[position - MIN_16B_RANGE] != NULL)
+			
+			//32-bit registers
+			else if (Temp_FileN == PCCC_FN_FLOAT && Temp_FileT == PCCC_FLOATING_POINT && (position % 2 == 0))
 			{
-				buffer[ 4 + position * 2] = lowByte(*int_memory[position - MIN_16B_RANGE]);
-				buffer[5 + position * 2] = highByte(*int_memory[position - MIN_16B_RANGE]);
+				position = position/2;
+				uint32_t tempValue = image->dint_memory[position];
+				
+				buffer[4+(4*position)] = tempValue;
+				buffer[5+(4*position)] = tempValue >> 8;
+				buffer[6+(4*position)] = tempValue >> 16;
+				buffer[7+(4*position)] = tempValue >> 24;
+			
 			}
+			/*Left in for future error handling setup-Invalid Address*/
 			else
 			{
-				buffer[ 4 + position * 2] = 0;
-				buffer[5 + position * 2] = 0;
+				//PCCC Error Handling (Fill in?); If none of the above are recognized, error
 			}
 		}
-		
-		//32-bit registers
-		else if (Temp_FileN == PCCC_FN_FLOAT && Temp_FileT == PCCC_FLOATING_POINT && (position % 2 == 0))
-		{
-			position = position/2;
-			uint32_t tempValue = *dint_memory[position];
-			
-			buffer[4+(4*position)] = tempValue;
-			buffer[5+(4*position)] = tempValue >> 8;
-			buffer[6+(4*position)] = tempValue >> 16;
-			buffer[7+(4*position)] = tempValue >> 24;
-		
-		}
-		/*Left in for future error handling setup-Invalid Address*/
-		else
-		{
-			//PCCC Error Handling (Fill in?); If none of the above are recognized, error
-		}
-
-	}
-	pthread_mutex_unlock(&bufferLock);
+	} while (image_snapshot_retry(image, seq));
 
 }
 
@@ -514,12 +493,8 @@ void Pccc_ReadHoldingRegisters(unsigned char *buffer, int buffer_size) // QW Rea
 		{
 			value = 0; 
 		}
-		pthread_mutex_lock(&bufferLock);
-		if(bool_output[Start][Mask] != NULL)
-		{
-			*bool_output[Start][Mask] = value;
-		}
-		pthread_mutex_unlock(&bufferLock);
+		//applied by the scan thread at the start of its next cycle
+		image_queue_bits(AREA_BOOL_OUTPUT, Start * 8 + Mask, 1, &value);
 	}
 	
 }
@@ -539,41 +514,32 @@ void Pccc_WriteRegister(unsigned char *buffer, int buffer_size) // QW Write
 	unsigned int Temp_FileT = buffer[7];//Value will be changed potentially during this process, save the File Type Value from command packet
 	unsigned int Temp_FileN = buffer[6];//Value will be changed potentially during this process, save the File Number Value from command packet
 
-	pthread_mutex_lock(&bufferLock);
-	
-	/*--------Determines if the values inside the PCCC data has data. Writes that value to the appropriate PLC Buffer based on the contents of the data in PCCC Buffer-------*/
+	/*--------Determines if the values inside the PCCC data has data. Queues that value for the appropriate PLC Buffer based on the contents of the data in PCCC Buffer-------*/
+	/*--------The scan thread applies the queued writes at the start of its next cycle-------*/
 	for(int i = 0; i < WordDataLength; i++)
 	{
 		int position = Start + i;
 		//analog outputs
-		if ((position <= MIN_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && (Temp_FileT == PCCC_INTEGER)))
+		if ((position < MIN_16B_RANGE) && (Temp_FileN == PCCC_FN_INT && (Temp_FileT == PCCC_INTEGER)))
 		{
-			if (int_output[position] != NULL) *int_output[position] =  an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer
+			uint16_t value = an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer
+			image_queue_words(AREA_INT_OUTPUT, position, 1, &value);
 		}
 		//accessing memory
 		//16-bit registers
 		else if ((position >= MIN_16B_RANGE && position <= MAX_16B_RANGE) && (Temp_FileN == PCCC_FN_OUTPUT && (Temp_FileT == PCCC_INTEGER)))
 		{
-			if (int_memory[position - MIN_16B_RANGE] != NULL) *int_memory[position - MIN_16B_RANGE] = an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer
+			uint16_t value = an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer
+			image_queue_words(AREA_INT_MEMORY, position - MIN_16B_RANGE, 1, &value);
 		}
 		//32-bit registers
 		if (Temp_FileN == PCCC_FN_FLOAT && (Temp_FileT == PCCC_FLOATING_POINT))
 		{
-			if (dint_memory[position] != NULL)
-			{
-				uint32_t tempValue = buffer[10 + i] | buffer[11 + i] << 8 | buffer[12 + i] << 16 | buffer[13 + i] <<24;//look at this closer
-				
-				*dint_memory[position] = tempValue;
-				
-				i += 4;
-			}
-			else
-			{
-				pccc_holding_regs[position] = an_word_pccc(buffer[10 + i], buffer[11 + i]);//look at this closer might need to copy from temp
-			}
+			uint32_t tempValue = buffer[10 + i] | buffer[11 + i] << 8 | buffer[12 + i] << 16 | buffer[13 + i] <<24;//look at this closer
+			uint16_t words[2] = {(uint16_t)(tempValue >> 16), (uint16_t)tempValue};
+			image_queue_words(AREA_DINT_MEMORY, position * 2, 2, words);
+			
+			i += 4;
 		}
-	
-	pthread_mutex_unlock(&bufferLock);
-
 	}
 }
\ No newline at end of file
@@ -18,134 +18,428 @@
 //
 // This file is responsible for the persistent storage on the OpenPLC
 // Thiago Alves, Jun 2019
+//
+// The retained memory (%MW, %MD and %ML) is kept in an append-only journal.
+// It starts with a checkpoint of the whole retained memory, followed by
+// delta records holding only the words that changed. Every record carries
+// a sequence number and a CRC32, so recovery replays the journal up to the
+// first torn or corrupted record. When the journal grows past
+// PSTORAGE_COMPACT_BYTES it is rewritten as a single checkpoint into a
+// temporary file that is renamed over it.
 //-----------------------------------------------------------------------------
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <vector>
 
 #include "ladder.h"
+#include "process_image.h"
+
+#define PSTORAGE_FSYNC_ALWAYS       0   // fsync after every record
+#define PSTORAGE_FSYNC_PERIODIC     1   // fsync at most every PSTORAGE_FSYNC_PERIOD_MS
+#define PSTORAGE_FSYNC_NEVER        2   // leave write back to the kernel
+
+#ifndef PSTORAGE_FSYNC
+#define PSTORAGE_FSYNC              PSTORAGE_FSYNC_ALWAYS
+#endif
+#define PSTORAGE_FSYNC_PERIOD_MS    5000
+#ifndef PSTORAGE_COMPACT_BYTES
+#define PSTORAGE_COMPACT_BYTES      (256 * 1024)
+#endif
+
+#define JOURNAL_FILE                "persistent.journal"
+#define JOURNAL_TEMP_FILE           "persistent.journal.tmp"
+#define LEGACY_FILE                 "persistent.file"       // %MW only, before the journal
+#define JOURNAL_MAGIC               0x4e524a50              // "PJRN"
+#define RECORD_CHECKPOINT           1
+#define RECORD_DELTA                2
+
+struct RetainedMemory
+{
+	IEC_UINT int_memory[BUFFER_SIZE];
+	IEC_DINT dint_memory[BUFFER_SIZE];
+	IEC_LINT lint_memory[BUFFER_SIZE];
+};
+
+struct JournalRecord
+{
+	uint32_t magic;
+	uint32_t type;
+	uint64_t seq;
+	uint32_t length;        // payload bytes after the record header
+	uint32_t crc;           // CRC32 of the header, with crc 0, and the payload
+};
+
+//one changed word of a delta record
+struct JournalEntry
+{
+	uint16_t area;          // AREA_INT_MEMORY, AREA_DINT_MEMORY or AREA_LINT_MEMORY
+	uint16_t index;
+	uint32_t reserved;
+	uint64_t value;
+};
+
+//what the journal holds, as last written or recovered
+static RetainedMemory persisted;
+static uint64_t journal_seq = 0;
+static int journal_fd = -1;
+static off_t journal_size = 0;
+static uint64_t last_sync_ms = 0;
+static bool journal_unsynced = false;   //records appended since the last sync
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+	static uint32_t table[256];
+	if (table[1] == 0)
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	const uint8_t *p = (const uint8_t *)data;
+	crc = ~crc;
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint64_t monotonicMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void copyRetained(RetainedMemory *retained, const ProcessImage *image)
+{
+	memcpy(retained->int_memory, image->int_memory, sizeof(retained->int_memory));
+	memcpy(retained->dint_memory, image->dint_memory, sizeof(retained->dint_memory));
+	memcpy(retained->lint_memory, image->lint_memory, sizeof(retained->lint_memory));
+}
 
 //-----------------------------------------------------------------------------
-// Main function for the thread. Should create a buffer for the persistent
-// data, compare it with the actual data and write back to the persistent
-// file if the data has changed
+// Append one record with the next sequence number. Returns false if it could
+// not be written completely
 //-----------------------------------------------------------------------------
-void startPstorage()
+static bool writeRecord(int fd, uint32_t type, const void *payload, uint32_t length)
 {
-    unsigned char log_msg[1000];
-	IEC_UINT persistentBuffer[BUFFER_SIZE];
+	JournalRecord record;
+	record.magic = JOURNAL_MAGIC;
+	record.type = type;
+	record.seq = journal_seq + 1;
+	record.length = length;
+	record.crc = 0;
+	record.crc = crc32(crc32(0, &record, sizeof(record)), payload, length);
 
-    //Read initial buffers into persistent struct
-	pthread_mutex_lock(&bufferLock); //lock mutex
-	for (int i = 0; i < BUFFER_SIZE; i++)
+	struct iovec iov[2];
+	iov[0].iov_base = &record;
+	iov[0].iov_len = sizeof(record);
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = length;
+
+	ssize_t n = writev(fd, iov, 2);
+	if (n != (ssize_t)(sizeof(record) + length))
+		return false;
+
+	journal_seq++;
+	journal_size += n;
+	return true;
+}
+
+static void syncJournal(bool force)
+{
+	if (!journal_unsynced)
+		return;
+	uint64_t now = monotonicMs();
+	if (PSTORAGE_FSYNC == PSTORAGE_FSYNC_ALWAYS || force ||
+		(PSTORAGE_FSYNC == PSTORAGE_FSYNC_PERIODIC && now - last_sync_ms >= PSTORAGE_FSYNC_PERIOD_MS))
 	{
-		if (int_memory[i] != NULL) persistentBuffer[i] = *int_memory[i];
+		fdatasync(journal_fd);
+		last_sync_ms = now;
+		journal_unsynced = false;
 	}
-	pthread_mutex_unlock(&bufferLock); //unlock mutex
-    
-    //Perform the first write
-    if (access("persistent.file", F_OK) == -1) 
-    {
-        sprintf(log_msg, "Creating Persistent Storage file\n");
-        log(log_msg);
-    }
-    
-    FILE *ps = fopen("persistent.file", "w"); //if file already exists, it will be overwritten
-    if (ps == NULL)
-    {
-        sprintf(log_msg, "Persistent Storage: Error creating persistent memory file!\n");
-        log(log_msg);
-        return 0;
-    }
-
-    if (fwrite(persistentBuffer, sizeof(IEC_INT), BUFFER_SIZE, ps) < BUFFER_SIZE)
-    {
-        sprintf(log_msg, "Persistent Storage: Error writing to persistent memory file!\n");
-        log(log_msg);
-        return 0;
-    }
-    fclose(ps);
-    
-    //Run the main thread
-	while (run_pstorage)
+}
+
+//-----------------------------------------------------------------------------
+// Replace the journal with a single checkpoint of retained. The checkpoint
+// is written and synced to a temporary file first, so a crash leaves either
+// the old journal or the new one
+//-----------------------------------------------------------------------------
+static bool compactJournal(const RetainedMemory *retained)
+{
+	unsigned char log_msg[1000];
+
+	int fd = open(JOURNAL_TEMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		sprintf(log_msg, "Persistent Storage: Error creating %s: %s\n", JOURNAL_TEMP_FILE, strerror(errno));
+		log(SEV_ERROR, log_msg);
+		return false;
+	}
+
+	journal_size = 0;
+	if (!writeRecord(fd, RECORD_CHECKPOINT, retained, sizeof(RetainedMemory)) || fsync(fd) != 0)
+	{
+		sprintf(log_msg, "Persistent Storage: Error writing %s!\n", JOURNAL_TEMP_FILE);
+		log(SEV_ERROR, log_msg);
+		close(fd);
+		return false;
+	}
+	close(fd);
+
+	if (rename(JOURNAL_TEMP_FILE, JOURNAL_FILE) != 0)
+	{
+		sprintf(log_msg, "Persistent Storage: Error replacing %s: %s\n", JOURNAL_FILE, strerror(errno));
+		log(SEV_ERROR, log_msg);
+		return false;
+	}
+
+	//make the rename itself durable
+	int dir_fd = open(".", O_RDONLY);
+	if (dir_fd >= 0)
+	{
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+
+	if (journal_fd >= 0) close(journal_fd);
+	journal_fd = open(JOURNAL_FILE, O_WRONLY | O_APPEND);
+	memcpy(&persisted, retained, sizeof(RetainedMemory));
+	last_sync_ms = monotonicMs();
+	journal_unsynced = false;
+	return journal_fd >= 0;
+}
+
+//-----------------------------------------------------------------------------
+// Words of retained that differ from what the journal holds
+//-----------------------------------------------------------------------------
+static void findChanges(const RetainedMemory *retained, std::vector<JournalEntry> &entries)
+{
+	JournalEntry entry;
+	entry.reserved = 0;
+	entries.clear();
+
+	for (int i = 0; i < BUFFER_SIZE; i++)
 	{
-        
-        //Verify if persistent buffer is outdated
-		bool bufferOutdated = false;
-		pthread_mutex_lock(&bufferLock); //lock mutex
-		for (int i = 0; i < BUFFER_SIZE; i++)
+		if (retained->int_memory[i] != persisted.int_memory[i])
 		{
-			if (int_memory[i] != NULL)
-			{
-				if (persistentBuffer[i] != *int_memory[i])
-				{
-					persistentBuffer[i] = *int_memory[i];
-					bufferOutdated = true;
-				}
-			}
+			entry.area = AREA_INT_MEMORY;
+			entry.index = i;
+			entry.value = retained->int_memory[i];
+			entries.push_back(entry);
 		}
-		pthread_mutex_unlock(&bufferLock); //unlock mutex
-
-        //If buffer is outdated, write the changes back to the file
-		if (bufferOutdated)
+		if (retained->dint_memory[i] != persisted.dint_memory[i])
 		{
-			FILE *fd = fopen("persistent.file", "w"); //if file already exists, it will be overwritten
-			if (fd == NULL)
-			{
-                sprintf(log_msg, "Persistent Storage: Error creating persistent memory file!\n");
-                log(log_msg);
-				return 0;
-			}
+			entry.area = AREA_DINT_MEMORY;
+			entry.index = i;
+			entry.value = (uint32_t)retained->dint_memory[i];
+			entries.push_back(entry);
+		}
+		if (retained->lint_memory[i] != persisted.lint_memory[i])
+		{
+			entry.area = AREA_LINT_MEMORY;
+			entry.index = i;
+			entry.value = (uint64_t)retained->lint_memory[i];
+			entries.push_back(entry);
+		}
+	}
+}
+
+static void applyEntry(RetainedMemory *retained, const JournalEntry *entry)
+{
+	if (entry->index >= BUFFER_SIZE) return;
+	if (entry->area == AREA_INT_MEMORY)
+		retained->int_memory[entry->index] = (IEC_UINT)entry->value;
+	else if (entry->area == AREA_DINT_MEMORY)
+		retained->dint_memory[entry->index] = (IEC_DINT)entry->value;
+	else if (entry->area == AREA_LINT_MEMORY)
+		retained->lint_memory[entry->index] = (IEC_LINT)entry->value;
+}
+
+//-----------------------------------------------------------------------------
+// Main function for the thread. Starts the journal with a checkpoint of the
+// retained memory, then every pstorage_polling seconds appends the words
+// that changed since
+//-----------------------------------------------------------------------------
+void startPstorage()
+{
+	unsigned char log_msg[1000];
+	RetainedMemory retained;
+	std::vector<JournalEntry> entries;
+	uint32_t seq;
+	const ProcessImage *image;
+
+	do {
+		image = image_snapshot_begin(&seq);
+		copyRetained(&retained, image);
+	} while (image_snapshot_retry(image, seq));
 
-			if (fwrite(persistentBuffer, sizeof(IEC_INT), BUFFER_SIZE, fd) < BUFFER_SIZE)
+	if (access(JOURNAL_FILE, F_OK) == -1)
+	{
+		sprintf(log_msg, "Creating Persistent Storage journal\n");
+		log(log_msg);
+	}
+	if (!compactJournal(&retained))
+	{
+		return;
+	}
+
+	//Run the main thread
+	while (run_pstorage)
+	{
+		sleepms(pstorage_polling*1000);
+
+		do {
+			image = image_snapshot_begin(&seq);
+			copyRetained(&retained, image);
+		} while (image_snapshot_retry(image, seq));
+
+		findChanges(&retained, entries);
+		if (!entries.empty())
+		{
+			if (!writeRecord(journal_fd, RECORD_DELTA, entries.data(), entries.size() * sizeof(JournalEntry)))
 			{
-                sprintf(log_msg, "Persistent Storage: Error writing to persistent memory file!\n");
-                log(log_msg);
-				return 0;
+				//a partial record is dropped at recovery; start over from a checkpoint
+				sprintf(log_msg, "Persistent Storage: Error writing to %s!\n", JOURNAL_FILE);
+				log(SEV_ERROR, log_msg);
+				compactJournal(&retained);
+				continue;
 			}
-			fclose(fd);
+			for (size_t i = 0; i < entries.size(); i++)
+				applyEntry(&persisted, &entries[i]);
+			journal_unsynced = true;
 		}
 
-		sleepms(pstorage_polling*1000);
+		//also when nothing changed this period: a record appended inside the
+		//last PSTORAGE_FSYNC_PERIOD_MS is still waiting for its sync
+		if (journal_size > PSTORAGE_COMPACT_BYTES)
+			compactJournal(&retained);
+		else
+			syncJournal(false);
 	}
+
+	syncJournal(true);
+	close(journal_fd);
+	journal_fd = -1;
 }
 
 //-----------------------------------------------------------------------------
-// This function reads the contents from persistent.file into OpenPLC internal
-// buffers. Must be called when OpenPLC is initializing. If persistent storage
-// is disabled, the persistent.file will not be found and the function will
-// exit gracefully.
+// %MW from the file written before the journal existed
 //-----------------------------------------------------------------------------
-int readPersistentStorage()
+static bool readLegacyFile(RetainedMemory *retained)
 {
-    unsigned char log_msg[1000];
-	FILE *fd = fopen("persistent.file", "r");
+	FILE *fd = fopen(LEGACY_FILE, "r");
 	if (fd == NULL)
-	{
-        sprintf(log_msg, "Warning: Persistent Storage file not found\n");
-        log(log_msg);
-		return 0;
-	}
+		return false;
 
-	IEC_INT persistentBuffer[BUFFER_SIZE];
+	bool ok = fread(retained->int_memory, sizeof(IEC_UINT), BUFFER_SIZE, fd) == BUFFER_SIZE;
+	fclose(fd);
+	return ok;
+}
+
+//-----------------------------------------------------------------------------
+// This function replays the journal into OpenPLC internal buffers. Must be
+// called when OpenPLC is initializing. Replay stops at the first record that
+// is incomplete, fails its CRC or breaks the sequence, which is where a crash
+// interrupted a write. If persistent storage is disabled, the journal will
+// not be found and the function will exit gracefully.
+//-----------------------------------------------------------------------------
+int readPersistentStorage()
+{
+	unsigned char log_msg[1000];
+	RetainedMemory recovered;
+	memset(&recovered, 0, sizeof(recovered));
 
-	if (fread(persistentBuffer, sizeof(IEC_INT), BUFFER_SIZE, fd) < BUFFER_SIZE)
+	int fd = open(JOURNAL_FILE, O_RDONLY);
+	if (fd < 0)
 	{
-        sprintf(log_msg, "Persistent Storage: Error while trying to read persistent.file!\n");
-        log(log_msg);
-		return 0;
+		if (!readLegacyFile(&recovered))
+		{
+			sprintf(log_msg, "Warning: Persistent Storage file not found\n");
+			log(SEV_WARNING, log_msg);
+			return 0;
+		}
+		sprintf(log_msg, "Persistent Storage: Reading %s into local buffers\n", LEGACY_FILE);
+		log(log_msg);
 	}
-	fclose(fd);
-    
-    sprintf(log_msg, "Persistent Storage: Reading persistent.file into local buffers\n");
-    log(log_msg);
-    
-	pthread_mutex_lock(&bufferLock); //lock mutex
-	for (int i = 0; i < BUFFER_SIZE; i++)
+	else
 	{
-		if (int_memory[i] != NULL) *int_memory[i] = persistentBuffer[i];
+		struct stat st;
+		fstat(fd, &st);
+		std::vector<uint8_t> journal(st.st_size);
+		ssize_t size = read(fd, journal.data(), journal.size());
+		close(fd);
+
+		ssize_t offset = 0;
+		int records = 0;
+		while (size >= 0 && offset + (ssize_t)sizeof(JournalRecord) <= size)
+		{
+			JournalRecord record;
+			memcpy(&record, &journal[offset], sizeof(record));
+			const uint8_t *payload = &journal[offset + sizeof(record)];
+			if (record.magic != JOURNAL_MAGIC || record.length > size - offset - sizeof(record))
+				break;
+
+			uint32_t crc = record.crc;
+			record.crc = 0;
+			if (crc32(crc32(0, &record, sizeof(record)), payload, record.length) != crc)
+				break;
+			if (records == 0 ? record.type != RECORD_CHECKPOINT : record.seq != journal_seq + 1)
+				break;
+
+			if (record.type == RECORD_CHECKPOINT && record.length == sizeof(RetainedMemory))
+			{
+				memcpy(&recovered, payload, sizeof(RetainedMemory));
+			}
+			else if (record.type == RECORD_DELTA)
+			{
+				for (uint32_t i = 0; i + sizeof(JournalEntry) <= record.length; i += sizeof(JournalEntry))
+				{
+					JournalEntry entry;
+					memcpy(&entry, payload + i, sizeof(entry));
+					applyEntry(&recovered, &entry);
+				}
+			}
+			journal_seq = record.seq;
+			offset += sizeof(record) + record.length;
+			records++;
+		}
+
+		if (records == 0)
+		{
+			sprintf(log_msg, "Persistent Storage: %s has no valid checkpoint!\n", JOURNAL_FILE);
+			log(log_msg);
+			return 0;
+		}
+		sprintf(log_msg, "Persistent Storage: Replayed %d records up to sequence %llu from %s\n", records, (unsigned long long)journal_seq, JOURNAL_FILE);
+		log(log_msg);
+		if (offset < size)
+		{
+			sprintf(log_msg, "Persistent Storage: Discarded %lld bytes of an interrupted write\n", (long long)(size - offset));
+			log(log_msg);
+		}
 	}
+
+	memcpy(&persisted, &recovered, sizeof(RetainedMemory));
+
+	pthread_mutex_lock(&bufferLock); //lock mutex
+	memcpy(plc_image.int_memory, recovered.int_memory, sizeof(recovered.int_memory));
+	memcpy(plc_image.dint_memory, recovered.dint_memory, sizeof(recovered.dint_memory));
+	memcpy(plc_image.lint_memory, recovered.lint_memory, sizeof(recovered.lint_memory));
 	pthread_mutex_unlock(&bufferLock); //unlock mutex
-}
\ No newline at end of file
+	return 1;
+}
@@ -0,0 +1,362 @@
+//-----------------------------------------------------------------------------
+// Packed process image. glueVars.cpp (written by glue_generator) gives every
+// located IEC variable its own storage and a pointer the IEC program reads
+// it through. At startup image_init() moves these pointers into plc_image,
+// so the program, the hardware layer and the protocol servers share one
+// contiguous block, and records which addresses are used. The pointer
+// tables (bool_input, int_output, ...) are kept for the code that still
+// walks them: glueVars() fills them from the moved pointers, and
+// image_map_tables() points their unused entries into the image as well.
+//
+// Threads other than the scan read a copy of the image published at the end
+// of every cycle and queue their writes for the start of the next one, so a
+// slow client never holds bufferLock against the scan.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+
+#include "iec_types_all.h"
+#include "process_image.h"
+
+ProcessImage plc_image;
+ImageIndex image_index;
+
+/* two published copies, written alternately; seq is odd while one is written */
+struct ImageSnapshot {
+	std::atomic<uint32_t> seq;
+	ProcessImage image;
+};
+static ImageSnapshot snapshots[2];
+static std::atomic<int> snapshot_current(0);
+
+/* bounded multi-producer queue of writes, consumed by the scan thread only.
+ * A cell is free for the producer holding ticket pos when its seq equals pos,
+ * and ready for the scan thread when it equals pos + 1 */
+struct ImageWrite {
+	uint8_t area;
+	uint8_t bits;                   // data is packed bits, else 16 bit words
+	uint16_t start;
+	uint16_t count;
+	uint8_t data[IMAGE_WRITE_MAX_BYTES];
+};
+struct ImageWriteCell {
+	std::atomic<uint32_t> seq;
+	ImageWrite write;
+};
+static ImageWriteCell write_queue[IMAGE_WRITE_QUEUE_SIZE];
+static std::atomic<uint32_t> write_enqueue_pos(0);
+static uint32_t write_dequeue_pos = 0;
+
+#define __LOCATED_VAR(type, name, ...) extern type* name;
+#include "LOCATED_VARIABLES.h"
+#undef __LOCATED_VAR
+
+int image_area_size(int area)
+{
+	return (area == AREA_BOOL_INPUT || area == AREA_BOOL_OUTPUT) ? BUFFER_SIZE * 8 : BUFFER_SIZE;
+}
+
+//-----------------------------------------------------------------------------
+// Move one located variable into the image, keeping its value. location is
+// I, Q or M, size X, B, W, D or L, as in %QX2.1 or %MW10
+//-----------------------------------------------------------------------------
+static void image_place(void **var, size_t var_size, char location, char size, int address, int bit)
+{
+	int area = -1, index = address;
+	void *cell = NULL;
+	size_t cell_size = 0;
+
+	if (size == 'X' && (location == 'I' || location == 'Q') && address < BUFFER_SIZE && bit < 8) {
+		area = (location == 'I') ? AREA_BOOL_INPUT : AREA_BOOL_OUTPUT;
+		index = address * 8 + bit;
+		cell = (location == 'I') ? &plc_image.bool_input[index] : &plc_image.bool_output[index];
+		cell_size = sizeof(IEC_BOOL);
+	} else if (address < BUFFER_SIZE && size == 'B' && location != 'M') {
+		area = (location == 'I') ? AREA_BYTE_INPUT : AREA_BYTE_OUTPUT;
+		cell = (location == 'I') ? &plc_image.byte_input[address] : &plc_image.byte_output[address];
+		cell_size = sizeof(IEC_BYTE);
+	} else if (address < BUFFER_SIZE && size == 'W') {
+		area = (location == 'I') ? AREA_INT_INPUT : (location == 'Q') ? AREA_INT_OUTPUT : AREA_INT_MEMORY;
+		cell = (location == 'I') ? &plc_image.int_input[address] : (location == 'Q') ? &plc_image.int_output[address] : &plc_image.int_memory[address];
+		cell_size = sizeof(IEC_UINT);
+	} else if (address < BUFFER_SIZE && size == 'D' && location == 'M') {
+		area = AREA_DINT_MEMORY;
+		cell = &plc_image.dint_memory[address];
+		cell_size = sizeof(IEC_DINT);
+	} else if (address < 2 * BUFFER_SIZE && size == 'L' && location == 'M') {
+		area = (address < BUFFER_SIZE) ? AREA_LINT_MEMORY : AREA_SPECIAL;
+		index = address % BUFFER_SIZE;
+		cell = (address < BUFFER_SIZE) ? &plc_image.lint_memory[index] : &plc_image.special_functions[index];
+		cell_size = sizeof(IEC_LINT);
+	}
+
+	/* the storage glueVars.cpp gave it stays in use */
+	if (cell == NULL || cell_size != var_size) {
+		printf("Located variable %%%c%c%d is kept out of the process image\n", location, size, address);
+		return;
+	}
+	memcpy(cell, *var, var_size);
+	*var = cell;
+	image_index.used[area][index / 64] |= (uint64_t)1 << (index % 64);
+	image_index.located++;
+}
+
+//-----------------------------------------------------------------------------
+// Place the located variables into the image and build the index of used
+// addresses. Must be called before config_init__(), which copies the located
+// pointers into the program instances and writes their initial values
+// through them, and before glueVars()
+//-----------------------------------------------------------------------------
+void image_init()
+{
+	memset(&image_index.used, 0, sizeof(image_index.used));
+	image_index.located = 0;
+
+#define __LOCATED_VAR(type, name, location, size, ...) \
+	{ const int address[] = {__VA_ARGS__, 0}; image_place((void **)&name, sizeof(type), #location[0], #size[0], address[0], address[1]); }
+#include "LOCATED_VARIABLES.h"
+#undef __LOCATED_VAR
+
+	for (int area = 0; area < AREA_COUNT; area++) {
+		std::vector<ImageRun> &runs = image_index.runs[area];
+		runs.clear();
+		for (int addr = 0; addr < image_area_size(area); addr++) {
+			if (!image_used(area, addr)) continue;
+			if (!runs.empty() && runs.back().start + runs.back().count == addr)
+				runs.back().count++;
+			else
+				runs.push_back(ImageRun{(uint16_t)addr, 1});
+		}
+	}
+	for (int i = 0; i < IMAGE_WRITE_QUEUE_SIZE; i++)
+		write_queue[i].seq.store(i, std::memory_order_relaxed);
+	printf("Process image: %d located variables, %d bytes\n", image_index.located, (int)sizeof(ProcessImage));
+}
+
+//-----------------------------------------------------------------------------
+// Point every entry of the pointer tables at its cell of the image, so that
+// addresses the program does not use are still backed for the protocol servers
+//-----------------------------------------------------------------------------
+void image_map_tables()
+{
+	for (int i = 0; i < BUFFER_SIZE * 8; i++) {
+		bool_input[i / 8][i % 8] = &plc_image.bool_input[i];
+		bool_output[i / 8][i % 8] = &plc_image.bool_output[i];
+	}
+	for (int i = 0; i < BUFFER_SIZE; i++) {
+		byte_input[i] = &plc_image.byte_input[i];
+		byte_output[i] = &plc_image.byte_output[i];
+		int_input[i] = &plc_image.int_input[i];
+		int_output[i] = &plc_image.int_output[i];
+		int_memory[i] = &plc_image.int_memory[i];
+		dint_memory[i] = &plc_image.dint_memory[i];
+		lint_memory[i] = &plc_image.lint_memory[i];
+		special_functions[i] = &plc_image.special_functions[i];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Pack count bools (0 or 1 each) into bits, LSB first as Modbus does, eight
+// at a time: the multiply gathers the low bit of each byte of a little
+// endian word into its top byte
+//-----------------------------------------------------------------------------
+void image_pack_bits(const IEC_BOOL *bits, int count, uint8_t *packed)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		uint64_t v;
+		memcpy(&v, &bits[i], 8);
+		packed[i / 8] = (uint8_t)(((v & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+	}
+	if (i < count) {
+		uint8_t last = 0;
+		for (int k = 0; i + k < count; k++)
+			last |= (uint8_t)((bits[i + k] & 1) << k);
+		packed[i / 8] = last;
+	}
+}
+
+void image_unpack_bits(const uint8_t *packed, int count, IEC_BOOL *bits)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		/* byte k keeps bit k of the packed byte, then becomes 0 or 1 */
+		uint64_t v = ((uint64_t)packed[i / 8] * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+		v = ((v + 0x7f7f7f7f7f7f7f7fULL) & 0x8080808080808080ULL) >> 7;
+		memcpy(&bits[i], &v, 8);
+	}
+	for (int k = 0; i + k < count; k++)
+		bits[i + k] = (packed[i / 8] >> k) & 1;
+}
+
+//-----------------------------------------------------------------------------
+// Copy the image into the snapshot readers are not pointed at, then point
+// them at it. Called by the scan thread at the end of a cycle, after
+// updateBuffersOut(). Only the scan thread writes plc_image, so the copy
+// needs no bufferLock and stays off the path to the outputs
+//-----------------------------------------------------------------------------
+void image_publish()
+{
+	int next = 1 - snapshot_current.load(std::memory_order_relaxed);
+	ImageSnapshot &snapshot = snapshots[next];
+	uint32_t seq = snapshot.seq.load(std::memory_order_relaxed);
+
+	snapshot.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(&snapshot.image, &plc_image, sizeof(ProcessImage));
+	snapshot.seq.store(seq + 2, std::memory_order_release);
+	snapshot_current.store(next, std::memory_order_release);
+}
+
+const ProcessImage *image_snapshot_begin(uint32_t *seq)
+{
+	while (1)
+	{
+		ImageSnapshot &snapshot = snapshots[snapshot_current.load(std::memory_order_acquire)];
+		uint32_t s = snapshot.seq.load(std::memory_order_acquire);
+		if ((s & 1) == 0)
+		{
+			*seq = s;
+			return &snapshot.image;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// True when the snapshot was rewritten while it was read, which takes a
+// reader slower than a whole scan cycle
+//-----------------------------------------------------------------------------
+bool image_snapshot_retry(const ProcessImage *image, uint32_t seq)
+{
+	const ImageSnapshot &snapshot = (image == &snapshots[0].image) ? snapshots[0] : snapshots[1];
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return snapshot.seq.load(std::memory_order_relaxed) != seq;
+}
+
+//-----------------------------------------------------------------------------
+// Size of an area in the units writes address it by, or 0 when it cannot be
+// written from outside the scan
+//-----------------------------------------------------------------------------
+static int image_write_size(int area, bool bits)
+{
+	if (bits)
+		return (area == AREA_BOOL_INPUT || area == AREA_BOOL_OUTPUT) ? BUFFER_SIZE * 8 : 0;
+	switch (area)
+	{
+		case AREA_INT_INPUT:
+		case AREA_INT_OUTPUT:
+		case AREA_INT_MEMORY:
+			return BUFFER_SIZE;
+		case AREA_DINT_MEMORY:
+			return BUFFER_SIZE * 2;
+		case AREA_LINT_MEMORY:
+			return BUFFER_SIZE * 4;
+	}
+	return 0;
+}
+
+static bool image_queue(int area, bool bits, int start, int count, const void *data, int bytes)
+{
+	if (count == 0)
+		return true;
+	if (count < 0 || start < 0 || start + count > image_write_size(area, bits) || bytes > IMAGE_WRITE_MAX_BYTES)
+		return false;
+
+	uint32_t pos = write_enqueue_pos.load(std::memory_order_relaxed);
+	ImageWriteCell *cell;
+	while (1)
+	{
+		cell = &write_queue[pos & (IMAGE_WRITE_QUEUE_SIZE - 1)];
+		int32_t diff = (int32_t)(cell->seq.load(std::memory_order_acquire) - pos);
+		if (diff == 0)
+		{
+			if (write_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			return false;   // full
+		}
+		else
+		{
+			pos = write_enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->write.area = (uint8_t)area;
+	cell->write.bits = bits;
+	cell->write.start = (uint16_t)start;
+	cell->write.count = (uint16_t)count;
+	memcpy(cell->write.data, data, bytes);
+	cell->seq.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool image_queue_bits(int area, int start, int count, const uint8_t *packed)
+{
+	return image_queue(area, true, start, count, packed, (count + 7) / 8);
+}
+
+bool image_queue_words(int area, int start, int count, const uint16_t *words)
+{
+	return image_queue(area, false, start, count, words, count * 2);
+}
+
+static void image_apply_word(int area, int word, uint16_t value)
+{
+	if (area == AREA_DINT_MEMORY)
+	{
+		int shift = 16 * (1 - word % 2);
+		uint32_t dint = (uint32_t)plc_image.dint_memory[word / 2];
+		plc_image.dint_memory[word / 2] = (IEC_DINT)((dint & ~((uint32_t)0xffff << shift)) | ((uint32_t)value << shift));
+	}
+	else if (area == AREA_LINT_MEMORY)
+	{
+		int shift = 16 * (3 - word % 4);
+		uint64_t lint = (uint64_t)plc_image.lint_memory[word / 4];
+		plc_image.lint_memory[word / 4] = (IEC_LINT)((lint & ~((uint64_t)0xffff << shift)) | ((uint64_t)value << shift));
+	}
+	else
+	{
+		IEC_UINT *words = (area == AREA_INT_INPUT) ? plc_image.int_input : (area == AREA_INT_OUTPUT) ? plc_image.int_output : plc_image.int_memory;
+		words[word] = value;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Apply the queued writes to the image. Called by the scan thread at the
+// start of a cycle, with bufferLock. Returns the number of writes applied
+//-----------------------------------------------------------------------------
+int image_apply_writes()
+{
+	int applied = 0;
+
+	while (1)
+	{
+		ImageWriteCell &cell = write_queue[write_dequeue_pos & (IMAGE_WRITE_QUEUE_SIZE - 1)];
+		if (cell.seq.load(std::memory_order_acquire) != write_dequeue_pos + 1)
+			break;
+
+		const ImageWrite &w = cell.write;
+		if (w.bits)
+		{
+			IEC_BOOL *bits = (w.area == AREA_BOOL_INPUT) ? plc_image.bool_input : plc_image.bool_output;
+			image_unpack_bits(w.data, w.count, &bits[w.start]);
+		}
+		else
+		{
+			for (int i = 0; i < w.count; i++)
+			{
+				uint16_t value;
+				memcpy(&value, &w.data[i * 2], 2);
+				image_apply_word(w.area, w.start + i, value);
+			}
+		}
+
+		cell.seq.store(write_dequeue_pos + IMAGE_WRITE_QUEUE_SIZE, std::memory_order_release);
+		write_dequeue_pos++;
+		applied++;
+	}
+	return applied;
+}
@@ -0,0 +1,99 @@
+#ifndef PROCESS_IMAGE_H
+#define PROCESS_IMAGE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "ladder.h"
+
+/* The process image: every located IEC variable and every address served by the
+ * protocol servers lives in one contiguous block. Bools keep one IEC_BOOL per bit,
+ * because the IEC program addresses each %IX/%QX through its own pointer; packed
+ * bit ranges are produced with image_pack_bits()/image_unpack_bits().
+ */
+struct ProcessImage {
+	IEC_BOOL bool_input[BUFFER_SIZE * 8];       // %IX, bit address byte * 8 + bit
+	IEC_BOOL bool_output[BUFFER_SIZE * 8];      // %QX
+	IEC_BYTE byte_input[BUFFER_SIZE];           // %IB
+	IEC_BYTE byte_output[BUFFER_SIZE];          // %QB
+	IEC_UINT int_input[BUFFER_SIZE];            // %IW
+	IEC_UINT int_output[BUFFER_SIZE];           // %QW
+	IEC_UINT int_memory[BUFFER_SIZE];           // %MW
+	IEC_DINT dint_memory[BUFFER_SIZE];          // %MD
+	IEC_LINT lint_memory[BUFFER_SIZE];          // %ML0 - %ML1023
+	IEC_LINT special_functions[BUFFER_SIZE];    // %ML1024 - %ML2047
+};
+
+enum ImageArea {
+	AREA_BOOL_INPUT,
+	AREA_BOOL_OUTPUT,
+	AREA_BYTE_INPUT,
+	AREA_BYTE_OUTPUT,
+	AREA_INT_INPUT,
+	AREA_INT_OUTPUT,
+	AREA_INT_MEMORY,
+	AREA_DINT_MEMORY,
+	AREA_LINT_MEMORY,
+	AREA_SPECIAL,
+	AREA_COUNT
+};
+
+/* consecutive addresses of one area used by the IEC program */
+struct ImageRun {
+	uint16_t start;
+	uint16_t count;
+};
+
+/* Addresses the IEC program declares, built once from LOCATED_VARIABLES.h */
+struct ImageIndex {
+	uint64_t used[AREA_COUNT][BUFFER_SIZE * 8 / 64];    // one bit per address
+	std::vector<ImageRun> runs[AREA_COUNT];
+	int located;                                        // located variables placed in the image
+};
+
+extern ProcessImage plc_image;
+extern ImageIndex image_index;
+
+void image_init();
+void image_map_tables();
+int image_area_size(int area);
+
+static inline bool image_used(int area, int addr)
+{
+	return (image_index.used[area][addr / 64] >> (addr % 64)) & 1;
+}
+
+void image_pack_bits(const IEC_BOOL *bits, int count, uint8_t *packed);
+void image_unpack_bits(const uint8_t *packed, int count, IEC_BOOL *bits);
+
+/* Published copy of the image for the protocol servers and the persistent
+ * storage thread, which read it without bufferLock. The scan thread refreshes
+ * it with image_publish() at the end of each cycle, after sending the outputs
+ * and without bufferLock. A reader retries when the
+ * scan thread overwrote the copy it was reading:
+ *
+ *     uint32_t seq;
+ *     const ProcessImage *image;
+ *     do {
+ *         image = image_snapshot_begin(&seq);
+ *         ... read from image ...
+ *     } while (image_snapshot_retry(image, seq));
+ */
+void image_publish();
+const ProcessImage *image_snapshot_begin(uint32_t *seq);
+bool image_snapshot_retry(const ProcessImage *image, uint32_t seq);
+
+/* Writes from other threads are queued and applied by the scan thread at the
+ * start of its next cycle, in the order they were queued. Bits are packed LSB
+ * first; the words of the DINT and LINT areas are addressed as 16 bit words,
+ * high word first, as the Modbus holding registers do. The queue functions
+ * return false for an invalid range or when the queue is full
+ */
+#define IMAGE_WRITE_QUEUE_SIZE          256     // commands, a power of two
+#define IMAGE_WRITE_MAX_BYTES           256     // data bytes per command
+
+bool image_queue_bits(int area, int start, int count, const uint8_t *packed);
+bool image_queue_words(int area, int start, int count, const uint16_t *words);
+int image_apply_writes();
+#endif
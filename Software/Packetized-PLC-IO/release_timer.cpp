@@ -0,0 +1,160 @@
+//-----------------------------------------------------------------------------
+// Release timer for the compute task. Deadlines are given in synchronized
+// (RTC sync) time. The thread sleeps with clock_nanosleep on CLOCK_MONOTONIC
+// until spin_margin_ns before the deadline and only busy-waits on the RTC for
+// the rest, so the core is free for time sync and networking most of the cycle.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "release_timer.h"
+#include "tsn_drivers/rtc.h"
+#include "tsn_drivers/ptp_types.h"
+
+/* samples taken to map synchronized time to CLOCK_MONOTONIC, the tightest one is used */
+#define OFFSET_SAMPLES 3
+/* longest sleep in release_wait() without a deadline */
+#define EVENT_IDLE_NS 100000000ULL
+
+static uint64_t spin_margin = 50000;
+static ReleaseStats stats;
+
+static inline uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* synchronized time - CLOCK_MONOTONIC, taken from the sample with the shortest RTC read.
+ * The sync clock is disciplined by gPTP, so the mapping is taken again for every release.
+ */
+static int64_t sync_to_monotonic_offset(uint64_t *sync_now)
+{
+	UScaledNs tmp, current_ts;
+	uint64_t best_width = UINT64_MAX;
+	int64_t offset = 0;
+	for (int i = 0; i < OFFSET_SAMPLES; i++) {
+		uint64_t before = monotonic_ns();
+		get_current_local_sync_ts(&tmp, &current_ts);
+		uint64_t after = monotonic_ns();
+		if (after - before < best_width) {
+			best_width = after - before;
+			offset = (int64_t)(current_ts.nsec - (before + (after - before) / 2));
+			*sync_now = current_ts.nsec;
+		}
+	}
+	return offset;
+}
+
+void release_init(uint64_t spin_margin_ns)
+{
+	spin_margin = spin_margin_ns;
+	release_reset_stats();
+}
+
+//-----------------------------------------------------------------------------
+// Return at deadline_ns of synchronized time. Returns the release jitter in
+// ns (>= 0, how late the release was).
+//-----------------------------------------------------------------------------
+int64_t release_at(uint64_t deadline_ns)
+{
+	uint64_t sync_now;
+	int64_t offset = sync_to_monotonic_offset(&sync_now);
+	bool late = (sync_now >= deadline_ns);
+
+	/* coarse: sleep until the spin margin */
+	if (!late && deadline_ns - sync_now > spin_margin) {
+		uint64_t wake = deadline_ns - spin_margin - offset;
+		struct timespec ts;
+		ts.tv_sec = wake / 1000000000ULL;
+		ts.tv_nsec = wake % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+
+	/* fine: spin on the synchronized clock */
+	UScaledNs tmp, current_ts;
+	do {
+		get_current_local_sync_ts(&tmp, &current_ts);
+	} while (current_ts.nsec < deadline_ns);
+
+	int64_t jitter = (int64_t)(current_ts.nsec - deadline_ns);
+	if (stats.count == 0 || jitter < stats.min_ns) stats.min_ns = jitter;
+	if (stats.count == 0 || jitter > stats.max_ns) stats.max_ns = jitter;
+	stats.count++;
+	stats.late += late;
+	stats.sum_ns += jitter;
+	stats.sum_sq_ns += (double)jitter * jitter;
+	return jitter;
+}
+
+//-----------------------------------------------------------------------------
+// Wake the compute task if it sleeps in release_wait()
+//-----------------------------------------------------------------------------
+void release_signal(ReleaseEvent *event)
+{
+	event->count.fetch_add(1, std::memory_order_seq_cst);
+	if (event->waiting.load(std::memory_order_seq_cst))
+		syscall(SYS_futex, &event->count, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Sleep until the event is signalled after seen was read from its count, or
+// until the spin margin before deadline_ns of synchronized time (UINT64_MAX
+// for none, the sleep then ends after EVENT_IDLE_NS). Returns true when it was
+// signalled. Within the spin margin it returns false right away, so that the
+// caller only polls the clock for the last few microseconds.
+//-----------------------------------------------------------------------------
+bool release_wait(ReleaseEvent *event, uint32_t seen, uint64_t deadline_ns)
+{
+	uint64_t sync_now;
+	int64_t offset = sync_to_monotonic_offset(&sync_now);
+	uint64_t wake;
+	if (deadline_ns == UINT64_MAX)
+		wake = sync_now + EVENT_IDLE_NS - offset;
+	else if (deadline_ns > sync_now + spin_margin)
+		wake = deadline_ns - spin_margin - offset;
+	else
+		return event->count.load(std::memory_order_acquire) != seen;
+
+	struct timespec ts;
+	ts.tv_sec = wake / 1000000000ULL;
+	ts.tv_nsec = wake % 1000000000ULL;
+	event->waiting.store(1, std::memory_order_seq_cst);
+	/* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, it returns at once if count moved on */
+	syscall(SYS_futex, &event->count, FUTEX_WAIT_BITSET_PRIVATE, seen, &ts, NULL, FUTEX_BITSET_MATCH_ANY);
+	event->waiting.store(0, std::memory_order_relaxed);
+	return event->count.load(std::memory_order_acquire) != seen;
+}
+
+void release_get_stats(ReleaseStats *out)
+{
+	*out = stats;
+}
+
+void release_reset_stats()
+{
+	stats.count = 0;
+	stats.late = 0;
+	stats.min_ns = 0;
+	stats.max_ns = 0;
+	stats.sum_ns = 0;
+	stats.sum_sq_ns = 0;
+}
+
+int release_format_stats(char *buf, int size, const ReleaseStats *stats)
+{
+	if (stats->count == 0 || size <= 0) return 0;
+	double mean = stats->sum_ns / stats->count;
+	double var = stats->sum_sq_ns / stats->count - mean * mean;
+	int len = snprintf(buf, size, "release jitter over %" PRIu64 " cycles: min %" PRId64 " ns, max %" PRId64 " ns, mean %.1f ns, stddev %.1f ns, late %" PRIu64 "\n",
+		stats->count, stats->min_ns, stats->max_ns, mean, sqrt(var > 0 ? var : 0), stats->late);
+	return len < size ? len : size - 1;
+}
@@ -0,0 +1,30 @@
+#ifndef RELEASE_TIMER_H
+#define RELEASE_TIMER_H
+
+#include <stdint.h>
+#include <atomic>
+
+/* Release jitter of the compute task: actual - planned release time, in synchronized ns */
+struct ReleaseStats {
+	uint64_t count;
+	uint64_t late;          // deadline already passed when release_at() was called
+	int64_t min_ns;
+	int64_t max_ns;
+	double sum_ns;
+	double sum_sq_ns;
+};
+
+/* Event the compute task sleeps on while it waits for its inputs, signalled by the RX thread */
+struct ReleaseEvent {
+	std::atomic<uint32_t> count;
+	std::atomic<uint32_t> waiting;      // the compute task is in release_wait()
+};
+
+void release_init(uint64_t spin_margin_ns);
+int64_t release_at(uint64_t deadline_ns);
+void release_signal(ReleaseEvent *event);
+bool release_wait(ReleaseEvent *event, uint32_t seen, uint64_t deadline_ns);
+void release_get_stats(ReleaseStats *stats);
+void release_reset_stats();
+int release_format_stats(char *buf, int size, const ReleaseStats *stats);
+#endif
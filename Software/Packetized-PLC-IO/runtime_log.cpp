@@ -0,0 +1,182 @@
+//-----------------------------------------------------------------------------
+// Runtime log of the OpenPLC core. log() may be called from any thread, the
+// scan cycle included, so writing a message never takes a lock or blocks:
+// writers claim the next sequence number with a CAS on the ring head and copy
+// the message into that slot. Each slot carries the sequence number of the
+// record it holds, which lets readers follow the log by sequence number and
+// detect records that were overwritten while they were read. When a writer
+// finds its slot still held by a writer one lap behind, the message is
+// dropped and counted instead of waiting for it, and the slot is marked so
+// that readers step past the sequence number instead of waiting for it.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <atomic>
+
+#include "runtime_log.h"
+
+#define LOG_TEXT_WORDS  (LOG_MSG_SIZE / sizeof(uint64_t))
+
+struct LogSlot {
+	std::atomic<uint64_t> state;        // 2 * seq + 1 while record seq is written, 2 * seq + 2 once complete
+	std::atomic<uint64_t> timestamp;
+	std::atomic<uint32_t> meta;         // severity << 16 | length
+	std::atomic<uint64_t> skipped;      // 1 + highest seq whose writer gave up on this slot
+	std::atomic<uint64_t> text[LOG_TEXT_WORDS];
+};
+
+static LogSlot ring[LOG_RING_SIZE];
+static std::atomic<uint64_t> ring_head(0);                  // sequence number of the next record
+static std::atomic<uint64_t> log_written(0);
+static std::atomic<uint64_t> log_dropped(0);
+static std::atomic<uint64_t> log_truncated(0);
+
+static const char *severity_names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+void log_write(int severity, const char *msg)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	size_t length = strlen(msg);
+	if (length > LOG_MSG_SIZE) {
+		length = LOG_MSG_SIZE;
+		log_truncated.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (severity < SEV_DEBUG || severity > SEV_ERROR) severity = SEV_INFO;
+
+	uint64_t seq = ring_head.load(std::memory_order_relaxed);
+	uint64_t state;
+	do {
+		state = ring[seq & (LOG_RING_SIZE - 1)].state.load(std::memory_order_acquire);
+		if ((state & 1) && state < 2 * seq) {
+			log_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	} while (!ring_head.compare_exchange_weak(seq, seq + 1, std::memory_order_relaxed));
+
+	/* the record before ours in this slot may have completed meanwhile; any
+	   other change means a writer one lap behind or ahead holds the slot */
+	LogSlot &slot = ring[seq & (LOG_RING_SIZE - 1)];
+	while (!slot.state.compare_exchange_weak(state, 2 * seq + 1, std::memory_order_relaxed)) {
+		if (state < 2 * seq && !(state & 1)) continue;
+		if (state < 2 * seq) {
+			uint64_t skipped = slot.skipped.load(std::memory_order_relaxed);
+			while (skipped < seq + 1 && !slot.skipped.compare_exchange_weak(skipped, seq + 1, std::memory_order_release));
+		}
+		log_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot.timestamp.store((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec, std::memory_order_relaxed);
+	slot.meta.store((uint32_t)severity << 16 | (uint32_t)length, std::memory_order_relaxed);
+	for (size_t i = 0; i * sizeof(uint64_t) < length; i++) {
+		uint64_t word = 0;
+		size_t n = length - i * sizeof(uint64_t);
+		memcpy(&word, msg + i * sizeof(uint64_t), n < sizeof(uint64_t) ? n : sizeof(uint64_t));
+		slot.text[i].store(word, std::memory_order_relaxed);
+	}
+	slot.state.store(2 * seq + 2, std::memory_order_release);
+	log_written.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t log_next_seq()
+{
+	return ring_head.load(std::memory_order_acquire);
+}
+
+/* oldest record that may still be in the ring */
+uint64_t log_oldest_seq()
+{
+	uint64_t head = ring_head.load(std::memory_order_acquire);
+	return head > LOG_RING_SIZE ? head - LOG_RING_SIZE : 0;
+}
+
+int log_read(uint64_t seq, LogRecord *rec)
+{
+	LogSlot &slot = ring[seq & (LOG_RING_SIZE - 1)];
+	uint64_t state = slot.state.load(std::memory_order_acquire);
+	if (state < 2 * seq + 2)
+		return slot.skipped.load(std::memory_order_acquire) > seq ? LOG_READ_LOST : LOG_READ_PENDING;
+	if (state > 2 * seq + 2) return LOG_READ_LOST;
+
+	rec->seq = seq;
+	rec->timestamp = slot.timestamp.load(std::memory_order_relaxed);
+	uint32_t meta = slot.meta.load(std::memory_order_relaxed);
+	rec->severity = meta >> 16;
+	rec->length = meta & 0xffff;
+	for (size_t i = 0; i * sizeof(uint64_t) < (size_t)rec->length; i++) {
+		uint64_t word = slot.text[i].load(std::memory_order_relaxed);
+		memcpy(rec->text + i * sizeof(uint64_t), &word, sizeof(uint64_t));
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot.state.load(std::memory_order_relaxed) != state) return LOG_READ_LOST;
+	return LOG_READ_OK;
+}
+
+void log_get_stats(LogStats *stats)
+{
+	stats->written = log_written.load(std::memory_order_relaxed);
+	stats->dropped = log_dropped.load(std::memory_order_relaxed);
+	stats->truncated = log_truncated.load(std::memory_order_relaxed);
+}
+
+//-----------------------------------------------------------------------------
+// Formats the records from *seq on into buf and advances *seq past them.
+// Stops at the first record that is not complete yet or does not fit, so the
+// caller can continue from *seq later. With details, every record is prefixed
+// with its sequence number, time and severity. Returns the bytes written.
+//-----------------------------------------------------------------------------
+int log_format(char *buf, int size, uint64_t *seq, bool details)
+{
+	int len = 0;
+	uint64_t lost = 0;
+	uint64_t oldest = log_oldest_seq();
+	if (*seq < oldest) {
+		lost = oldest - *seq;
+		*seq = oldest;
+	}
+
+	LogRecord rec;
+	char line[LOG_MSG_SIZE + 128];
+	while (*seq < log_next_seq()) {
+		int result = log_read(*seq, &rec);
+		if (result == LOG_READ_PENDING) break;
+		if (result == LOG_READ_LOST) {
+			lost++;
+			(*seq)++;
+			continue;
+		}
+
+		int n = 0;
+		if (lost > 0)
+			n += snprintf(line, sizeof(line), "[%" PRIu64 " log records lost]\n", lost);
+		if (details) {
+			time_t sec = (time_t)(rec.timestamp / 1000000000ULL);
+			struct tm tm;
+			localtime_r(&sec, &tm);
+			n += snprintf(line + n, sizeof(line) - n, "%" PRIu64 " ", rec.seq);
+			n += strftime(line + n, sizeof(line) - n, "%Y-%m-%d %H:%M:%S", &tm);
+			n += snprintf(line + n, sizeof(line) - n, ".%06u %-7s ", (unsigned)(rec.timestamp % 1000000000ULL / 1000), severity_names[rec.severity]);
+		}
+		memcpy(line + n, rec.text, rec.length);
+		n += rec.length;
+		if (details && (rec.length == 0 || rec.text[rec.length - 1] != '\n')) line[n++] = '\n';
+
+		if (len + n > size) {
+			if (len > 0) return len;
+			n = size;       // a buffer smaller than one record gets it truncated
+		}
+		memcpy(buf + len, line, n);
+		len += n;
+		lost = 0;
+		(*seq)++;
+	}
+	if (lost > 0 && len < size)
+		len += snprintf(buf + len, size - len, "[%" PRIu64 " log records lost]\n", lost);
+	return len < size ? len : size;
+}
@@ -0,0 +1,46 @@
+#ifndef RUNTIME_LOG_H
+#define RUNTIME_LOG_H
+
+#include <stdint.h>
+
+/* records kept by the log ring, must be a power of two */
+#define LOG_RING_SIZE       4096
+/* message bytes kept per record, longer messages are truncated */
+#define LOG_MSG_SIZE        248
+
+enum LogSeverity {
+	SEV_DEBUG,
+	SEV_INFO,
+	SEV_WARNING,
+	SEV_ERROR
+};
+
+struct LogRecord {
+	uint64_t seq;
+	uint64_t timestamp;     // CLOCK_REALTIME, ns
+	int severity;
+	int length;
+	char text[LOG_MSG_SIZE];
+};
+
+/* result of log_read() */
+enum LogReadResult {
+	LOG_READ_OK,
+	LOG_READ_PENDING,       // not written yet
+	LOG_READ_LOST           // overwritten before it was read, or dropped by its writer
+};
+
+/* counters of the log ring, see log_get_stats() */
+struct LogStats {
+	uint64_t written;       // records completed
+	uint64_t dropped;       // messages not logged because their slot was still being written
+	uint64_t truncated;     // messages cut to LOG_MSG_SIZE bytes
+};
+
+void log_write(int severity, const char *msg);
+uint64_t log_next_seq();
+uint64_t log_oldest_seq();
+int log_read(uint64_t seq, LogRecord *rec);
+void log_get_stats(LogStats *stats);
+int log_format(char *buf, int size, uint64_t *seq, bool details);
+#endif
@@ -0,0 +1,188 @@
+//-----------------------------------------------------------------------------
+// Duplicate elimination of replicated input streams (802.1CB vector recovery
+// algorithm). Every input stream may arrive over several disjoint paths, each
+// replica carrying the same pkt_id; the first copy wins.
+//
+// Off-target benchmark of loss and latency with one or two paths under
+// injected drops:
+//   g++ -std=gnu++11 -O2 -DRECOVERY_BENCH seq_recovery.cpp -o recovery_bench
+//   ./recovery_bench [frames] [burst]
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "seq_recovery.h"
+
+static inline void count(std::atomic<uint64_t> &counter, uint64_t n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void recovery_init(SeqRecovery *rcv, uint64_t reset_ns)
+{
+	rcv->last = 0;
+	rcv->history = 0;
+	rcv->take_any = true;
+	rcv->last_accept_ns = 0;
+	rcv->reset_ns = reset_ns;
+	rcv->passed = 0;
+	rcv->discarded = 0;
+	rcv->out_of_order = 0;
+	rcv->rogue = 0;
+	rcv->lost = 0;
+	rcv->resets = 0;
+	rcv->reset_gap = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true for the first copy of pkt_id, false for duplicates and frames
+// too old to tell
+//-----------------------------------------------------------------------------
+bool recovery_accept(SeqRecovery *rcv, uint32_t pkt_id, uint64_t now_ns)
+{
+	/* the talker restarted or the stream was down, its pkt_ids can start anywhere */
+	if (!rcv->take_any && now_ns - rcv->last_accept_ns > rcv->reset_ns) {
+		rcv->take_any = true;
+		count(rcv->resets, 1);
+		/* the window is dropped unseen, and a stream that was down continues after the pkt_ids it missed */
+		int32_t delta = (int32_t)(pkt_id - rcv->last);
+		if (delta > 0) {
+			count(rcv->lost, RECOVERY_HISTORY - __builtin_popcount(rcv->history));
+			count(rcv->reset_gap, (uint64_t)(delta - 1));
+		}
+	}
+	/* pkt_ids before the first one count as seen: late replicas of them are dropped, not reported lost */
+	if (rcv->take_any) {
+		rcv->take_any = false;
+		rcv->last = pkt_id;
+		rcv->history = ~0U;
+		rcv->last_accept_ns = now_ns;
+		count(rcv->passed, 1);
+		return true;
+	}
+
+	int32_t delta = (int32_t)(pkt_id - rcv->last);
+	if (delta > 0) {
+		/* bits shifted out of the window that were never set are lost pkt_ids */
+		uint64_t lost;
+		if (delta >= RECOVERY_HISTORY) {
+			lost = (RECOVERY_HISTORY - __builtin_popcount(rcv->history)) + (uint64_t)(delta - RECOVERY_HISTORY);
+			rcv->history = 1;
+		} else {
+			uint32_t gone = rcv->history >> (RECOVERY_HISTORY - delta);
+			lost = delta - __builtin_popcount(gone);
+			rcv->history = (rcv->history << delta) | 1;
+		}
+		count(rcv->lost, lost);
+		rcv->last = pkt_id;
+	} else if (-delta >= RECOVERY_HISTORY) {
+		count(rcv->rogue, 1);
+		return false;
+	} else if (rcv->history & (1U << -delta)) {
+		count(rcv->discarded, 1);
+		return false;
+	} else {
+		rcv->history |= 1U << -delta;
+		count(rcv->out_of_order, 1);
+	}
+	rcv->last_accept_ns = now_ns;
+	count(rcv->passed, 1);
+	return true;
+}
+
+int recovery_format_stats(char *buf, int size, const SeqRecovery *rcv, int n)
+{
+	int len = 0;
+	for (int i = 0; i < n && len < size; i++) {
+		len += snprintf(buf + len, size - len, "stream %d passed %" PRIu64 " discarded %" PRIu64 " out_of_order %" PRIu64
+			" rogue %" PRIu64 " lost %" PRIu64 " resets %" PRIu64 " reset_gap %" PRIu64 "\n", i,
+			rcv[i].passed.load(std::memory_order_relaxed), rcv[i].discarded.load(std::memory_order_relaxed),
+			rcv[i].out_of_order.load(std::memory_order_relaxed), rcv[i].rogue.load(std::memory_order_relaxed),
+			rcv[i].lost.load(std::memory_order_relaxed), rcv[i].resets.load(std::memory_order_relaxed),
+			rcv[i].reset_gap.load(std::memory_order_relaxed));
+	}
+	return len < size ? len : size - 1;
+}
+
+#ifdef RECOVERY_BENCH
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define BENCH_PERIOD_NS 20000   // frames sent every 20 us, replicas of neighbours overlap
+
+struct Arrival {
+	uint64_t at_ns;
+	uint32_t pkt_id;
+};
+
+/* path: base latency, uniform jitter, independent drops plus an optional outage of frames [burst_from, burst_to) */
+struct Path {
+	uint64_t base_ns;
+	uint64_t jitter_ns;
+	uint32_t burst_from;
+	uint32_t burst_to;
+};
+
+static void send(const Path &path, double drop, uint32_t frames, std::mt19937_64 &rng, std::vector<Arrival> &arrivals)
+{
+	std::uniform_real_distribution<double> coin(0.0, 1.0);
+	std::uniform_int_distribution<uint64_t> jitter(0, path.jitter_ns);
+	for (uint32_t id = 0; id < frames; id++) {
+		if (coin(rng) < drop || (id >= path.burst_from && id < path.burst_to)) continue;
+		arrivals.push_back({(uint64_t)id * BENCH_PERIOD_NS + path.base_ns + jitter(rng), id});
+	}
+}
+
+static void run(const char *name, const std::vector<Arrival> &sent, uint32_t frames)
+{
+	std::vector<Arrival> arrivals = sent;
+	std::sort(arrivals.begin(), arrivals.end(), [](const Arrival &a, const Arrival &b) { return a.at_ns < b.at_ns; });
+
+	SeqRecovery rcv;
+	recovery_init(&rcv, 100ULL * BENCH_PERIOD_NS);
+	std::vector<uint64_t> latency;
+	latency.reserve(frames);
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (const Arrival &a : arrivals) {
+		if (recovery_accept(&rcv, a.pkt_id, a.at_ns))
+			latency.push_back(a.at_ns - (uint64_t)a.pkt_id * BENCH_PERIOD_NS);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+	std::sort(latency.begin(), latency.end());
+	uint64_t delivered = latency.size();
+	printf("  %-10s loss %.6f%% (lost counter %" PRIu64 ", %" PRIu64 " resets skipping %" PRIu64 "), latency p50 %.1f us p99 %.1f us max %.1f us, "
+		"%" PRIu64 " duplicates dropped, %.1f ns/frame\n", name, 100.0 * (frames - delivered) / frames,
+		rcv.lost.load(), rcv.resets.load(), rcv.reset_gap.load(), delivered ? latency[delivered / 2] / 1e3 : 0.0,
+		delivered ? latency[delivered * 99 / 100] / 1e3 : 0.0, delivered ? latency.back() / 1e3 : 0.0,
+		rcv.discarded.load(), arrivals.empty() ? 0.0 : ns / arrivals.size());
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t frames = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1000000;
+	uint32_t burst = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1000;
+	/* the replica takes a longer path; path A goes down for burst frames in the middle */
+	Path a = {50000, 5000, frames / 2, frames / 2 + burst};
+	Path b = {65000, 20000, 0, 0};
+	const double drops[] = {0.0, 1e-4, 1e-3, 1e-2, 1e-1};
+
+	for (double drop : drops) {
+		printf("drop probability %g per path, outage of %" PRIu32 " frames on path A:\n", drop, burst);
+		std::mt19937_64 rng(1);
+		std::vector<Arrival> single, replicated;
+		send(a, drop, frames, rng, single);
+		replicated = single;
+		send(b, drop, frames, rng, replicated);
+		run("single", single, frames);
+		run("replicated", replicated, frames);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef SEQ_RECOVERY_H
+#define SEQ_RECOVERY_H
+
+#include <stdint.h>
+#include <atomic>
+
+/* pkt_ids remembered behind the newest accepted one */
+#define RECOVERY_HISTORY 32
+
+/* 802.1CB-style vector recovery of one input stream: the first copy of every pkt_id
+ * is accepted, replicas and frames older than the history window are discarded.
+ * Written by the RX thread only, the counters can be read from any thread.
+ */
+struct SeqRecovery {
+	uint32_t last;                      // newest accepted pkt_id
+	uint32_t history;                   // bit i: pkt_id last - i was accepted
+	bool take_any;                      // accept the next frame whatever its pkt_id
+	uint64_t last_accept_ns;
+	uint64_t reset_ns;                  // take any pkt_id after this long without an accepted frame
+	std::atomic<uint64_t> passed;
+	std::atomic<uint64_t> discarded;    // duplicates
+	std::atomic<uint64_t> out_of_order; // accepted, but older than the newest one
+	std::atomic<uint64_t> rogue;        // older than the history window
+	std::atomic<uint64_t> lost;         // pkt_ids that left the history window unseen
+	std::atomic<uint64_t> resets;
+	std::atomic<uint64_t> reset_gap;    // pkt_ids skipped across resets, a restarted talker may also jump
+};
+
+void recovery_init(SeqRecovery *rcv, uint64_t reset_ns);
+bool recovery_accept(SeqRecovery *rcv, uint32_t pkt_id, uint64_t now_ns);
+int recovery_format_stats(char *buf, int size, const SeqRecovery *rcv, int count);
+
+/* one per input stream, NULL until the hardware layer is initialized */
+extern SeqRecovery *rx_recovery;
+#endif
@@ -17,7 +17,8 @@
 //------
 //
 // This is the file for the network routines of the OpenPLC. It has procedures
-// to create a socket, bind it and start network communication.
+// to create a socket, bind it and start network communication. Each server
+// serves all of its clients from one thread with epoll.
 // Thiago Alves, Dec 2015
 //-----------------------------------------------------------------------------
 
@@ -29,6 +30,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include "ladder.h"
 
@@ -36,6 +39,26 @@
 #define MAX_OUTPUT 16
 #define MAX_MODBUS 100
 #define NET_BUFFER_SIZE 10000
+#define MAX_CONNECTIONS 32          // clients served at once per protocol
+#define SERVER_POLL_MS 100          // how long a stopped server takes to notice
+#define MAX_PIPELINE 16             // Modbus ADUs answered per writev()
+#define MODBUS_SLOT_SIZE 300        // a request answered in place, up to 264 bytes
+
+//-----------------------------------------------------------------------------
+// A client session. Received bytes wait in in until a whole frame is there,
+// and the part of the responses the socket did not take at once waits in out.
+// Pipelined Modbus requests are answered in place in their own slot of adu
+//-----------------------------------------------------------------------------
+struct Connection
+{
+    int fd;
+    int slot;
+    unsigned char in[NET_BUFFER_SIZE];
+    int in_len;
+    unsigned char out[NET_BUFFER_SIZE];
+    int out_len;
+    unsigned char adu[MAX_PIPELINE][MODBUS_SLOT_SIZE];
+};
 
 
 //-----------------------------------------------------------------------------
@@ -95,7 +118,7 @@ int createSocket(uint16_t port)
     if (socket_fd<0)
     {
         sprintf(log_msg, "Server: error creating stream socket => %s\n", strerror(errno));
-        log(log_msg);
+        log(SEV_ERROR, log_msg);
         return -1;
     }
     
@@ -116,7 +139,7 @@ int createSocket(uint16_t port)
     if (bind(socket_fd,(struct sockaddr *)&server_addr,sizeof(server_addr)) < 0)
     {
         sprintf(log_msg, "Server: error binding socket => %s\n", strerror(errno));
-        log(log_msg);
+        log(SEV_ERROR, log_msg);
         return -1;
     }
     
@@ -129,133 +152,236 @@ int createSocket(uint16_t port)
 }
 
 //-----------------------------------------------------------------------------
-// Blocking call. Wait here for the client to connect. Returns the file
-// descriptor to communicate with the client.
+// Size of the frame at the start of buffer, taken from its header: the MBAP
+// length for Modbus/TCP, the encapsulation length for EtherNet/IP. Returns 0
+// while the header itself is incomplete, and -1 for a header no valid frame
+// has, after which the stream cannot be followed any more
 //-----------------------------------------------------------------------------
-int waitForClient(int socket_fd, int protocol_type)
+int frameSize(unsigned char *buffer, int len, int protocol_type)
 {
-    unsigned char log_msg[1000];
-    int client_fd;
-    struct sockaddr_in client_addr;
-    bool *run_server;
-    socklen_t client_len;
-
     if (protocol_type == MODBUS_PROTOCOL)
-        run_server = &run_modbus;
-    else if (protocol_type == ENIP_PROTOCOL)
-        run_server = &run_enip;
-    
-    sprintf(log_msg, "Server: waiting for new client...\n");
-    log(log_msg);
-
-    client_len = sizeof(client_addr);
-    while (*run_server)
     {
-        client_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &client_len); //non-blocking call
-        if (client_fd > 0)
-        {
-            SetSocketBlockingEnabled(client_fd, true);
-            break;
-        }
-        sleepms(100);
+        if (len < 6) return 0;
+        int length = (buffer[4] << 8) | buffer[5]; //unit identifier and PDU
+        bool modbus = (buffer[2] == 0 && buffer[3] == 0);
+        return (modbus && length >= 2 && length <= 254) ? 6 + length : -1;
+    }
+    else
+    {
+        if (len < 24) return 0;
+        int size = 24 + (buffer[2] | (buffer[3] << 8));
+        return (size <= NET_BUFFER_SIZE) ? size : -1;
     }
-
-    return client_fd;
 }
 
 //-----------------------------------------------------------------------------
-// Blocking call. Holds here until something is received from the client.
-// Once the message is received, it is stored on the buffer and the function
-// returns the number of bytes received.
+// Send count responses with one system call, keeping in out what the socket
+// does not take. Returns false if the connection failed
 //-----------------------------------------------------------------------------
-int listenToClient(int client_fd, unsigned char *buffer)
+bool sendResponses(Connection *conn, struct iovec *iov, int count)
 {
-    bzero(buffer, NET_BUFFER_SIZE);
-    int n = read(client_fd, buffer, NET_BUFFER_SIZE);
-    return n;
+    int n = writev(conn->fd, iov, count);
+    if (n < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+        n = 0;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int len = iov[i].iov_len;
+        int skip = (n < len) ? n : len;
+        n -= skip;
+        memcpy(conn->out + conn->out_len, (unsigned char *)iov[i].iov_base + skip, len - skip);
+        conn->out_len += len - skip;
+    }
+    return true;
 }
 
 //-----------------------------------------------------------------------------
-// Process client's request
+// Write as much of the pending response as the socket takes. Returns false
+// if the connection failed
 //-----------------------------------------------------------------------------
-void processMessage(unsigned char *buffer, int bufferSize, int client_fd, int protocol_type)
+bool flushClient(Connection *conn)
 {
-    if (protocol_type == MODBUS_PROTOCOL)
+    while (conn->out_len > 0)
     {
-        int messageSize = processModbusMessage(buffer, bufferSize);
-        write(client_fd, buffer, messageSize);
-    }
-    else if (protocol_type == ENIP_PROTOCOL)
-    {
-        int messageSize = processEnipMessage(buffer, bufferSize);
-        write(client_fd, buffer, messageSize);
+        int n = write(conn->fd, conn->out, conn->out_len);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        memmove(conn->out, conn->out + n, conn->out_len - n);
+        conn->out_len -= n;
     }
+    return true;
 }
 
 //-----------------------------------------------------------------------------
-// Thread to handle requests for each connected client
+// Process the complete frames received from the client, in order. Modbus
+// ADUs are answered in batches of up to MAX_PIPELINE, each batch sent with
+// one writev(); EtherNet/IP requests one at a time. Responses the socket does
+// not take at once are kept in out, and no further frame is processed until
+// they are gone. Returns false if the connection must be closed
 //-----------------------------------------------------------------------------
-void *handleConnections(void *arguments)
+bool serveFrames(Connection *conn, int protocol_type)
 {
     unsigned char log_msg[1000];
-    int *args = (int *)arguments;
-    int client_fd = args[0];
-    int protocol_type = args[1];
     unsigned char buffer[NET_BUFFER_SIZE];
-    int messageSize;
-    bool *run_server;
-    
-    if (protocol_type == MODBUS_PROTOCOL)
-        run_server = &run_modbus;
-    else if (protocol_type == ENIP_PROTOCOL)
-        run_server = &run_enip;
+    struct iovec iov[MAX_PIPELINE];
+    int offset = 0;
+    bool complete = true;
 
-    sprintf(log_msg, "Server: Thread created for client ID: %d\n", client_fd);
-    log(log_msg);
-
-    while(*run_server)
+    while (conn->out_len == 0 && complete)
     {
-        //unsigned char buffer[NET_BUFFER_SIZE];
-        //int messageSize;
-
-        messageSize = listenToClient(client_fd, buffer);
-        if (messageSize <= 0 || messageSize > NET_BUFFER_SIZE)
+        int count = 0;
+        while (count < MAX_PIPELINE)
         {
-            // something has  gone wrong or the client has closed connection
-            if (messageSize == 0)
+            int size = frameSize(conn->in + offset, conn->in_len - offset, protocol_type);
+            if (size < 0)
             {
-                sprintf(log_msg, "Modbus Server: client ID: %d has closed the connection\n", client_fd);
-                log(log_msg);
+                sprintf(log_msg, "Server: client ID: %d sent an invalid frame header, closing the connection\n", conn->fd);
+                log(SEV_ERROR, log_msg);
+                return false;
             }
+            if (size == 0 || size > conn->in_len - offset)
+            {
+                complete = false;
+                break;
+            }
+
+            //the request is processed in place and the response may be longer
+            unsigned char *frame = (protocol_type == MODBUS_PROTOCOL) ? conn->adu[count] : buffer;
+            memcpy(frame, conn->in + offset, size);
+            offset += size;
+
+            int messageSize;
+            if (protocol_type == MODBUS_PROTOCOL)
+                messageSize = processModbusMessage(frame, size);
             else
+                messageSize = processEnipMessage(frame, size);
+
+            if (messageSize > 0)
             {
-                sprintf(log_msg, "Modbus Server: Something is wrong with the  client ID: %d message Size : %i\n", client_fd, messageSize);
-                log(log_msg);
+                iov[count].iov_base = frame;
+                iov[count].iov_len = messageSize;
+                count++;
             }
-            break;
+            if (protocol_type != MODBUS_PROTOCOL) break;
         }
 
-        processMessage(buffer, messageSize, client_fd, protocol_type);
+        if (count > 0 && !sendResponses(conn, iov, count)) return false;
     }
-    //printf("Debug: Closing client socket and calling pthread_exit in server.cpp\n");
-    close(client_fd);
-    sprintf(log_msg, "Terminating Modbus connections thread\r\n");
-    log(log_msg);
-    pthread_exit(NULL);
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Read what the client sent and serve it. Returns false if the client closed
+// the connection or it failed
+//-----------------------------------------------------------------------------
+bool readClient(Connection *conn, int protocol_type)
+{
+    unsigned char log_msg[1000];
+
+    int n = read(conn->fd, conn->in + conn->in_len, NET_BUFFER_SIZE - conn->in_len);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return true;
+    if (n <= 0)
+    {
+        // something has gone wrong or the client has closed connection
+        if (n == 0)
+            sprintf(log_msg, "Server: client ID: %d has closed the connection\n", conn->fd);
+        else
+            sprintf(log_msg, "Server: Something is wrong with the client ID: %d => %s\n", conn->fd, strerror(errno));
+        log(SEV_ERROR, log_msg);
+        return false;
+    }
+
+    conn->in_len += n;
+    return serveFrames(conn, protocol_type);
+}
+
+//-----------------------------------------------------------------------------
+// Wait for requests while nothing is pending for the client, and for the
+// socket to drain otherwise
+//-----------------------------------------------------------------------------
+void watchClient(int epoll_fd, Connection *conn, int op)
+{
+    struct epoll_event ev;
+    ev.events = (conn->out_len > 0) ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(epoll_fd, op, conn->fd, &ev);
+}
+
+//-----------------------------------------------------------------------------
+// Accept every pending client, up to MAX_CONNECTIONS sessions
+//-----------------------------------------------------------------------------
+void acceptClients(int socket_fd, int epoll_fd, Connection **connections)
+{
+    unsigned char log_msg[1000];
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+
+    while (1)
+    {
+        client_len = sizeof(client_addr);
+        int client_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (client_fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                sprintf(log_msg, "Server: Error accepting client! => %s\n", strerror(errno));
+                log(SEV_ERROR, log_msg);
+            }
+            return;
+        }
+
+        int slot = 0;
+        while (slot < MAX_CONNECTIONS && connections[slot] != NULL) slot++;
+        if (slot == MAX_CONNECTIONS)
+        {
+            sprintf(log_msg, "Server: %d clients already connected, refusing client ID: %d\n", MAX_CONNECTIONS, client_fd);
+            log(log_msg);
+            close(client_fd);
+            continue;
+        }
+
+        SetSocketBlockingEnabled(client_fd, false);
+        Connection *conn = new Connection();
+        conn->fd = client_fd;
+        conn->slot = slot;
+        connections[slot] = conn;
+        watchClient(epoll_fd, conn, EPOLL_CTL_ADD);
+
+        sprintf(log_msg, "Server: Client accepted! Client ID: %d\n", client_fd);
+        log(log_msg);
+    }
+}
+
+void dropClient(int epoll_fd, Connection *conn, Connection **connections)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    connections[conn->slot] = NULL;
+    delete conn;
 }
 
 //-----------------------------------------------------------------------------
 // Function to start the server. It receives the port number as argument and
-// creates an infinite loop to listen and parse the messages sent by the
-// clients
+// serves every client of the protocol from this thread, waiting on epoll for
+// new clients and for requests, until the server is stopped
 //-----------------------------------------------------------------------------
 void startServer(uint16_t port, int protocol_type)
 {
     unsigned char log_msg[1000];
-    int socket_fd, client_fd;
+    int socket_fd, epoll_fd;
     bool *run_server;
-    
-    socket_fd = createSocket(port);
+    Connection *connections[MAX_CONNECTIONS] = {NULL};
+    struct epoll_event events[MAX_CONNECTIONS + 1];
     
     if (protocol_type == MODBUS_PROTOCOL)
     {
@@ -265,33 +391,53 @@ void startServer(uint16_t port, int protocol_type)
     else if (protocol_type == ENIP_PROTOCOL)
         run_server = &run_enip;
     
-    while(*run_server)
+    socket_fd = createSocket(port);
+    epoll_fd = epoll_create1(0);
+    if (socket_fd < 0 || epoll_fd < 0)
     {
-        client_fd = waitForClient(socket_fd, protocol_type); //block until a client connects
-        if (client_fd < 0)
-        {
-            sprintf(log_msg, "Server: Error accepting client!\n");
-            log(log_msg);
-        }
+        sprintf(log_msg, "Server: could not start on port %d\n", port);
+        log(SEV_ERROR, log_msg);
+        if (socket_fd >= 0) close(socket_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        return;
+    }
 
-        else
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; //the listening socket
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &ev);
+    
+    while(*run_server)
+    {
+        int n = epoll_wait(epoll_fd, events, MAX_CONNECTIONS + 1, SERVER_POLL_MS);
+        for (int i = 0; i < n; i++)
         {
-            int arguments[2];
-            pthread_t thread;
-            int ret = -1;
-            sprintf(log_msg, "Server: Client accepted! Creating thread for the new client ID: %d...\n", client_fd);
-            log(log_msg);
-            arguments[0] = client_fd;
-            arguments[1] = protocol_type;
-            ret = pthread_create(&thread, NULL, handleConnections, (void*)arguments);
-            if (ret==0) 
+            Connection *conn = (Connection *)events[i].data.ptr;
+            if (conn == NULL)
             {
-                pthread_detach(thread);
+                acceptClients(socket_fd, epoll_fd, connections);
+                continue;
             }
+
+            bool alive;
+            if (conn->out_len > 0)
+                alive = flushClient(conn) && serveFrames(conn, protocol_type);
+            else
+                alive = readClient(conn, protocol_type);
+
+            if (alive && !(events[i].events & (EPOLLERR | EPOLLHUP)))
+                watchClient(epoll_fd, conn, EPOLL_CTL_MOD);
+            else
+                dropClient(epoll_fd, conn, connections);
         }
     }
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        if (connections[i] != NULL) dropClient(epoll_fd, connections[i], connections);
+    }
+    close(epoll_fd);
     close(socket_fd);
-    close(client_fd);
     sprintf(log_msg, "Terminating Server thread\r\n");
     log(log_msg);
-}
\ No newline at end of file
+}
@@ -0,0 +1,311 @@
+/*
+ * @Description: Runtime thread policy. The policy file has one line per thread
+ * role:
+ *
+ *     # role         class  priority  cpus  stack_kb
+ *     scan           fifo   80        1     256
+ *
+ * class is fifo or rr with a priority of 1-99, or other, batch or idle with
+ * the nice value as priority. cpus is a list such as 0,1 or 0-1, * for every
+ * CPU. The stack of the thread is pre-faulted for stack_kb kilobytes. The role
+ * default applies to the roles without a line of their own. "memlock on" locks
+ * the memory of the process, so that the pre-faulted stacks stay resident.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "thread_policy.h"
+#include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define STACK_GUARD_BYTES   (64 * 1024)     // stack left untouched below the pre-faulted part
+
+struct thread_rule {
+    char role[THREAD_ROLE_NAME_SIZE];
+    int policy;                 // SCHED_*
+    int priority;               // 1-99 for SCHED_FIFO and SCHED_RR, nice value otherwise
+    char cpu_list[32];
+    cpu_set_t cpus;
+    int stack_kb;
+    int threads;                // threads that applied the rule
+    int violations;
+    int last_tid;
+};
+
+struct sched_class {
+    const char *name;
+    int policy;
+};
+
+static const struct sched_class sched_classes[] = {
+    {"fifo", SCHED_FIFO},
+    {"rr", SCHED_RR},
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+};
+#define SCHED_CLASS_COUNT (int)(sizeof(sched_classes) / sizeof(sched_classes[0]))
+
+static struct thread_rule rules[THREAD_POLICY_MAX_ROLES];
+static int rule_count = 0;
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *class_name(int policy) {
+    for (int i = 0; i < SCHED_CLASS_COUNT; i++) {
+        if (sched_classes[i].policy == policy) return sched_classes[i].name;
+    }
+    return "unknown";
+}
+
+static int is_realtime(int policy) {
+    return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+// parses "0,2-3" or "*" into cpus, returns -1 if the list is invalid
+static int parse_cpu_list(const char *list, cpu_set_t *cpus, const cpu_set_t *online) {
+    if (strcmp(list, "*") == 0) {
+        *cpus = *online;
+        return 0;
+    }
+    CPU_ZERO(cpus);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) return -1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return -1;
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, cpus);
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        p = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+// warns about what keeps the policy from being met, returns the number of warnings
+static int check_policy(const cpu_set_t *online) {
+    int warnings = 0;
+
+    FILE *file = fopen("/proc/sys/kernel/sched_rt_runtime_us", "r");
+    long rt_runtime = -1;
+    if (file) {
+        if (fscanf(file, "%ld", &rt_runtime) != 1) rt_runtime = -1;
+        fclose(file);
+    }
+    for (int i = 0; i < rule_count; i++) {
+        if (is_realtime(rules[i].policy) && rt_runtime >= 0) {
+            printf("Thread policy: RT throttling is on (sched_rt_runtime_us = %ld), real-time threads can be stopped every period\n", rt_runtime);
+            warnings++;
+            break;
+        }
+    }
+
+    for (int i = 0; i < rule_count; i++) {
+        cpu_set_t usable;
+        CPU_AND(&usable, &rules[i].cpus, online);
+        if (!CPU_EQUAL(&usable, &rules[i].cpus)) {
+            printf("Thread policy: %s asks for CPUs %s, but the process may only run on some of them\n", rules[i].role, rules[i].cpu_list);
+            warnings++;
+        }
+        // threads of one SCHED_FIFO priority on a CPU cannot preempt each other
+        for (int j = i + 1; j < rule_count; j++) {
+            cpu_set_t shared;
+            CPU_AND(&shared, &rules[i].cpus, &rules[j].cpus);
+            if (rules[i].policy == SCHED_FIFO && rules[j].policy == SCHED_FIFO &&
+                rules[i].priority == rules[j].priority && CPU_COUNT(&shared) > 0) {
+                printf("Thread policy: %s and %s share a CPU at SCHED_FIFO priority %d\n", rules[i].role, rules[j].role, rules[i].priority);
+                warnings++;
+            }
+        }
+    }
+    return warnings;
+}
+
+int thread_policy_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Thread policy: %s not found, threads keep the default scheduling\n", path);
+        return -1;
+    }
+
+    cpu_set_t online;
+    if (sched_getaffinity(0, sizeof(online), &online) != 0) {
+        CPU_ZERO(&online);
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); cpu++) CPU_SET(cpu, &online);
+    }
+
+    char line[256];
+    int line_no = 0;
+    int memlock = 0;
+    int count = 0;
+    pthread_mutex_lock(&policy_lock);
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char role[64], class_str[16], cpu_list[64];
+        int priority, stack_kb;
+        int n = sscanf(line, "%63s %15s %d %63s %d", role, class_str, &priority, cpu_list, &stack_kb);
+        if (n <= 0) continue;
+        if (n == 2 && strcmp(role, "memlock") == 0) {
+            memlock = strcmp(class_str, "on") == 0;
+            continue;
+        }
+
+        const char *error = NULL;
+        struct thread_rule *rule = &rules[count];
+        cpu_set_t cpus;
+        int c;
+        for (c = 0; c < SCHED_CLASS_COUNT && strcmp(sched_classes[c].name, class_str) != 0; c++);
+        if (n != 5) error = "expected role, class, priority, cpus and stack_kb";
+        else if (strlen(role) >= THREAD_ROLE_NAME_SIZE) error = "role names have at most 15 characters";
+        else if (count == THREAD_POLICY_MAX_ROLES) error = "too many roles";
+        else if (c == SCHED_CLASS_COUNT) error = "class must be fifo, rr, other, batch or idle";
+        else if (is_realtime(sched_classes[c].policy) && (priority < 1 || priority > 99)) error = "fifo and rr priorities are 1-99";
+        else if (!is_realtime(sched_classes[c].policy) && (priority < -20 || priority > 19)) error = "nice values are -20 to 19";
+        else if (strlen(cpu_list) >= sizeof(rule->cpu_list) || parse_cpu_list(cpu_list, &cpus, &online) != 0) error = "invalid cpu list";
+        else if (stack_kb < 0) error = "stack_kb must not be negative";
+        if (error) {
+            printf("Thread policy: %s line %d: %s\n", path, line_no, error);
+            rule_count = 0;
+            pthread_mutex_unlock(&policy_lock);
+            fclose(file);
+            return -1;
+        }
+
+        memset(rule, 0, sizeof(*rule));
+        strcpy(rule->role, role);
+        rule->policy = sched_classes[c].policy;
+        rule->priority = priority;
+        strcpy(rule->cpu_list, cpu_list);
+        rule->cpus = cpus;
+        rule->stack_kb = stack_kb;
+        count++;
+    }
+    fclose(file);
+    rule_count = count;
+    check_policy(&online);
+    pthread_mutex_unlock(&policy_lock);
+
+    if (memlock && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        printf("Thread policy: failed to lock memory: %s\n", strerror(errno));
+    }
+    printf("Thread policy: %d roles read from %s\n", count, path);
+    return count;
+}
+
+// touches the next bytes of the stack, so that the thread does not page fault on them later
+static void __attribute__((noinline)) prefault_stack(size_t bytes) {
+    pthread_attr_t attr;
+    size_t stack_size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstacksize(&attr, &stack_size);
+        pthread_attr_destroy(&attr);
+    }
+    if (stack_size > 0 && bytes + STACK_GUARD_BYTES > stack_size) {
+        bytes = stack_size > STACK_GUARD_BYTES ? stack_size - STACK_GUARD_BYTES : 0;
+    }
+
+    volatile char *stack = (volatile char *)alloca(bytes);
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < bytes; i += page) stack[i] = 0;
+}
+
+int thread_policy_apply(const char *role) {
+    char name[THREAD_ROLE_NAME_SIZE];
+    snprintf(name, sizeof(name), "%s", role);
+    pthread_setname_np(pthread_self(), name);
+
+    pthread_mutex_lock(&policy_lock);
+    struct thread_rule *rule = NULL;
+    for (int i = 0; i < rule_count && rule == NULL; i++) {
+        if (strcmp(rules[i].role, role) == 0) rule = &rules[i];
+    }
+    for (int i = 0; i < rule_count && rule == NULL; i++) {
+        if (strcmp(rules[i].role, "default") == 0) rule = &rules[i];
+    }
+    int loaded = rule_count > 0;
+    pthread_mutex_unlock(&policy_lock);
+    if (rule == NULL) {
+        if (loaded) printf("Thread policy: no rule for %s and no default rule\n", role);
+        return loaded ? 1 : 0;
+    }
+
+    int tid = (int)syscall(SYS_gettid);
+    struct sched_param param;
+    param.sched_priority = is_realtime(rule->policy) ? rule->priority : 0;
+    int ret = pthread_setschedparam(pthread_self(), rule->policy, &param);
+    if (ret != 0) {
+        printf("Thread policy: %s (tid %d) failed to set %s %d: %s\n", role, tid, class_name(rule->policy), param.sched_priority, strerror(ret));
+    }
+    if (!is_realtime(rule->policy) && setpriority(PRIO_PROCESS, tid, rule->priority) != 0) {
+        printf("Thread policy: %s (tid %d) failed to set nice %d: %s\n", role, tid, rule->priority, strerror(errno));
+    }
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(rule->cpus), &rule->cpus);
+    if (ret != 0) {
+        printf("Thread policy: %s (tid %d) failed to set CPUs %s: %s\n", role, tid, rule->cpu_list, strerror(ret));
+    }
+    prefault_stack((size_t)rule->stack_kb * 1024);
+
+    // read back what the thread got
+    int violations = 0;
+    int policy;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0 || policy != rule->policy ||
+        (is_realtime(policy) && param.sched_priority != rule->priority)) {
+        printf("Thread policy: %s (tid %d) runs %s %d instead of %s %d\n", role, tid, class_name(policy), param.sched_priority,
+               class_name(rule->policy), rule->priority);
+        violations++;
+    }
+    if (!is_realtime(rule->policy)) {
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, tid);
+        if (errno == 0 && nice != rule->priority) {
+            printf("Thread policy: %s (tid %d) runs at nice %d instead of %d\n", role, tid, nice, rule->priority);
+            violations++;
+        }
+    }
+    cpu_set_t cpus;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0 || !CPU_EQUAL(&cpus, &rule->cpus)) {
+        printf("Thread policy: %s (tid %d) does not run on CPUs %s only\n", role, tid, rule->cpu_list);
+        violations++;
+    }
+
+    pthread_mutex_lock(&policy_lock);
+    rule->threads++;
+    rule->violations += violations;
+    rule->last_tid = tid;
+    pthread_mutex_unlock(&policy_lock);
+    return violations;
+}
+
+int thread_policy_format(char *buf, int size) {
+    int len = 0;
+    pthread_mutex_lock(&policy_lock);
+    if (rule_count == 0 && size > 0) {
+        len += snprintf(buf, size, "no thread policy loaded\n");
+    }
+    for (int i = 0; i < rule_count && len < size; i++) {
+        struct thread_rule *rule = &rules[i];
+        len += snprintf(buf + len, size - len, "%-15s %-5s %3d cpus %-8s stack %5d KB threads %d last tid %d violations %d\n",
+                        rule->role, class_name(rule->policy), rule->priority, rule->cpu_list, rule->stack_kb,
+                        rule->threads, rule->last_tid, rule->violations);
+    }
+    pthread_mutex_unlock(&policy_lock);
+    return len < size ? len : size;
+}
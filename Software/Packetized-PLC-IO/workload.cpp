@@ -0,0 +1,242 @@
+//-----------------------------------------------------------------------------
+// Synthetic control workloads for packetized PLC benchmarking. Each kernel
+// runs a number of iterations of one unit of work; workload_init() measures
+// the cost of an iteration on the running machine and sizes the kernel to
+// the target duration, so the same configuration holds on any board (or off
+// target). workload_run() times every cycle with CLOCK_MONOTONIC and records
+// actual against planned compute time.
+//
+// Off-target benchmark:
+//   g++ -std=gnu++11 -O2 -DWORKLOAD_BENCH -I lib workload.cpp workload_fb.cpp -o workload_bench
+//   ./workload_bench [cpu|memory|fb] [target_us] [cycles]
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <algorithm>
+
+#include "workload.h"
+
+#define CALIBRATION_MIN_NS   2000000   // every calibration run lasts at least 2 ms
+#define CALIBRATION_RUNS     5         // the median iteration cost of these runs is used
+#define MEMORY_BUFFER_BYTES  (8 * 1024 * 1024)
+#define CACHE_LINE           64
+
+static WorkloadKind workload_kind = WORKLOAD_NONE;
+static uint64_t planned_iterations = 0;
+static double ns_per_iteration = 0;
+static WorkloadStats stats;
+
+/* results are written here so the compiler keeps the kernels */
+static volatile double sink_real;
+static volatile uint32_t sink_index;
+
+static inline uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// CPU-bound: cascaded position/velocity PID with a second order output filter
+//-----------------------------------------------------------------------------
+static double cpu_state[8];
+
+static void cpu_kernel(uint64_t iterations)
+{
+	double setpoint = 1.0, pos = cpu_state[0], vel = cpu_state[1];
+	double i_pos = cpu_state[2], i_vel = cpu_state[3], e_vel_prev = cpu_state[4];
+	double y1 = cpu_state[5], y2 = cpu_state[6];
+	const double dt = 1e-3;
+	for (uint64_t k = 0; k < iterations; k++) {
+		double e_pos = setpoint - pos;
+		i_pos += e_pos * dt;
+		double vel_ref = 2.0 * e_pos + 0.5 * i_pos;
+		vel_ref = std::max(-10.0, std::min(10.0, vel_ref));
+		double e_vel = vel_ref - vel;
+		i_vel += e_vel * dt;
+		double u = 1.2 * e_vel + 0.8 * i_vel + 0.01 * (e_vel - e_vel_prev) / dt;
+		e_vel_prev = e_vel;
+		double y = 0.2 * u + 1.6 * y1 - 0.64 * y2;
+		y2 = y1;
+		y1 = y;
+		vel += (y - 0.1 * vel) * dt;
+		pos += vel * dt;
+		if (k % 4096 == 4095) setpoint = -setpoint;
+	}
+	cpu_state[0] = pos; cpu_state[1] = vel; cpu_state[2] = i_pos; cpu_state[3] = i_vel;
+	cpu_state[4] = e_vel_prev; cpu_state[5] = y1; cpu_state[6] = y2;
+	sink_real = pos;
+}
+
+//-----------------------------------------------------------------------------
+// Memory-bound: pointer chase over cache lines in a random single cycle
+//-----------------------------------------------------------------------------
+struct ChaseNode {
+	uint32_t next;
+	uint8_t pad[CACHE_LINE - sizeof(uint32_t)];
+};
+
+static ChaseNode *chase_nodes = NULL;
+static uint32_t chase_index = 0;
+
+static void memory_setup()
+{
+	if (chase_nodes) return;
+	uint32_t n = MEMORY_BUFFER_BYTES / sizeof(ChaseNode);
+	chase_nodes = (ChaseNode *)malloc(n * sizeof(ChaseNode));
+	uint32_t *order = (uint32_t *)malloc(n * sizeof(uint32_t));
+	for (uint32_t i = 0; i < n; i++) order[i] = i;
+	/* Sattolo's algorithm: a random permutation that is a single cycle */
+	srand(1);
+	for (uint32_t i = n - 1; i > 0; i--) {
+		uint32_t j = (uint32_t)(((uint64_t)rand() * i) / ((uint64_t)RAND_MAX + 1));
+		std::swap(order[i], order[j]);
+	}
+	for (uint32_t i = 0; i < n; i++) chase_nodes[order[i]].next = order[(i + 1) % n];
+	free(order);
+}
+
+static void memory_kernel(uint64_t iterations)
+{
+	uint32_t idx = chase_index;
+	for (uint64_t k = 0; k < iterations; k++) idx = chase_nodes[idx].next;
+	chase_index = idx;
+	sink_index = idx;
+}
+
+static void run_kernel(WorkloadKind kind, uint64_t iterations)
+{
+	switch (kind) {
+	case WORKLOAD_CPU:    cpu_kernel(iterations); break;
+	case WORKLOAD_MEMORY: memory_kernel(iterations); break;
+	case WORKLOAD_FB_MIX: workload_fb_kernel(iterations); break;
+	default: break;
+	}
+}
+
+const char *workload_name(WorkloadKind kind)
+{
+	switch (kind) {
+	case WORKLOAD_CPU:    return "cpu";
+	case WORKLOAD_MEMORY: return "memory";
+	case WORKLOAD_FB_MIX: return "fb_mix";
+	default:              return "none";
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Measure the cost of one iteration of the kernel and size it to target_ns
+//-----------------------------------------------------------------------------
+void workload_init(WorkloadKind kind, uint64_t target_ns)
+{
+	workload_kind = kind;
+	planned_iterations = 0;
+	workload_reset_stats();
+	stats.planned_ns = target_ns;
+	if (kind == WORKLOAD_NONE || target_ns == 0) return;
+
+	if (kind == WORKLOAD_MEMORY) memory_setup();
+	if (kind == WORKLOAD_FB_MIX) workload_fb_setup();
+
+	/* grow the run until it is long enough to time, warming up caches on the way */
+	uint64_t iterations = 1024, elapsed = 0;
+	while (1) {
+		uint64_t start = monotonic_ns();
+		run_kernel(kind, iterations);
+		elapsed = monotonic_ns() - start;
+		if (elapsed >= CALIBRATION_MIN_NS) break;
+		iterations *= 2;
+	}
+
+	double cost[CALIBRATION_RUNS];
+	for (int i = 0; i < CALIBRATION_RUNS; i++) {
+		uint64_t start = monotonic_ns();
+		run_kernel(kind, iterations);
+		cost[i] = (double)(monotonic_ns() - start) / iterations;
+	}
+	std::sort(cost, cost + CALIBRATION_RUNS);
+	ns_per_iteration = cost[CALIBRATION_RUNS / 2];
+	planned_iterations = (uint64_t)(target_ns / ns_per_iteration);
+
+	printf("workload %s: %.2f ns per iteration, %" PRIu64 " iterations for %" PRIu64 " ns\n",
+		workload_name(kind), ns_per_iteration, planned_iterations, target_ns);
+}
+
+//-----------------------------------------------------------------------------
+// Resize the calibrated workload to target_ns, e.g. for the compute window of
+// another job. Does nothing before workload_init() calibrated the kernel.
+//-----------------------------------------------------------------------------
+void workload_set_target(uint64_t target_ns)
+{
+	stats.planned_ns = target_ns;
+	planned_iterations = ns_per_iteration > 0 ? (uint64_t)(target_ns / ns_per_iteration) : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Run one cycle of the calibrated workload, returns its actual duration (ns)
+//-----------------------------------------------------------------------------
+uint64_t workload_run()
+{
+	if (planned_iterations == 0) return 0;
+
+	uint64_t start = monotonic_ns();
+	run_kernel(workload_kind, planned_iterations);
+	uint64_t actual = monotonic_ns() - start;
+
+	if (stats.count == 0 || actual < stats.min_ns) stats.min_ns = actual;
+	if (stats.count == 0 || actual > stats.max_ns) stats.max_ns = actual;
+	if (actual > stats.planned_ns + stats.planned_ns / 10) stats.overruns++;
+	stats.count++;
+	stats.last_ns = actual;
+	stats.sum_ns += actual;
+	return actual;
+}
+
+void workload_get_stats(WorkloadStats *out)
+{
+	*out = stats;
+}
+
+void workload_reset_stats()
+{
+	uint64_t planned = stats.planned_ns;
+	memset(&stats, 0, sizeof(stats));
+	stats.planned_ns = planned;
+}
+
+int workload_format_stats(char *buf, int size, const WorkloadStats *stats)
+{
+	if (stats->count == 0 || size <= 0) return 0;
+	int len = snprintf(buf, size, "workload %s over %" PRIu64 " cycles: planned %" PRIu64 " ns, actual min %" PRIu64 " ns, max %" PRIu64 " ns, mean %.1f ns, overruns %" PRIu64 "\n",
+		workload_name(workload_kind), stats->count, stats->planned_ns, stats->min_ns, stats->max_ns, stats->sum_ns / stats->count, stats->overruns);
+	return len < size ? len : size - 1;
+}
+
+void workload_print_stats()
+{
+	char line[256];
+	if (workload_format_stats(line, sizeof(line), &stats) > 0) printf("%s", line);
+}
+
+#ifdef WORKLOAD_BENCH
+int main(int argc, char **argv)
+{
+	WorkloadKind kind = WORKLOAD_CPU;
+	if (argc > 1) {
+		if (strcmp(argv[1], "memory") == 0) kind = WORKLOAD_MEMORY;
+		else if (strcmp(argv[1], "fb") == 0) kind = WORKLOAD_FB_MIX;
+	}
+	uint64_t target_ns = (argc > 2 ? strtoull(argv[2], NULL, 10) : 6000) * 1000;
+	int cycles = argc > 3 ? atoi(argv[3]) : 1000;
+
+	workload_init(kind, target_ns);
+	for (int i = 0; i < cycles; i++) workload_run();
+	workload_print_stats();
+	return 0;
+}
+#endif
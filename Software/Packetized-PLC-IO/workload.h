@@ -0,0 +1,37 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdint.h>
+
+/* Synthetic control workloads used in place of a real control law when benchmarking */
+enum WorkloadKind {
+	WORKLOAD_NONE,      // no synthetic compute
+	WORKLOAD_CPU,       // floating point control loop (cascaded PID + filter), stays in registers/L1
+	WORKLOAD_MEMORY,    // dependent loads over a buffer larger than the caches
+	WORKLOAD_FB_MIX     // IEC standard function blocks (R_TRIG, CTU, TON, SR) plus a REAL PI loop
+};
+
+/* Planned vs actual compute time of the calibrated workload, in ns */
+struct WorkloadStats {
+	uint64_t count;
+	uint64_t planned_ns;
+	uint64_t last_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t overruns;      // cycles running longer than planned_ns + 10%
+	double sum_ns;
+};
+
+void workload_init(WorkloadKind kind, uint64_t target_ns);
+void workload_set_target(uint64_t target_ns);
+uint64_t workload_run();
+void workload_get_stats(WorkloadStats *stats);
+void workload_reset_stats();
+void workload_print_stats();
+int workload_format_stats(char *buf, int size, const WorkloadStats *stats);
+const char *workload_name(WorkloadKind kind);
+
+/* workload_fb.cpp */
+void workload_fb_setup();
+void workload_fb_kernel(uint64_t iterations);
+#endif
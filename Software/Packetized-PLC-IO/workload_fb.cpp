@@ -0,0 +1,60 @@
+//-----------------------------------------------------------------------------
+// IEC function block kernel of the synthetic workload (see workload.cpp). It
+// lives in its own file because iec_std_lib.h defines its own tm and cannot be
+// included together with <time.h>.
+//-----------------------------------------------------------------------------
+
+#include "iec_std_lib.h"
+#include "iec_std_FB.h"
+#include "workload.h"
+
+#ifdef WORKLOAD_BENCH
+TIME __CURRENT_TIME;
+BOOL __DEBUG;
+#endif
+
+//-----------------------------------------------------------------------------
+// Function blocks a typical ladder/ST scan calls per rung
+//-----------------------------------------------------------------------------
+static R_TRIG fb_trig;
+static CTU fb_counter;
+static TON fb_timer;
+static SR fb_latch;
+static REAL fb_pi_integral = 0;
+static volatile REAL fb_sink;
+
+void workload_fb_setup()
+{
+	R_TRIG_init__(&fb_trig, 0);
+	CTU_init__(&fb_counter, 0);
+	TON_init__(&fb_timer, 0);
+	SR_init__(&fb_latch, 0);
+	__SET_VAR(fb_counter.,PV,,1000);
+	__SET_VAR(fb_timer.,PT,,__time_to_timespec(1, 5, 0, 0, 0, 0));
+}
+
+void workload_fb_kernel(uint64_t iterations)
+{
+	for (uint64_t k = 0; k < iterations; k++) {
+		BOOL in = (k & 1);
+		__SET_VAR(fb_trig.,CLK,,in);
+		R_TRIG_body__(&fb_trig);
+
+		__SET_VAR(fb_counter.,CU,,__GET_VAR(fb_trig.Q,));
+		__SET_VAR(fb_counter.,R,,__GET_VAR(fb_counter.Q,));
+		CTU_body__(&fb_counter);
+
+		__SET_VAR(fb_timer.,IN,,!__GET_VAR(fb_counter.Q,));
+		TON_body__(&fb_timer);
+
+		__SET_VAR(fb_latch.,S1,,__GET_VAR(fb_timer.Q,));
+		__SET_VAR(fb_latch.,R,,__GET_VAR(fb_counter.Q,));
+		SR_body__(&fb_latch);
+
+		REAL error = (REAL)__GET_VAR(fb_counter.CV,) * 0.001f - 0.5f;
+		fb_pi_integral += error * 0.001f;
+		REAL out = 0.8f * error + 0.3f * fb_pi_integral;
+		if (__GET_VAR(fb_latch.Q1,)) out = -out;
+		fb_sink = out;
+	}
+}
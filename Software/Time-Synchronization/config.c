@@ -7,6 +7,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/inotify.h>
 
 #include "tsn_drivers/rtc.h"
 #include "tsn_drivers/tsu.h"
@@ -19,6 +23,18 @@
 // definition for cpp part
 extern void setup_topo();
 extern void setup_gcl();
+extern void setup_gcl_with_base_time(uint64_t admin_base_time);
+extern int reload_topo_start();
+extern int reload_topo_poll();
+extern void reload_switch_rules_poll(int gcl_pending);
+
+#define CONFIG_WATCH_INTERVAL_NS  10000000ULL   // look for file events every 10 ms
+#define CONFIG_RELOAD_DELAY_NS    200000000ULL  // reload once the files were quiet for 200 ms
+
+static int config_watch_fd = -1;
+static volatile sig_atomic_t config_reload_requested;
+static uint64_t config_watch_last_check;
+static uint64_t config_reload_due;  // monotonic time of the pending reload, 0 if none
 
 void set_gcl_with_init() {
 	int get_gcl_status;
@@ -47,6 +63,12 @@ void set_gcl_with_init() {
 	// get_gcl_status = get_gcl(4);
 }
 
+void update_gcl_at_base_time(uint64_t admin_base_time) {
+	// unlike set_gcl_with_init(), the running lists are kept until the config change time
+	setup_gcl_with_base_time(admin_base_time);
+	gcl_wait_config_change();
+}
+
 void set_switch_rule_with_init() {
 	// output_port: 0 -> to Port 0
     //                 1 -> to Port 1
@@ -59,4 +81,73 @@ void set_switch_rule_with_init() {
 
 	// setup switch rules
 	setup_topo();
-}
\ No newline at end of file
+}
+
+static void config_reload_signal_handler(int sig) {
+	config_reload_requested = 1;
+}
+
+static uint64_t config_watch_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int is_config_file(const char *name) {
+	return strcmp(name, "config.json") == 0 || strcmp(name, "schedule.json") == 0 ||
+		strcmp(name, "config.bin") == 0;
+}
+
+int config_watch_init() {
+	signal(SIGHUP, config_reload_signal_handler);
+
+	config_watch_fd = inotify_init1(IN_NONBLOCK);
+	if (config_watch_fd < 0) {
+		perror("inotify_init1() failed");
+		return -1;
+	}
+	// editors and cp end with a close or a rename
+	if (inotify_add_watch(config_watch_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		perror("inotify_add_watch() failed");
+		close(config_watch_fd);
+		config_watch_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void config_watch_poll() {
+	uint64_t now = config_watch_now();
+	if (now - config_watch_last_check < CONFIG_WATCH_INTERVAL_NS) return;
+	config_watch_last_check = now;
+
+	if (config_reload_requested) {
+		config_reload_requested = 0;
+		config_reload_due = now;
+	}
+
+	if (config_watch_fd >= 0) {
+		char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t len;
+		while ((len = read(config_watch_fd, buf, sizeof(buf))) > 0) {
+			for (char *p = buf; p < buf + len; ) {
+				struct inotify_event *event = (struct inotify_event *)p;
+				// files are often written in several steps, wait until they are quiet
+				if (event->len && is_config_file(event->name)) config_reload_due = now + CONFIG_RELOAD_DELAY_NS;
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+	}
+
+	// a request that comes while a reload is still being prepared stays due until that one is applied
+	if (config_reload_due && now >= config_reload_due && reload_topo_start() == 0) {
+		config_reload_due = 0;
+		printf("--- Reloading switch rules and GCL. ---\r\n");
+	}
+}
+
+void config_change_poll() {
+	reload_topo_poll();
+	// the rules wait for the GCLs, so a switchover moved to a later boundary moves them too
+	reload_switch_rules_poll(gcl_config_change_poll());
+}
@@ -1,12 +1,28 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdint.h>
+
 #define SWITCH1
 
 // set up gcl schedle before initialization
 void set_gcl_with_init();
 
+// install the schedule as admin GCL lists, switching over at the first
+// cycle boundary at or after admin_base_time (synchronized time, ns)
+void update_gcl_at_base_time(uint64_t admin_base_time);
+
 // set up switch forwarding table before initialization
 void set_switch_rule_with_init();
 
+// watch config.json/schedule.json/config.bin in the working directory and reload on SIGHUP
+int config_watch_init();
+
+// start a reload of the changed files, parsed and compiled off the time sync main loop
+void config_watch_poll();
+
+// apply a finished reload, then install pending admin GCL lists and, at the same cycle
+// boundary, the switch rules of the reload
+void config_change_poll();
+
 #endif
\ No newline at end of file
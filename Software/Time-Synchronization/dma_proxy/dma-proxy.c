@@ -1,5 +1,6 @@
 #include "dma-proxy.h"
 #include "../log/log.h"
+#include "../tsn_drivers/thread_policy.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -134,6 +135,7 @@ void process_packet(uint8_t *buf, buffer_queue *queue) {
 
 // cite: https://github.com/Horacehxw/software-prototypes/blob/master/linux-user-space-dma/Software/User/dma-proxy-test.c
 void *DMA_rx_thread (buffer_queue *queue) {
+	thread_policy_apply("dma_rx");
 	log_info("Entering rx thread");
     struct channel *channel_ptr = rx_channels;
     int in_progress_count = 0, buffer_id = 0;
@@ -0,0 +1,74 @@
+// Benchmark of the GCL schedule compiler over schedule files.
+// Usage: ./gcl_bench [-a] [iterations] [schedule.json ...]
+// -a closes the shortest best-effort (and PTP) gaps of a GCL that does not fit, as time_sync -a.
+// By default the a380 and ring3 schedules in the source tree's config/ are compiled.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gcl_compiler.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+static void bench_schedule(const std::string &path, int iterations, bool absorb) {
+    json j;
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "[ERROR] Could not open " << path << std::endl;
+        return;
+    }
+    file >> j;
+
+    int links = 0, failed = 0, max_entries = 0;
+    double total_us = 0;
+    for (auto &link : j) {
+        if (link["type"].get<std::string>() != "link") continue;
+
+        std::vector<GclFlowWindow> windows;
+        for (auto &item : link["schedule"]) {
+            windows.push_back({item["period"].get<int>(), item["start"].get<int>(),
+                               item["end"].get<int>()});
+        }
+
+        GclCompilerOptions options;
+        options.absorb = absorb;
+        GclCompileResult result;
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) compile_gcl(windows, options, &result);
+        auto end = std::chrono::steady_clock::now();
+        const double us = std::chrono::duration<double, std::micro>(end - begin).count() / iterations;
+
+        links++;
+        total_us += us;
+        if (!result.ok) failed++;
+        if (result.entries_needed > max_entries) max_entries = result.entries_needed;
+        std::cout << "link " << link["from"] << " -> " << link["to"] << ": " << windows.size()
+                  << " windows, " << us << " us, " << (result.ok ? "" : "FAILED: ") << result.report
+                  << std::endl;
+    }
+    std::cout << "== " << path << ": " << links << " links, " << failed << " failed, max "
+              << max_entries << " entries, " << total_us << " us total per compile" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 1000;
+    bool absorb = false;
+    std::vector<std::string> paths;
+    int arg = 1;
+    if (arg < argc && std::string(argv[arg]) == "-a") {
+        absorb = true;
+        arg++;
+    }
+    if (arg < argc) iterations = std::stoi(argv[arg++]);
+    for (; arg < argc; ++arg) paths.push_back(argv[arg]);
+    if (paths.empty()) {
+        paths.push_back(GCL_BENCH_CONFIG_DIR "/a380-schedule.json");
+        paths.push_back(GCL_BENCH_CONFIG_DIR "/ring3-schedule.json");
+    }
+    for (auto &path : paths) bench_schedule(path, iterations, absorb);
+    return 0;
+}
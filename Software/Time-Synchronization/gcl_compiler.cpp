@@ -0,0 +1,227 @@
+#include "gcl_compiler.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+// schedule slot is 2^14 ns, GCL time unit is 2^11 ns
+static const int UNITS_PER_SLOT = 1 << (14 - GCL_TIME_UNIT_SHIFT);
+// preamble + SFD + inter frame gap
+static const int FRAME_OVERHEAD_BYTES = 20;
+
+struct GclEntry {
+    int gate_state;
+    int units;
+};
+
+static int gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int guard_band_units(const GclCompilerOptions &options) {
+    if (options.link_speed_mbps <= 0 || options.max_frame_bytes <= 0) return 0;
+    const long long bits = (long long)(options.max_frame_bytes + FRAME_OVERHEAD_BYTES) * 8;
+    const long long ns = (bits * 1000 + options.link_speed_mbps - 1) / options.link_speed_mbps;
+    const long long unit_ns = 1LL << GCL_TIME_UNIT_SHIFT;
+    return (int)((ns + unit_ns - 1) / unit_ns);
+}
+
+// add [start, start + length) to intervals, wrapping around the cycle
+static void add_interval(std::vector<std::pair<int, int> > &intervals, int start, int length, int cycle) {
+    if (length <= 0) return;
+    if (length >= cycle) {
+        intervals.emplace_back(0, cycle);
+        return;
+    }
+    start = ((start % cycle) + cycle) % cycle;
+    if (start + length <= cycle) {
+        intervals.emplace_back(start, start + length);
+    } else {
+        intervals.emplace_back(start, cycle);
+        intervals.emplace_back(0, start + length - cycle);
+    }
+}
+
+// merge adjacent identical gate states
+static void merge_entries(std::vector<GclEntry> &entries) {
+    std::vector<GclEntry> compact;
+    for (const auto &e : entries) {
+        if (!compact.empty() && compact.back().gate_state == e.gate_state) {
+            compact.back().units += e.units;
+        } else {
+            compact.push_back(e);
+        }
+    }
+    entries.swap(compact);
+}
+
+// a best-effort entry at either end of the list is one gap with the entry at the other end
+static bool wraps(const std::vector<GclEntry> &entries, size_t i) {
+    return (i == 0 || i == entries.size() - 1) && entries.size() > 1 &&
+           entries.front().gate_state == GCL_GATE_BE && entries.back().gate_state == GCL_GATE_BE;
+}
+
+// shortest best-effort gap between TT entries, false if there is none
+static bool shortest_gap(const std::vector<GclEntry> &entries, size_t *index, int *units) {
+    bool found = false;
+    for (size_t i = 0; i < entries.size() && entries.size() > 1; ++i) {
+        if (entries[i].gate_state != GCL_GATE_BE) continue;
+        const int gap = wraps(entries, i) ? entries.front().units + entries.back().units : entries[i].units;
+        if (!found || gap < *units) {
+            *index = i;
+            *units = gap;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// keep the TT gate open over a best-effort gap, merging it into its neighbours
+static void close_gap(std::vector<GclEntry> &entries, size_t i) {
+    if (wraps(entries, i)) {
+        entries.front().gate_state = GCL_GATE_TT;
+        entries.back().gate_state = GCL_GATE_TT;
+    } else {
+        entries[i].gate_state = GCL_GATE_TT;
+    }
+    merge_entries(entries);
+}
+
+// build the merged entry list of one cycle, returns false with a message on invalid input
+static bool build_entries(const std::vector<GclFlowWindow> &windows, int cycle_slots, int guard,
+                          std::vector<GclEntry> &entries, int &tt_units, std::ostringstream &report) {
+    const int cycle = cycle_slots * UNITS_PER_SLOT;
+    std::vector<std::pair<int, int> > tt;
+    for (const auto &w : windows) {
+        if (w.period <= 0 || cycle_slots % w.period != 0 || w.end <= w.start) {
+            report << "invalid window {period " << w.period << ", start " << w.start
+                   << ", end " << w.end << "} for a cycle of " << cycle_slots << " slots; ";
+            return false;
+        }
+        for (int x = 0; x < cycle_slots; x += w.period) {
+            add_interval(tt, (x + w.start) * UNITS_PER_SLOT, (w.end - w.start) * UNITS_PER_SLOT, cycle);
+        }
+    }
+
+    // unite TT windows, then measure TT time before the guard bands are added
+    std::sort(tt.begin(), tt.end());
+    std::vector<std::pair<int, int> > merged;
+    for (const auto &iv : tt) {
+        if (!merged.empty() && iv.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, iv.second);
+        } else {
+            merged.push_back(iv);
+        }
+    }
+    tt_units = 0;
+    for (const auto &iv : merged) tt_units += iv.second - iv.first;
+
+    // guard band: close the best-effort gate before every TT window
+    std::vector<std::pair<int, int> > gated;
+    for (const auto &iv : merged) {
+        add_interval(gated, iv.first - guard, iv.second - iv.first + guard, cycle);
+    }
+    std::sort(gated.begin(), gated.end());
+
+    entries.clear();
+    int cursor = 0;
+    for (const auto &iv : gated) {
+        if (iv.second <= cursor) continue;
+        const int start = std::max(iv.first, cursor);
+        if (start > cursor) entries.push_back({GCL_GATE_BE, start - cursor});
+        entries.push_back({GCL_GATE_TT, iv.second - start});
+        cursor = iv.second;
+    }
+    if (cursor < cycle) entries.push_back({GCL_GATE_BE, cycle - cursor});
+    merge_entries(entries);
+
+    // a best-effort gap shorter than the guard band cannot start a frame, it joins the TT entries around it
+    size_t i;
+    int gap;
+    while (shortest_gap(entries, &i, &gap) && gap < guard) close_gap(entries, i);
+    return true;
+}
+
+bool compile_gcl(const std::vector<GclFlowWindow> &windows,
+                 const GclCompilerOptions &options,
+                 GclCompileResult *result) {
+    std::ostringstream report;
+    result->ok = false;
+    result->list.length = 0;
+    result->guard_band_units = guard_band_units(options);
+
+    std::vector<GclEntry> entries;
+    int cycle_slots = options.cycle_slots;
+    if (!build_entries(windows, cycle_slots, result->guard_band_units, entries, result->tt_units, report)) {
+        result->report = report.str();
+        return false;
+    }
+
+    if ((int)entries.size() > options.capacity && options.fold && !windows.empty()) {
+        // hyperperiod: the cycle repeats with the lcm of the flow periods
+        int hyper = 1;
+        for (const auto &w : windows) hyper = hyper / gcd(hyper, w.period) * w.period;
+        if (hyper < cycle_slots && cycle_slots % hyper == 0) {
+            std::vector<GclEntry> folded;
+            int folded_tt = 0;
+            if (build_entries(windows, hyper, result->guard_band_units, folded, folded_tt, report)) {
+                report << "folded cycle " << cycle_slots << " -> " << hyper << " slots (" << entries.size()
+                       << " -> " << folded.size() << " entries); ";
+                entries.swap(folded);
+                cycle_slots = hyper;
+                result->tt_units = folded_tt;
+            }
+        }
+    }
+
+    result->absorbed_units = 0;
+    if ((int)entries.size() > options.capacity && options.absorb) {
+        // give up the shortest best-effort gaps until the list fits
+        const size_t needed = entries.size();
+        size_t i;
+        int gap;
+        while ((int)entries.size() > options.capacity && shortest_gap(entries, &i, &gap)) {
+            close_gap(entries, i);
+            result->absorbed_units += gap;
+        }
+        report << "closed best-effort gaps of " << result->absorbed_units << " units (" << needed << " -> "
+               << entries.size() << " entries); ";
+    }
+
+    result->cycle_slots = cycle_slots;
+    result->entries_needed = (int)entries.size();
+    const int cycle = cycle_slots * UNITS_PER_SLOT;
+    report << entries.size() << "/" << options.capacity << " entries, guard band "
+           << result->guard_band_units << " units, TT " << result->tt_units << "/" << cycle << " units";
+
+    if ((int)entries.size() > options.capacity || (int)entries.size() > GCL_LIST_LEN) {
+        report << "; schedule does not fit into the GCL: needs " << entries.size()
+               << " entries, hardware has " << std::min(options.capacity, GCL_LIST_LEN)
+               << "; entries: [";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            report << (i ? ", " : "") << std::hex << entries[i].gate_state << std::dec << ":" << entries[i].units;
+        }
+        report << "]";
+        result->report = report.str();
+        return false;
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].units > 0xFFFF) {
+            report << "; entry " << i << " is longer than the GCL time interval register (" << entries[i].units << " units)";
+            result->report = report.str();
+            return false;
+        }
+        result->list.gate_states[i] = uint16_t(entries[i].gate_state);
+        result->list.time_intervals[i] = uint16_t(entries[i].units);
+    }
+    result->list.length = uint16_t(entries.size());
+    result->ok = true;
+    result->report = report.str();
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef GCL_COMPILER_H
+#define GCL_COMPILER_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+    #include "tsn_drivers/gcl.h"
+}
+
+// gate states, see docs/system-design.md "Gate Control".
+// reference: IEEE std 802.1Q 2018, page 198. priority 0 or no VLAN -> queue 1, priority 1 -> queue 0.
+#define GCL_GATE_TT 0x001                   // only queue 0 (TT frames) open
+#define GCL_GATE_BE (0x002 | 0x100)         // queue 1 (ptp / background) open, hardware guard band on
+
+// one TT window of a flow on a link, in schedule slots (2^14 ns)
+struct GclFlowWindow {
+    int period;
+    int start;
+    int end;
+};
+
+struct GclCompilerOptions {
+    int cycle_slots = 2048;         // schedule cycle, in 2^14 ns slots
+    int link_speed_mbps = 1000;     // used to size the guard band
+    int max_frame_bytes = 1522;     // largest best-effort frame that may delay a TT window
+    int capacity = GCL_LIST_LEN;    // hardware GCL entries per port
+    bool fold = true;               // fold the list to the hyperperiod when the full cycle does not fit
+    bool absorb = false;            // close the shortest best-effort gaps (queue 1 also carries PTP) when the folded list does not fit
+};
+
+struct GclCompileResult {
+    bool ok = false;
+    GateControlList list;           // valid when ok
+    int cycle_slots = 0;            // cycle the list was compiled for (hyperperiod if folded)
+    int entries_needed = 0;         // entries of the compiled list, may exceed the capacity
+    int guard_band_units = 0;       // guard band before each TT window, in 2^11 ns
+    int tt_units = 0;               // TT gate open time per cycle (without guard bands), in 2^11 ns
+    int absorbed_units = 0;         // best-effort time closed to fit the capacity, in 2^11 ns
+    std::string report;             // human readable summary, explains failures
+};
+
+// Compile the TT windows of one link into a gate control list.
+// Windows are expanded over the cycle, overlapping windows are united, a guard band
+// (transmission time of max_frame_bytes at link_speed_mbps) closes the best-effort gate
+// before every TT window, adjacent entries with identical gate states are merged and
+// best-effort gaps shorter than the guard band are merged into the TT entries around them.
+// If the list needs more than options.capacity entries it is folded to the hyperperiod of
+// the flows and, only with options.absorb, the shortest best-effort gaps are closed until it
+// fits; if it still does not fit, ok is false and report says why.
+bool compile_gcl(const std::vector<GclFlowWindow> &windows,
+                 const GclCompilerOptions &options,
+                 GclCompileResult *result);
+
+#endif
@@ -1,3 +1,8 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
 #include "tsn_drivers/rtc.h"
 #include "tsn_drivers/tsu.h"
 #include "tsn_drivers/uio.h"
@@ -5,9 +10,39 @@
 #include "tsn_drivers/switch_rules.h"
 #include "config.h"
 
-int main () {
+int main (int argc, char * argv[]) {
     void *ptr, *ptr2;
+    int opt = 0;
+    uint64_t admin_base_time = 0;
+    int update_gcl_only = 0;
+    while ((opt = getopt(argc, argv, "hb:")) != -1) {
+        switch (opt) {
+            case 'h':
+                printf("Usage: ./switch_config [-b <admin_base_time>]\n");
+                printf("-b: only update GCL, switching over at the first cycle boundary at or after admin_base_time (synchronized time, ns)\n");
+                return 0;
+            case 'b':
+                admin_base_time = strtoull(optarg, NULL, 10);
+                update_gcl_only = 1;
+                break;
+            default:
+                printf("error opterr: %d\n", opterr);
+                return 0;
+        }
+    }
+
 	ptr = uio_init("/dev/uio0");
+
+    if (update_gcl_only) {
+        // keep switch rules and running GCL, time sync keeps running
+        gcl_attach(ptr);
+        rtc_init(ptr);
+        printf ("--- Start updating GCL at base time %" PRIu64 " ns. ---\r\n", admin_base_time);
+        update_gcl_at_base_time(admin_base_time);
+        printf ("--- Finish updating GCL. ---\r\n");
+        return 0;
+    }
+
 	gcl_init(ptr);
 	rtc_init(ptr);
 	tsu_init(ptr);
@@ -23,4 +58,4 @@ int main () {
 	set_gcl_with_init();
 	printf ("--- Finish setting up GCL. ---\r\n");
     return 0;
-}
\ No newline at end of file
+}
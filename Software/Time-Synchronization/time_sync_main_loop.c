@@ -80,6 +80,7 @@
 #include "tsn_drivers/uio.h"
 #include "tsn_drivers/switch_rules.h"
 #include "tsn_drivers/gpio_reset.h"
+#include "tsn_drivers/thread_policy.h"
 #include "log/log.h"
 
 
@@ -106,6 +107,7 @@ void set_default_config(SystemIdentity* system_identity,
 extern void get_ptp_ports(int *ptp_ports);
 extern void get_clock_identity(ClockIdentity clock_identity);
 extern void get_priority1(uint8_t* priority1);
+extern void set_gcl_absorb_gaps(int absorb);
 extern void get_config_from_json(
         SystemIdentity* system_identity,
         int *ptp_ports,
@@ -455,6 +457,10 @@ int TimeSyncMainLoop() {
             port_state_selection_sm_run(&port_state_selection_sm, current_ts);
         }
 		
+		// Reload changed config files, then install pending admin GCL lists at their config change time
+		config_watch_poll();
+		config_change_poll();
+
 		// Check for tx tsu timestamp
 		int tx_ts_status;
 		TSUTimestamp tsu_tx_ts;
@@ -505,12 +511,26 @@ int main(int argc,char * argv[])
     // log_set_level(LOG_WARN);
     int opt = 0;
     int log_level = LOG_TRACE;
-    while ((opt = getopt(argc, argv, "hl:")) != -1) {
+    int watch_config = 1;
+    const char *thread_policy_file = THREAD_POLICY_FILE;
+    while ((opt = getopt(argc, argv, "ahl:nt:")) != -1) {
         switch (opt) {
             case 'h':
-                printf("Usage: ./time_sync -l <w/i/t>\n");
+                printf("Usage: ./time_sync -l <w/i/t> [-a] [-n] [-t threads.conf]\n");
                 printf("-l: log_level, w(warn), i(info), t(trace)\n");
+                printf("-a: close the shortest best-effort (and PTP) gaps of a GCL that does not fit\n");
+                printf("-n: do not reload switch rules and GCL when config files change\n");
+                printf("-t: thread policy file, %s by default\n", THREAD_POLICY_FILE);
                 return 0;
+            case 'a':
+                set_gcl_absorb_gaps(1);
+                break;
+            case 'n':
+                watch_config = 0;
+                break;
+            case 't':
+                thread_policy_file = optarg;
+                break;
             case 'l':
                 if (strcmp(optarg, "w") == 0) {
                     log_level = LOG_WARN;
@@ -534,6 +554,8 @@ int main(int argc,char * argv[])
     printf("-l: log_level, w(warn), i(info), t(trace)\n");
 
 
+	thread_policy_load(thread_policy_file);
+
 	reset_PL_by_GPIO("960");
 
 	log_info("--- Entering main() ---");
@@ -558,6 +580,10 @@ int main(int argc,char * argv[])
 	set_gcl_with_init();
 	log_info ("--- Finish setting up GCL. ---");
 
+	if (watch_config && config_watch_init() == 0) {
+		log_info("Watching config files, switch rules and GCL are reloaded on change or SIGHUP.");
+	}
+
 	log_info("--- Launching DMA receving thread --- ");
 	// init RX buffer queue
 	queue = malloc (sizeof(buffer_queue));
@@ -571,6 +597,7 @@ int main(int argc,char * argv[])
 	log_info("--- Launching DMA receving thread successfully ---");
 
 	log_info ("--- Start time syncronization. ---");
+	thread_policy_apply("time_sync");
 	TimeSyncMainLoop();
 	log_info ("--- Finish time syncronization. ---");
 
@@ -1,19 +1,24 @@
 #include "topo.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "gcl_compiler.h"
 #include "json.hpp"
+#include "topo_image.h"
 
 extern "C" {
 #include "tsn_drivers/gcl.h"
 #include "log/log.h"
+#include "tsn_drivers/rtc.h"
 #include "tsn_drivers/switch_rules.h"
 }
 
@@ -25,8 +30,13 @@ std::string to_lower(std::string data) {
     return data;
 }
 
+// parsed config.json/schedule.json, replaced by a reload once the new files are valid; while a
+// reload is prepared the reload thread owns them
+static json *config_json;
+static json *gcl_config_json;
+
 json *get_config() {
-    static json *j;
+    json *&j = config_json;
     if (j) return j;
 
     j = new json();
@@ -40,7 +50,7 @@ json *get_config() {
 }
 
 json *get_gcl_config() {
-    static json *j;
+    json *&j = gcl_config_json;
     if (j) return j;
 
     j = new json();
@@ -63,8 +73,207 @@ std::string get_mac_address() {
     return mac;
 }
 
-void setup_topo() {
-    json j = *get_config();
+static TopoImage image;
+static bool image_loaded;
+
+// compiled config.bin (see topo_image.h), nullptr when it is absent or invalid
+const TopoImage *get_topo_image() {
+    bool &loaded = image_loaded;
+    if (loaded) return image.base ? &image : nullptr;
+
+    loaded = true;
+    if (topo_image_open(&image, TOPO_IMAGE_FILE) == -2) {
+        std::cout << "[WARNING] " << TOPO_IMAGE_FILE
+                  << " is invalid or of another version, using json config" << std::endl;
+    }
+    return image.base ? &image : nullptr;
+}
+
+struct ConfigCache {
+    json *config;
+    json *gcl_config;
+    TopoImage image;
+    bool image_loaded;
+};
+
+// move the parsed files out of the cache, the next get_config()/get_gcl_config()/get_topo_image() reads them again
+static ConfigCache take_config_cache() {
+    ConfigCache cache = {config_json, gcl_config_json, image, image_loaded};
+    config_json = nullptr;
+    gcl_config_json = nullptr;
+    image.base = nullptr;
+    image.size = 0;
+    image_loaded = false;
+    return cache;
+}
+
+static void free_config_cache(ConfigCache &cache) {
+    delete cache.config;
+    delete cache.gcl_config;
+    if (cache.image.base) munmap((void *)cache.image.base, cache.image.size);
+}
+
+// drop what was parsed since take_config_cache() and put the saved files back
+static void restore_config_cache(ConfigCache &saved) {
+    ConfigCache failed = take_config_cache();
+    free_config_cache(failed);
+    config_json = saved.config;
+    gcl_config_json = saved.gcl_config;
+    image = saved.image;
+    image_loaded = saved.image_loaded;
+}
+
+// section of the current node in config.bin, nullptr when there is no image
+// or (with *missing set) when the node is not in the image
+static const TopoImageNode *find_image_node(bool *missing) {
+    *missing = false;
+    const TopoImage *image = get_topo_image();
+    if (!image) return nullptr;
+
+    const std::string mac_addr = get_mac_address();
+    unsigned int bytes[6];
+    uint8_t mac[6];
+    std::sscanf(mac_addr.c_str(), "%02x:%02x:%02x:%02x:%02x:%02x", &bytes[0],
+                &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]);
+    for (int i = 0; i < 6; i++) mac[i] = (uint8_t)bytes[i];
+
+    const TopoImageNode *node = topo_image_find_node(image, mac);
+    if (!node) {
+        std::cout << "[ERROR] Could not find node with mac address " << mac_addr
+                  << " in " << TOPO_IMAGE_FILE << std::endl;
+        *missing = true;
+    }
+    return node;
+}
+
+// section of the current node in config.bin, nullptr when there is no image
+const TopoImageNode *get_image_node() {
+    bool missing;
+    const TopoImageNode *node = find_image_node(&missing);
+    if (missing) exit(1);
+    return node;
+}
+
+struct SwitchRuleEntry {
+    char mac[6];
+    int port;
+};
+
+// parse "aa:bb:cc:dd:ee:ff" from config.json, returns false if it is not a mac address
+static bool parse_mac(const std::string &text, uint8_t mac[6]) {
+    unsigned int bytes[6];
+    char trailing;
+    if (std::sscanf(text.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x%c", &bytes[0], &bytes[1], &bytes[2],
+                    &bytes[3], &bytes[4], &bytes[5], &trailing) != 6) {
+        std::cout << "[ERROR] " << text << " is an invalid mac address" << std::endl;
+        return false;
+    }
+    for (int i = 0; i < 6; i++) mac[i] = (uint8_t)bytes[i];
+    return true;
+}
+
+// same rule as find_src_dst() in Packetized-PLC-IO/config.cpp
+static bool find_src_dst(const json &sche, int job_id, int flow_id, int &src_id, int &dst_id) {
+    std::unordered_set<int> out_flow, in_flow;
+    for (const auto &elem : sche) {
+        if (elem["type"] != "link") continue;
+        for (const auto &flow : elem["schedule"]) {
+            if (flow.find("job_id") == flow.end() || flow.find("flow_id") == flow.end()) continue;
+            if (job_id == flow["job_id"].get<int>() && flow_id == flow["flow_id"].get<int>()) {
+                out_flow.insert(elem["from"].get<int>());
+                in_flow.insert(elem["to"].get<int>());
+            }
+        }
+    }
+    src_id = dst_id = -1;
+    for (int id : out_flow) {
+        if (in_flow.find(id) != in_flow.end()) continue;
+        if (src_id != -1) return false;
+        src_id = id;
+    }
+    for (int id : in_flow) {
+        if (out_flow.find(id) != out_flow.end()) continue;
+        if (dst_id != -1) return false;
+        dst_id = id;
+    }
+    return src_id != -1 && dst_id != -1;
+}
+
+// switch rules of flow replicas (see tsn_scheduler.cpp): a window with "replica": r on a link out of
+// this switch sends topo_replica_mac(dst, r) out of the link's port, and the flow's dst switch
+// delivers it to its local port, the "fwd" port of its own mac. Returns false on config errors.
+static bool load_replica_rules(json &j, int id, std::unordered_map<int, std::string> &nodes,
+                               std::vector<SwitchRuleEntry> &rules) {
+    int local_port = -1;
+    for (auto &link : j["fwd"]) {
+        if (link["src"].get<int>() == id && link["dst"].get<int>() == id) local_port = link["src_port"].get<int>();
+    }
+
+    json &sche = *get_gcl_config();
+    for (auto &link : sche) {
+        if (link["type"] != "link") continue;
+        const int from = link["from"].get<int>();
+        const int to = link["to"].get<int>();
+        if (from != id && to != id) continue;
+        for (auto &flow : link["schedule"]) {
+            if (flow.find("replica") == flow.end()) continue;
+            const int replica = flow["replica"].get<int>();
+            const int job_id = flow["job_id"].get<int>();
+            const int flow_id = flow["flow_id"].get<int>();
+            int src_id, dst_id;
+            if (!find_src_dst(sche, job_id, flow_id, src_id, dst_id) || nodes.find(dst_id) == nodes.end()) {
+                std::cout << "[ERROR] Flow#" << flow_id << " in job#" << job_id << " is not valid!" << std::endl;
+                return false;
+            }
+            int port;
+            if (from == id) port = link["from_port"].get<int>();
+            else if (dst_id == id) port = local_port;
+            else continue;
+            if (port < 0) {
+                std::cout << "[ERROR] Node " << id << " has no fwd entry for its own mac" << std::endl;
+                return false;
+            }
+
+            uint8_t mac[6];
+            if (!parse_mac(nodes[dst_id], mac)) return false;
+            SwitchRuleEntry rule;
+            topo_replica_mac(mac, replica, (uint8_t *)rule.mac);
+            rule.port = port;
+            auto same = std::find_if(rules.begin(), rules.end(),
+                                     [&](const SwitchRuleEntry &r) { return memcmp(r.mac, rule.mac, 6) == 0; });
+            if (same == rules.end()) {
+                std::cout << "switch rule: replica " << replica << " of node " << dst_id << " -> port " << port << std::endl;
+                rules.push_back(rule);
+            } else if (same->port != rule.port) {
+                std::cout << "[ERROR] Replica " << replica << " of flow#" << flow_id << " in job#" << job_id
+                          << " leaves on another port than earlier flows to node " << dst_id << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// switch rules of the current node, returns false on config errors
+static bool load_switch_rules(std::vector<SwitchRuleEntry> &rules) {
+    rules.clear();
+    bool missing;
+    if (const TopoImageNode *node = find_image_node(&missing)) {
+        const TopoImageSwitchRule *image_rules = topo_image_switch_rules(get_topo_image(), node);
+        for (int i = 0; i < node->switch_rule_count; ++i) {
+            SwitchRuleEntry rule;
+            memcpy(rule.mac, image_rules[i].mac, 6);
+            rule.port = image_rules[i].port;
+            rules.push_back(rule);
+        }
+        std::cout << "[INFO] current node id " << node->node_id << ", "
+                  << node->switch_rule_count << " switch rules from "
+                  << TOPO_IMAGE_FILE << std::endl;
+        return true;
+    }
+    if (missing) return false;
+
+    json &j = *get_config();
     const std::string mac_addr = get_mac_address();
 
     int id = -1;
@@ -88,7 +297,7 @@ void setup_topo() {
     if (id == -1) {
         std::cout << "[ERROR] Could not find node with mac address " << mac_addr
                   << std::endl;
-        exit(1);
+        return false;
     }
 
     // find links whose src is the current node
@@ -101,7 +310,7 @@ void setup_topo() {
             if (nodes.find(dst) == nodes.end()) {
                 std::cout << "[ERROR] Could not find node with id " << dst
                           << std::endl;
-                exit(1);
+                return false;
             }
             std::string dst_mac = nodes[dst];
 
@@ -110,11 +319,9 @@ void setup_topo() {
                       << std::endl;
 
             // convert mac address string to uint8 array
-            char bytes[6];
-            for (int i = 0; i < 6; i++) {
-                bytes[i] = std::stoi(dst_mac.substr(i * 3, 2), nullptr, 16);
-                std::cout << unsigned(bytes[i]) << " ";
-            }
+            uint8_t bytes[6];
+            if (!parse_mac(dst_mac, bytes)) return false;
+            for (int i = 0; i < 6; i++) std::cout << unsigned(bytes[i]) << " ";
 
             // // convert dst_mac to char array
             // char bytes[6];
@@ -135,121 +342,111 @@ void setup_topo() {
                       << unsigned(bytes[5]);
             std::cout << std::dec;
 
-            // add link to switch rules
-            push_switch_rule(bytes, src_port);
+            SwitchRuleEntry rule;
+            memcpy(rule.mac, bytes, 6);
+            rule.port = src_port;
+            rules.push_back(rule);
+        }
+    }
+    return load_replica_rules(j, id, nodes, rules);
+}
+
+// switch rules written by setup_topo()/reload_topo_poll(), diffed against on reload
+static std::vector<SwitchRuleEntry> applied_switch_rules;
+
+void setup_topo() {
+    std::vector<SwitchRuleEntry> rules;
+    if (!load_switch_rules(rules)) exit(1);
+
+    // add links to switch rules
+    for (auto &rule : rules) {
+        if (push_switch_rule(rule.mac, rule.port) != 0) {
+            std::cout << "[ERROR] Could not add the " << rules.size() << " switch rules of this node" << std::endl;
+            exit(1);
         }
     }
+    applied_switch_rules = rules;
 }
 
-// parse and apply gcl for a link
-void apply_gcl(json &data, const int port) {
-    std::cout << "enter apply_gcl" << std::endl;
-    // TODO: make it definition
-    const int MAX_PERIOD = 2048;
-    const int GCL_SIZE = 16;
+// set by time_sync -a, see GclCompilerOptions::absorb
+static bool gcl_absorb_gaps;
 
+void set_gcl_absorb_gaps(int absorb) { gcl_absorb_gaps = absorb != 0; }
+
+// parse and compile the gcl of a link, returns false if it does not fit into the hardware
+static bool compile_link_gcl(json &data, const int port, GateControlList *list) {
     const int from = data["from"].get<int>();
     const int to = data["to"].get<int>();
     std::cout << "gcl: from " << from << " to " << to << std::endl;
 
-    std::vector<int> tt_frames_start_times;
-    std::vector<int> time_points{0, MAX_PERIOD};
-
+    std::vector<GclFlowWindow> windows;
     for (auto &item : data["schedule"]) {
-        const int period = item["period"].get<int>();
-        const int start = item["start"].get<int>();
-        const int end = item["end"].get<int>();
-
-        if (period == MAX_PERIOD) {
-            if (end > MAX_PERIOD) {
-                time_points.push_back(0);
-                time_points.push_back(end - MAX_PERIOD);
-                tt_frames_start_times.push_back(0);
-                time_points.push_back(start);
-                time_points.push_back(MAX_PERIOD);
-                tt_frames_start_times.push_back(start);
-            } else {
-                time_points.push_back(start);
-                time_points.push_back(end);
-                tt_frames_start_times.push_back(start);
-            }
-        } else {
-            int x = 0;
-            while (x < MAX_PERIOD) {
-                if (x + end > MAX_PERIOD) {
-                    time_points.push_back(0);
-                    time_points.push_back(x + end - MAX_PERIOD);
-                    tt_frames_start_times.push_back(0);
-                    time_points.push_back(x + start);
-                    time_points.push_back(MAX_PERIOD);
-                    tt_frames_start_times.push_back(x + start);
-                } else {
-                    time_points.push_back(x + start);
-                    time_points.push_back(x + end);
-                    tt_frames_start_times.push_back(x + start);
-                }
-                x += period;
-            }
-        }
+        windows.push_back({item["period"].get<int>(), item["start"].get<int>(),
+                           item["end"].get<int>()});
     }
 
-    // sort and remove duplicates
-    std::sort(time_points.begin(), time_points.end());
-    time_points.erase(std::unique(time_points.begin(), time_points.end()),
-                      time_points.end());
-
-    std::vector<int> gcl_values(GCL_SIZE, 1);
-    std::vector<int> gcl_time_intervals(GCL_SIZE, 0);
-
-    int gcl_index = 0;
-
-    for (int i = 0; i < (int)time_points.size(); ++i) {
-        int time_point = time_points[i];
-        std::cout << time_point;
-
-        if (i == (int)time_points.size() - 1) break;
-        //  * reference: IEEE std 802.1Q 2018, page 198. priority 0 or no VLAN -> queue 1, priority 1 -> queue 0.
-        if (std::find(tt_frames_start_times.begin(), tt_frames_start_times.end(), time_point) != tt_frames_start_times.end()) {
-            std::cout << "===";
-            gcl_values[gcl_index] = 1;
-            // gcl_values[gcl_index] = 0b011111101; // priority =2
-            // gcl_values[gcl_index] = 0b011111111; // priority =2
-            gcl_time_intervals[gcl_index] = (time_points[i + 1] - time_point) * 8;
-        } else {
-            // TODO: add gaurd band mechanism in non-tt frame interval, to protect proceeding tt frames
-            std::cout << "---";
-            // gcl_values[gcl_index] = 0b011111111; // priority =2
-            // gcl_values[gcl_index] = 2;
-            gcl_values[gcl_index] = (0b000000010 | 0b100000000);
-            gcl_time_intervals[gcl_index] = (time_points[i + 1] - time_point) * 8;
-        }
-        gcl_index++;
+    GclCompilerOptions options;
+    options.absorb = gcl_absorb_gaps;
+    if (data.find("link_speed") != data.end()) options.link_speed_mbps = data["link_speed"].get<int>();
+    if (data.find("max_frame_size") != data.end()) options.max_frame_bytes = data["max_frame_size"].get<int>();
+
+    GclCompileResult result;
+    if (!compile_gcl(windows, options, &result)) {
+        std::cout << "[ERROR] Could not compile GCL of port " << port << " (link " << from
+                  << " -> " << to << "): " << result.report << std::endl;
+        return false;
     }
-    std::cout << std::endl;
+    std::cout << "GCL: " << result.report << std::endl;
 
     std::cout << "GCL values: [";
-    for (auto &i : gcl_values) std::cout << i << ", ";
-    std::cout << "\b\b" << ']' << std::endl;
+    for (int i = 0; i < result.list.length; ++i) std::cout << (i ? ", " : "") << result.list.gate_states[i];
+    std::cout << ']' << std::endl;
 
     std::cout << "GCL times: [";
-    for (auto &i : gcl_time_intervals) std::cout << i << ", ";
-    std::cout << "\b\b" << ']' << std::endl;
+    for (int i = 0; i < result.list.length; ++i) std::cout << (i ? ", " : "") << result.list.time_intervals[i];
+    std::cout << ']' << std::endl;
 
-    for (size_t i = 0; i < gcl_values.size(); ++i) {
-        set_gcl(port + 1, i, gcl_values[i]);
-        set_gcl_time_interval(port + 1, i, uint16_t(gcl_time_intervals[i]));
-    }
+    *list = result.list;
+    return true;
 }
 
+struct PortGcl {
+    int port;                 // GCL port number, start from 1
+    GateControlList list;
+};
+
 /**
-Description: Get GCL values and time intervals.
+Description: Get GCL values and time intervals of the current node.
 GCL time interval's time unit is 2^11 ns.
 In schedule result, time unit is 2^14 ns. 
 If TT flow, GCL value is set to 1 (0x10), which just allows time-triggered frames to pass.
 Otherwise, GCL value is set to 2 (0x01), which allows ptp frames or background frames to pass.
+Guard bands, entry merging and capacity fitting are done by compile_gcl() in gcl_compiler.cpp.
+Returns false on config errors, including a link whose list does not fit, after every such
+link was reported; a node that is not in the schedule gets no lists.
 */
-void setup_gcl() {
-    json j = *get_gcl_config();
+static bool load_gcls(std::vector<PortGcl> &gcls) {
+    gcls.clear();
+    bool missing;
+    if (const TopoImageNode *node = find_image_node(&missing)) {
+        if (!(node->flags & TOPO_HAS_SCHEDULE)) {
+            std::cout << "[WARNING] node " << node->node_id << " is not in the schedule" << std::endl;
+            return true;
+        }
+        const TopoImageGcl *image_gcls = topo_image_gcls(get_topo_image(), node);
+        for (int i = 0; i < node->gcl_count; ++i) {
+            PortGcl gcl;
+            gcl.port = image_gcls[i].port + 1;
+            gcl.list.length = image_gcls[i].length;
+            memcpy(gcl.list.gate_states, image_gcls[i].gate_states, sizeof(gcl.list.gate_states));
+            memcpy(gcl.list.time_intervals, image_gcls[i].time_intervals, sizeof(gcl.list.time_intervals));
+            gcls.push_back(gcl);
+        }
+        return true;
+    }
+    if (missing) return false;
+
+    json &j = *get_gcl_config();
 
     const std::string mac_addr = get_mac_address();
     int id = -1;
@@ -271,11 +468,11 @@ void setup_gcl() {
     // id for current switch is not found in schedule, no need to exit.
     if (id == -1) {
         std::cout << "[WARNING] Could not find node with mac address " << mac_addr << "in the schedule"<< std::endl;
-        return;
+        return true;
     }
 
-    json topo = *get_config();
-    json links = topo["fwd"];
+    json &topo = *get_config();
+    json &links = topo["fwd"];
 
     // mapping: link id -> src port
     std::unordered_map<int, int> link_port_map;
@@ -289,6 +486,7 @@ void setup_gcl() {
     }
 
     // find links whose src is the current node
+    bool fits = true;
     for (auto &link : j) {
         const std::string type = link["type"];
         if (type != "link") continue;
@@ -305,8 +503,183 @@ void setup_gcl() {
         // const int src_port = link_port_map[link_id];
         const int src_port = link["from_port"].get<int>();
 
-        apply_gcl(link, src_port);
+        PortGcl gcl;
+        gcl.port = src_port + 1;
+        if (!compile_link_gcl(link, src_port, &gcl.list)) {
+            fits = false;
+            continue;
+        }
+        gcls.push_back(gcl);
     }
+    return fits;
+}
+
+/**
+Description: Install the GCLs of the current node as the ports' admin lists.
+The lists become operational at the first cycle boundary at or after admin_base_time
+(synchronized time in ns), or at once with GCL_BASE_TIME_NOW.
+*/
+void setup_gcl_with_base_time(uint64_t admin_base_time) {
+    std::vector<PortGcl> gcls;
+    if (!load_gcls(gcls)) exit(1);
+
+    for (auto &gcl : gcls) gcl_set_admin_list(gcl.port, &gcl.list, admin_base_time);
+}
+
+void setup_gcl() { setup_gcl_with_base_time(GCL_BASE_TIME_NOW); }
+
+static bool same_gcl(const GateControlList &a, const GateControlList &b) {
+    if (a.length != b.length) return false;
+    for (int i = 0; i < a.length; ++i) {
+        if (a.gate_states[i] != b.gate_states[i] || a.time_intervals[i] != b.time_intervals[i]) return false;
+    }
+    return true;
+}
+
+// switch rule changes of a reload, written at the cycle boundary its GCLs switch over at
+static std::vector<SwitchRuleEntry> pending_switch_rules;
+static bool switch_rules_pending;
+static uint64_t switch_rules_change_time;  // synchronized time (ns)
+
+// leaves the time sync main loop time to reach the boundary before its first GCL entry ends
+static const uint64_t RELOAD_LEAD_NS = 1000000;
+
+// switch rules and GCLs of the new files, filled by the reload thread
+struct PreparedReload {
+    std::vector<SwitchRuleEntry> rules;
+    std::vector<PortGcl> gcls;
+    bool valid;
+};
+static PreparedReload prepared_reload;
+static std::thread reload_thread;
+static bool reload_running;                     // main loop only
+static std::atomic<bool> reload_prepared(false);  // prepared_reload is complete
+
+// parse and compile the new files next to the running config, which is kept if they are invalid
+static void prepare_reload() {
+    PreparedReload &reload = prepared_reload;
+    ConfigCache running_config = take_config_cache();
+    reload.valid = false;
+    try {
+        reload.valid = load_switch_rules(reload.rules) && load_gcls(reload.gcls);
+        if (!reload.valid) std::cout << "[ERROR] reload failed, keeping the running config" << std::endl;
+    } catch (const std::exception &e) {
+        std::cout << "[ERROR] reload failed, keeping the running config: " << e.what() << std::endl;
+    }
+    if (reload.valid) free_config_cache(running_config);
+    else restore_config_cache(running_config);
+    reload_prepared.store(true, std::memory_order_release);
+}
+
+/**
+ * description: re-read config.bin or config.json/schedule.json on a separate thread, so parsing
+ * and compiling the GCLs of every port stays out of the time sync main loop.
+ * return: 0 if the reload started, 1 if the previous one is still being prepared.
+ * */
+int reload_topo_start() {
+    if (reload_running) return 1;
+    reload_running = true;
+    reload_prepared.store(false, std::memory_order_relaxed);
+    reload_thread = std::thread(prepare_reload);
+    return 0;
+}
+
+/**
+ * description: apply a reload prepared by reload_topo_start(), only the differences to the running
+ * switch. Changed GCLs are installed as admin lists that switch over at the next cycle boundary
+ * shared by all ports (picked up by gcl_config_change_poll()), and changed switch rules are
+ * rewritten in place at the same boundary by reload_switch_rules_poll(). Ports that are no longer
+ * scheduled go back to best-effort only.
+ * ptp_ports and system_identity are only read at startup.
+ * return: number of switch rules and ports changed, 0 while no reload is finished, -1 on config errors.
+ * */
+int reload_topo_poll() {
+    if (!reload_running || !reload_prepared.load(std::memory_order_acquire)) return 0;
+    reload_thread.join();
+    reload_running = false;
+    if (!prepared_reload.valid) return -1;
+
+    std::vector<SwitchRuleEntry> rules;
+    std::vector<PortGcl> gcls;
+    rules.swap(prepared_reload.rules);
+    gcls.swap(prepared_reload.gcls);
+
+    UScaledNs local_ts, sync_ts;
+    get_current_local_sync_ts(&local_ts, &sync_ts);
+    const uint64_t change_time = gcl_common_cycle_boundary(sync_ts.nsec + RELOAD_LEAD_NS);
+
+    int changes = 0;
+    for (auto &old_rule : applied_switch_rules) {
+        bool kept = false;
+        for (auto &rule : rules) {
+            if (memcmp(rule.mac, old_rule.mac, 6) == 0) {
+                kept = (rule.port == old_rule.port);
+                break;
+            }
+        }
+        if (!kept) changes++;
+    }
+    for (auto &rule : rules) {
+        bool known = false;
+        for (auto &old_rule : applied_switch_rules) known = known || memcmp(rule.mac, old_rule.mac, 6) == 0;
+        if (!known) changes++;
+    }
+    pending_switch_rules = rules;
+    switch_rules_pending = true;
+    switch_rules_change_time = change_time;
+
+    for (int port = 1; port <= N_PORTS; ++port) {
+        // same list as gcl_init() for ports without schedule: best-effort only
+        GateControlList list;
+        list.length = GCL_LIST_LEN;
+        for (int i = 0; i < GCL_LIST_LEN; ++i) {
+            list.gate_states[i] = 2;
+            list.time_intervals[i] = 0x400;
+        }
+        for (auto &gcl : gcls) {
+            if (gcl.port == port) list = gcl.list;
+        }
+
+        GateControlList running;
+        if (gcl_get_pending_admin_list(port, &running) != 1) gcl_get_oper_list(port, &running);
+        if (same_gcl(running, list)) continue;
+
+        gcl_set_admin_list(port, &list, change_time);
+        changes++;
+    }
+
+    std::cout << "[INFO] reload done, " << changes << " changes at " << change_time << " ns" << std::endl;
+    return changes;
+}
+
+/**
+ * description: write the switch rules of the last reload once its GCLs are installed, called from
+ * the time sync main loop with the number of ports whose config change is still pending.
+ * */
+void reload_switch_rules_poll(int gcl_pending) {
+    if (!switch_rules_pending || gcl_pending > 0) return;
+
+    UScaledNs local_ts, sync_ts;
+    get_current_local_sync_ts(&local_ts, &sync_ts);
+    if (sync_ts.nsec < switch_rules_change_time) return;
+    switch_rules_pending = false;
+
+    for (auto &old_rule : applied_switch_rules) {
+        bool kept = false;
+        for (auto &rule : pending_switch_rules) {
+            if (memcmp(rule.mac, old_rule.mac, 6) == 0) {
+                kept = true;
+                break;
+            }
+        }
+        if (!kept) remove_switch_rule(old_rule.mac);
+    }
+    for (auto &rule : pending_switch_rules) {
+        if (update_switch_rule(rule.mac, rule.port) == 1) {
+            std::cout << "[ERROR] Could not update switch rule to port " << rule.port << std::endl;
+        }
+    }
+    applied_switch_rules = pending_switch_rules;
 }
 
 /**
@@ -314,7 +687,7 @@ void setup_gcl() {
  * return: ptp ports' state. (0: MASTER, 1: SLAVE, 2: PASSIVE, 3: DISABLED)
  * */
 void get_ptp_ports(int *ptp_ports) {
-    json j = *get_config();
+    json &j = *get_config();
 
     const std::string mac_addr = get_mac_address();
     int id = -1;
@@ -360,7 +733,7 @@ void get_ptp_ports(int *ptp_ports) {
  * return: clock identity is a uint8_t array (size: 8)
  * */
 void get_clock_identity(ClockIdentity clock_identity) {
-    json j = *get_config();
+    json &j = *get_config();
 
     const std::string mac_addr = get_mac_address();
     int id = -1;
@@ -405,7 +778,7 @@ void get_clock_identity(ClockIdentity clock_identity) {
  * return: priority1 is a uint8_t number
  * */
 void get_priority1(uint8_t* priority1) {
-    json j = *get_config();
+    json &j = *get_config();
 
     const std::string mac_addr = get_mac_address();
     int id = -1;
@@ -446,7 +819,28 @@ void get_config_from_json(
     int *ptp_ports,
     bool *externalPortConfigurationEnabled)
 {
-    json j = *get_config();
+    if (const TopoImageNode *node = get_image_node()) {
+        if (node->flags & TOPO_HAS_PTP_PORTS) {
+            for (int i = 0; i < TOPO_IMAGE_PORTS; ++i) {
+                ptp_ports[i] = node->ptp_ports[i];
+                log_debug("ptp ports[%d]: %s", i, lookup_port_state_name((PortState)ptp_ports[i]));
+            }
+        }
+        if (node->flags & TOPO_HAS_EXT_PORT_CONFIG) {
+            *externalPortConfigurationEnabled = (bool)node->external_port_config;
+        }
+        if (node->flags & TOPO_HAS_SYSTEM_IDENTITY) {
+            system_identity->priority1               = node->priority1;
+            system_identity->clockClass              = node->clock_class;
+            system_identity->clockAccuracy           = node->clock_accuracy;
+            system_identity->offsetScaledLogVariance = node->offset_scaled_log_variance;
+            system_identity->priority2               = node->priority2;
+            memcpy(system_identity->clockIdentity, node->clock_identity, sizeof(ClockIdentity));
+        }
+        return;
+    }
+
+    json &j = *get_config();
 
     const std::string mac_addr = get_mac_address();
     int id = -1;
@@ -5,6 +5,11 @@ extern "C" {
     #include "tsn_drivers/ptp_types.h"
     void setup_topo();
     void setup_gcl();
+    void setup_gcl_with_base_time(uint64_t admin_base_time);
+    void set_gcl_absorb_gaps(int absorb);
+    int reload_topo_start();
+    int reload_topo_poll();
+    void reload_switch_rules_poll(int gcl_pending);
     void get_ptp_ports(int *ptp_ports);
     void get_clock_identity(ClockIdentity clock_identity);
     void get_priority1(uint8_t* priority1);
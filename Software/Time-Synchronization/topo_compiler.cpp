@@ -0,0 +1,471 @@
+// Offline compiler: config.json + schedule.json -> config.bin (see topo_image.h).
+// Usage: ./topo_compiler [-a] [config.json] [schedule.json] [config.bin]
+// -a closes the shortest best-effort (and PTP) gaps of a GCL that does not fit, as time_sync -a.
+//
+// Everything the runtimes derive from the JSON files at startup is precomputed here:
+// switch rules, compiled GCL of every output port, input/output streams and compute
+// windows of every job. time_sync, switch_config and the packetized PLC runtime load
+// config.bin when it is present and then only touch their own node's section.
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "gcl_compiler.h"
+#include "json.hpp"
+#include "topo_image.h"
+
+using json = nlohmann::json;
+
+struct NodeSection {
+    TopoImageNode node;
+    std::vector<TopoImageSwitchRule> rules;
+    std::vector<TopoImageGcl> gcls;
+    std::vector<TopoImageStream> streams;
+    std::vector<TopoImageJob> jobs;
+    std::vector<TopoImagePoint> points;
+};
+
+static bool parse_mac(const std::string &str, uint8_t mac[6]) {
+    unsigned int bytes[6];
+    if (str.size() != 17 ||
+        std::sscanf(str.c_str(), "%02x:%02x:%02x:%02x:%02x:%02x", &bytes[0], &bytes[1],
+                    &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) mac[i] = (uint8_t)bytes[i];
+    return true;
+}
+
+static json load_json(const std::string &path) {
+    json j;
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "[ERROR] Could not open " << path << std::endl;
+        exit(1);
+    }
+    file >> j;
+    return j;
+}
+
+// same rule as find_src_dst() in Packetized-PLC-IO/config.cpp
+static bool find_src_dst(const json &sche, int job_id, int flow_id, int &src_id, int &dst_id) {
+    std::unordered_set<int> out_flow, in_flow;
+    for (const auto &elem : sche) {
+        if (elem["type"] != "link") continue;
+        for (const auto &flow : elem["schedule"]) {
+            if (flow.find("job_id") == flow.end() || flow.find("flow_id") == flow.end()) continue;
+            if (job_id == flow["job_id"].get<int>() && flow_id == flow["flow_id"].get<int>()) {
+                out_flow.insert(elem["from"].get<int>());
+                in_flow.insert(elem["to"].get<int>());
+            }
+        }
+    }
+    src_id = dst_id = -1;
+    for (int id : out_flow) {
+        if (in_flow.find(id) != in_flow.end()) continue;
+        if (src_id != -1) return false;
+        src_id = id;
+    }
+    for (int id : in_flow) {
+        if (out_flow.find(id) != out_flow.end()) continue;
+        if (dst_id != -1) return false;
+        dst_id = id;
+    }
+    return src_id != -1 && dst_id != -1;
+}
+
+// returns false if a link's GCL does not fit, after reporting every such link of the switch
+static bool compile_node_gcls(const json &sche, int switch_id, bool absorb, NodeSection &section) {
+    bool ok = true;
+    for (const auto &link : sche) {
+        if (link["type"] != "link" || link["from"].get<int>() != switch_id) continue;
+
+        std::vector<GclFlowWindow> windows;
+        for (const auto &item : link["schedule"]) {
+            windows.push_back({item["period"].get<int>(), item["start"].get<int>(),
+                               item["end"].get<int>()});
+        }
+        GclCompilerOptions options;
+        options.absorb = absorb;
+        if (link.find("link_speed") != link.end()) options.link_speed_mbps = link["link_speed"].get<int>();
+        if (link.find("max_frame_size") != link.end()) options.max_frame_bytes = link["max_frame_size"].get<int>();
+
+        GclCompileResult result;
+        if (!compile_gcl(windows, options, &result)) {
+            std::cout << "[ERROR] Could not compile GCL of link " << switch_id << " -> "
+                      << link["to"].get<int>() << " (port " << link["from_port"].get<int>() << "): "
+                      << result.report << std::endl;
+            ok = false;
+            continue;
+        }
+
+        TopoImageGcl gcl;
+        memset(&gcl, 0, sizeof(gcl));
+        gcl.port = (uint16_t)link["from_port"].get<int>();
+        gcl.length = result.list.length;
+        for (int i = 0; i < result.list.length; i++) {
+            gcl.gate_states[i] = result.list.gate_states[i];
+            gcl.time_intervals[i] = result.list.time_intervals[i];
+        }
+        section.gcls.push_back(gcl);
+    }
+    return ok;
+}
+
+// switch rules of flow replicas, as load_replica_rules() in topo.cpp: a window with "replica": r on a
+// link out of this switch sends topo_replica_mac(dst, r) out of the link's port, and the flow's
+// dst switch delivers it to its local port (the "fwd" port of its own mac)
+static bool compile_replica_rules(const json &topo, const json &sche, int id,
+                                  std::unordered_map<int, std::string> &id_to_mac, std::vector<TopoImageSwitchRule> &rules) {
+    int local_port = -1;
+    for (const auto &link : topo["fwd"]) {
+        if (link["src"].get<int>() == id && link["dst"].get<int>() == id) local_port = link["src_port"].get<int>();
+    }
+    for (const auto &link : sche) {
+        if (link["type"] != "link") continue;
+        const int from = link["from"].get<int>();
+        const int to = link["to"].get<int>();
+        if (from != id && to != id) continue;
+        for (const auto &flow : link["schedule"]) {
+            if (flow.find("replica") == flow.end()) continue;
+            const int job_id = flow["job_id"].get<int>();
+            const int flow_id = flow["flow_id"].get<int>();
+            int src_id, dst_id;
+            uint8_t mac[6];
+            if (!find_src_dst(sche, job_id, flow_id, src_id, dst_id) || !parse_mac(id_to_mac[dst_id], mac)) {
+                std::cout << "[ERROR] Flow#" << flow_id << " in job#" << job_id << " is not valid!" << std::endl;
+                return false;
+            }
+            int port;
+            if (from == id) port = link["from_port"].get<int>();
+            else if (dst_id == id) port = local_port;
+            else continue;
+            if (port < 0) {
+                std::cout << "[ERROR] Node " << id << " has no \"fwd\" entry for its own mac" << std::endl;
+                return false;
+            }
+
+            TopoImageSwitchRule rule;
+            memset(&rule, 0, sizeof(rule));
+            topo_replica_mac(mac, flow["replica"].get<int>(), rule.mac);
+            rule.port = (uint8_t)port;
+            auto same = std::find_if(rules.begin(), rules.end(),
+                                     [&](const TopoImageSwitchRule &r) { return memcmp(r.mac, rule.mac, 6) == 0; });
+            if (same == rules.end()) {
+                rules.push_back(rule);
+            } else if (same->port != rule.port) {
+                std::cout << "[ERROR] Replica " << flow["replica"].get<int>() << " of flow#" << flow_id << " in job#"
+                          << job_id << " leaves node " << id << " on another port than earlier flows to node "
+                          << dst_id << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// "payload": [{"type": "bool"|"int"|"dint"|"real", "index": n}, ...] of a flow, appended to section.points
+static void compile_payload(const json &flow, TopoImageStream &stream, NodeSection &section) {
+    stream.first_point = (uint32_t)section.points.size();
+    stream.point_count = 0;
+    if (flow.find("payload") == flow.end()) return;
+    for (const auto &item : flow["payload"]) {
+        const std::string type = item["type"].get<std::string>();
+        const int index = item["index"].get<int>();
+        TopoImagePoint point;
+        memset(&point, 0, sizeof(point));
+        if (type == "bool") point.type = TOPO_POINT_BOOL;
+        else if (type == "int") point.type = TOPO_POINT_INT;
+        else if (type == "dint") point.type = TOPO_POINT_DINT;
+        else if (type == "real") point.type = TOPO_POINT_REAL;
+        else {
+            std::cout << "[ERROR] Unknown payload point type \"" << type << "\" in flow#"
+                      << flow["flow_id"].get<int>() << std::endl;
+            exit(1);
+        }
+        if (index < 0 || index > 0xFFFF) {
+            std::cout << "[ERROR] Invalid payload point index " << index << " in flow#"
+                      << flow["flow_id"].get<int>() << std::endl;
+            exit(1);
+        }
+        point.index = (uint16_t)index;
+        section.points.push_back(point);
+        stream.point_count++;
+    }
+}
+
+// "input_policy": "hold"|"default"|"skip" of a job, "hold" if not given
+static uint8_t parse_policy(const json &job) {
+    if (job.find("input_policy") == job.end()) return TOPO_POLICY_HOLD;
+    const std::string policy = job["input_policy"].get<std::string>();
+    if (policy == "hold") return TOPO_POLICY_HOLD;
+    if (policy == "default") return TOPO_POLICY_DEFAULT;
+    if (policy == "skip") return TOPO_POLICY_SKIP;
+    std::cout << "[ERROR] Unknown input_policy \"" << policy << "\" in job#" << job["job_id"].get<int>() << std::endl;
+    exit(1);
+}
+
+static void compile_node_jobs(const json &sche, const json &sched_switch, int my_id,
+                              std::unordered_map<int, std::string> &id_to_mac, NodeSection &section) {
+    std::vector<TopoImageStream> inputs, outputs;
+    for (const auto &job : sched_switch["schedule"]) {
+        const int job_id = job["job_id"].get<int>();
+        for (const auto &link : sche) {
+            if (link["type"] != "link") continue;
+            const int from = link["from"].get<int>();
+            const int to = link["to"].get<int>();
+            for (const auto &flow : link["schedule"]) {
+                if (flow.find("job_id") == flow.end() || flow["job_id"].get<int>() != job_id) continue;
+                const int flow_id = flow["flow_id"].get<int>();
+
+                TopoImageStream stream;
+                memset(&stream, 0, sizeof(stream));
+                stream.seq_id = (uint32_t)((job_id << 8) | flow_id);
+                // replicas of a flow carry the same payload, their streams share the points of the first one
+                auto same_seq = [&](const TopoImageStream &s) { return s.seq_id == stream.seq_id; };
+                auto input = std::find_if(inputs.begin(), inputs.end(), same_seq);
+                auto output = std::find_if(outputs.begin(), outputs.end(), same_seq);
+                if (input != inputs.end() || output != outputs.end()) {
+                    const TopoImageStream &first = input != inputs.end() ? *input : *output;
+                    stream.first_point = first.first_point;
+                    stream.point_count = first.point_count;
+                } else if (to == my_id || from == my_id) {
+                    compile_payload(flow, stream, section);
+                }
+                // replicas of an input are one stream, the PLC drops the duplicate frames
+                if (to == my_id && input == inputs.end()) inputs.push_back(stream);
+                if (from == my_id) {
+                    int src_id, dst_id;
+                    uint8_t dst_mac[6];
+                    if (!find_src_dst(sche, job_id, flow_id, src_id, dst_id) ||
+                        !parse_mac(id_to_mac[dst_id], dst_mac)) {
+                        std::cout << "[ERROR] Flow#" << flow_id << " in job#" << job_id
+                                  << " is not valid!" << std::endl;
+                        exit(1);
+                    }
+                    topo_replica_mac(dst_mac, flow.find("replica") != flow.end() ? flow["replica"].get<int>() : 0,
+                                     stream.dst_mac);
+                    outputs.push_back(stream);
+                }
+            }
+        }
+
+        TopoImageJob image_job;
+        image_job.job_id = (uint32_t)job_id;
+        image_job.period = job["period"].get<uint32_t>();
+        image_job.start = job["start"].get<uint32_t>();
+        image_job.end = job["end"].get<uint32_t>();
+        image_job.input_policy = parse_policy(job);
+        memset(image_job.reserved, 0, sizeof(image_job.reserved));
+        section.jobs.push_back(image_job);
+    }
+    section.node.input_stream_count = (uint16_t)inputs.size();
+    section.node.output_stream_count = (uint16_t)outputs.size();
+    section.streams = inputs;
+    section.streams.insert(section.streams.end(), outputs.begin(), outputs.end());
+}
+
+template <typename T>
+static uint32_t append(std::vector<uint8_t> &buf, const T *data, size_t count) {
+    while (buf.size() % 8) buf.push_back(0);
+    const uint32_t offset = (uint32_t)buf.size();
+    const uint8_t *bytes = (const uint8_t *)data;
+    buf.insert(buf.end(), bytes, bytes + sizeof(T) * count);
+    return offset;
+}
+
+// write the image next to path and rename it over path, so time_sync, which maps config.bin
+// and reloads it on change, only ever sees the old or the complete new image
+static bool write_image(const std::string &path, const std::vector<uint8_t> &buf) {
+    const std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "[ERROR] Could not create " << temp_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    size_t written = 0;
+    while (written < buf.size()) {
+        ssize_t n = write(fd, buf.data() + written, buf.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += n;
+    }
+    if (written < buf.size() || fsync(fd) != 0) {
+        std::cout << "[ERROR] Could not write " << temp_path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    close(fd);
+
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cout << "[ERROR] Could not replace " << path << ": " << strerror(errno) << std::endl;
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    // make the rename itself durable
+    const size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int dir_fd = open(dir.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    bool absorb = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-a") absorb = true;
+        else args.push_back(argv[i]);
+    }
+    const std::string config_path = args.size() > 0 ? args[0] : "config.json";
+    const std::string schedule_path = args.size() > 1 ? args[1] : "schedule.json";
+    const std::string image_path = args.size() > 2 ? args[2] : TOPO_IMAGE_FILE;
+
+    const json topo = load_json(config_path);
+    const json sche = load_json(schedule_path);
+
+    std::unordered_map<int, std::string> id_to_mac;
+    for (const auto &node : topo["nodes"]) {
+        std::string mac = node["mac"].get<std::string>();
+        std::transform(mac.begin(), mac.end(), mac.begin(), [](unsigned char c) { return std::tolower(c); });
+        id_to_mac[node["id"].get<int>()] = mac;
+    }
+
+    std::map<std::vector<uint8_t>, NodeSection> sections;  // sorted by mac
+    int failed_nodes = 0;  // nodes with a GCL that does not fit, all of them are reported before giving up
+    for (const auto &item : topo["nodes"]) {
+        NodeSection section;
+        TopoImageNode &node = section.node;
+        memset(&node, 0, sizeof(node));
+        const int id = item["id"].get<int>();
+        node.node_id = (uint16_t)id;
+        node.type = item["type"].get<std::string>() == "switch" ? TOPO_NODE_SWITCH : TOPO_NODE_DEVICE;
+        if (!parse_mac(id_to_mac[id], node.mac)) {
+            std::cout << "[ERROR] Invalid mac address of node " << id << std::endl;
+            return 1;
+        }
+
+        if (item.find("ptp_ports") != item.end() && item["ptp_ports"].is_array() && item["ptp_ports"].size() > 0) {
+            auto ports = item["ptp_ports"].get<std::vector<int> >();
+            for (int i = 0; i < (int)ports.size() && i < TOPO_IMAGE_PORTS; ++i) node.ptp_ports[i] = (int8_t)ports[i];
+            node.flags |= TOPO_HAS_PTP_PORTS;
+        }
+        if (item.find("externalPortConfigurationEnabled") != item.end()) {
+            node.external_port_config = (uint8_t)item["externalPortConfigurationEnabled"].get<int>();
+            node.flags |= TOPO_HAS_EXT_PORT_CONFIG;
+        }
+        if (item.find("system_identity") != item.end()) {
+            const json &si = item["system_identity"];
+            node.priority1 = (uint8_t)si["priority1"].get<int>();
+            node.clock_class = (uint8_t)si["clockClass"].get<int>();
+            node.clock_accuracy = (uint8_t)si["clockAccuracy"].get<int>();
+            node.offset_scaled_log_variance = (uint16_t)si["offsetScaledLogVariance"].get<int>();
+            node.priority2 = (uint8_t)si["priority2"].get<int>();
+            auto clock_identity = si["clock_identity"].get<std::vector<int> >();
+            for (int i = 0; i < (int)clock_identity.size() && i < 8; ++i) node.clock_identity[i] = (uint8_t)clock_identity[i];
+            node.flags |= TOPO_HAS_SYSTEM_IDENTITY;
+        }
+
+        // switch rules, as setup_topo()
+        for (const auto &link : topo["fwd"]) {
+            if (link["src"].get<int>() != id) continue;
+            TopoImageSwitchRule rule;
+            memset(&rule, 0, sizeof(rule));
+            const int dst = link["dst"].get<int>();
+            if (id_to_mac.find(dst) == id_to_mac.end() || !parse_mac(id_to_mac[dst], rule.mac)) {
+                std::cout << "[ERROR] Could not find node with id " << dst << std::endl;
+                return 1;
+            }
+            rule.port = (uint8_t)link["src_port"].get<int>();
+            section.rules.push_back(rule);
+        }
+
+        // GCL, streams and jobs, as setup_gcl() and init_configure()
+        for (const auto &sched_switch : sche) {
+            if (sched_switch["type"] != "switch") continue;
+            uint8_t mac[6];
+            if (!parse_mac(sched_switch["mac"].get<std::string>(), mac) || memcmp(mac, node.mac, 6) != 0) continue;
+
+            node.flags |= TOPO_HAS_SCHEDULE;
+            if (!compile_node_gcls(sche, sched_switch["id"].get<int>(), absorb, section)) failed_nodes++;
+            compile_node_jobs(sche, sched_switch, id, id_to_mac, section);
+            break;
+        }
+        if (!compile_replica_rules(topo, sche, id, id_to_mac, section.rules)) return 1;
+
+        node.switch_rule_count = (uint16_t)section.rules.size();
+        node.gcl_count = (uint16_t)section.gcls.size();
+        node.job_count = (uint16_t)section.jobs.size();
+        node.point_count = (uint16_t)section.points.size();
+
+        std::vector<uint8_t> key(node.mac, node.mac + 6);
+        if (sections.find(key) != sections.end()) {
+            std::cout << "[ERROR] Duplicate mac address " << id_to_mac[id] << std::endl;
+            return 1;
+        }
+        sections[key] = section;
+    }
+    if (failed_nodes) {
+        std::cout << "[ERROR] GCLs of " << failed_nodes << " node(s) do not fit, no image written" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> buf;
+    TopoImageHeader header;
+    memset(&header, 0, sizeof(header));
+    append(buf, &header, 1);
+
+    std::vector<TopoImageNodeIndex> index(sections.size());
+    header.index_offset = append(buf, index.data(), index.size());
+
+    size_t i = 0;
+    for (auto &kv : sections) {
+        NodeSection &section = kv.second;
+        const uint32_t node_offset = append(buf, &section.node, 1);
+        section.node.switch_rules_offset = append(buf, section.rules.data(), section.rules.size());
+        section.node.gcls_offset = append(buf, section.gcls.data(), section.gcls.size());
+        section.node.streams_offset = append(buf, section.streams.data(), section.streams.size());
+        section.node.jobs_offset = append(buf, section.jobs.data(), section.jobs.size());
+        section.node.points_offset = append(buf, section.points.data(), section.points.size());
+        memcpy(&buf[node_offset], &section.node, sizeof(TopoImageNode));
+
+        memcpy(index[i].mac, section.node.mac, 6);
+        index[i].node_id = section.node.node_id;
+        index[i].offset = node_offset;
+        index[i].size = (uint32_t)buf.size() - node_offset;
+        std::cout << "node " << section.node.node_id << " (" << id_to_mac[section.node.node_id] << "): "
+                  << section.rules.size() << " switch rules, " << section.gcls.size() << " GCLs, "
+                  << section.node.input_stream_count << "/" << section.node.output_stream_count
+                  << " input/output streams, " << section.jobs.size() << " jobs, "
+                  << section.points.size() << " payload points" << std::endl;
+        i++;
+    }
+    while (buf.size() % 8) buf.push_back(0);
+
+    header.magic = TOPO_IMAGE_MAGIC;
+    header.version = TOPO_IMAGE_VERSION;
+    header.node_count = (uint16_t)sections.size();
+    header.total_size = (uint32_t)buf.size();
+    memcpy(&buf[0], &header, sizeof(header));
+    memcpy(&buf[header.index_offset], index.data(), index.size() * sizeof(TopoImageNodeIndex));
+
+    if (!write_image(image_path, buf)) return 1;
+    std::cout << "[INFO] wrote " << image_path << ": " << sections.size() << " nodes, "
+              << buf.size() << " bytes" << std::endl;
+    return 0;
+}
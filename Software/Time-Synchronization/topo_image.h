@@ -0,0 +1,274 @@
+/*
+ * Compiled topology/schedule image ("config.bin").
+ *
+ * Built offline from config.json + schedule.json by topo_compiler, and mmap-ed
+ * at startup by time_sync/switch_config and by the packetized PLC runtime, so
+ * that each node only reads its own section instead of parsing the JSON files.
+ *
+ * Layout (all offsets are from the start of the image, all sections 8-byte aligned,
+ * integers in host byte order of the compiler, i.e. little endian on x86 and Zynq):
+ *
+ *   TopoImageHeader
+ *   TopoImageNodeIndex[node_count]      sorted by mac, binary searched at startup
+ *   per node: TopoImageNode, followed by its
+ *     TopoImageSwitchRule[switch_rule_count]
+ *     TopoImageGcl[gcl_count]
+ *     TopoImageStream[input_stream_count + output_stream_count]
+ *     TopoImageJob[job_count]
+ *     TopoImagePoint[point_count]       payload points of all its streams
+ *
+ * This header is shared with Packetized-PLC-IO/topo_image.h, keep both in sync
+ * and bump TOPO_IMAGE_VERSION on any layout change.
+ */
+#ifndef TOPO_IMAGE_H
+#define TOPO_IMAGE_H
+#ifdef __cplusplus
+extern "C"{
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TOPO_IMAGE_MAGIC     0x4F504F54  // "TOPO"
+#define TOPO_IMAGE_VERSION   3
+#define TOPO_IMAGE_FILE      "config.bin"
+#define TOPO_IMAGE_PORTS     5           // [local, ETH1, ETH2, ETH3, ETH4]
+#define TOPO_IMAGE_GCL_LEN   16
+
+#define TOPO_NODE_DEVICE     0
+#define TOPO_NODE_SWITCH     1
+
+// TopoImageNode.flags
+#define TOPO_HAS_PTP_PORTS        0x01
+#define TOPO_HAS_EXT_PORT_CONFIG  0x02
+#define TOPO_HAS_SYSTEM_IDENTITY  0x04
+#define TOPO_HAS_SCHEDULE         0x08  // node is listed as a switch in schedule.json
+
+// TopoImagePoint.type, the "type" of a "payload" point in schedule.json
+#define TOPO_POINT_BOOL   0   // "bool", one bit
+#define TOPO_POINT_INT    1   // "int", one 16-bit word
+#define TOPO_POINT_DINT   2   // "dint", two words
+#define TOPO_POINT_REAL   3   // "real", two words
+
+// TopoImageJob.input_policy, the "input_policy" of a job in schedule.json
+#define TOPO_POLICY_HOLD     0   // "hold", missing inputs keep their last value (default)
+#define TOPO_POLICY_DEFAULT  1   // "default", missing inputs are cleared
+#define TOPO_POLICY_SKIP     2   // "skip", the cycle is not run
+
+// 802.1CB-style replicas: at most TOPO_MAX_REPLICAS copies of a flow ("replicas" in config.json),
+// each sent to one of TOPO_REPLICA_MACS addresses of its destination ("replica" of a window in schedule.json)
+#define TOPO_MAX_REPLICAS    4
+#define TOPO_REPLICA_MACS    16
+
+typedef struct TopoImageHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t node_count;
+	uint32_t total_size;
+	uint32_t index_offset;
+} TopoImageHeader;
+
+typedef struct TopoImageNodeIndex {
+	uint8_t mac[6];
+	uint16_t node_id;
+	uint32_t offset;   // TopoImageNode
+	uint32_t size;     // node section including its tables
+} TopoImageNodeIndex;
+
+typedef struct TopoImageNode {
+	uint16_t node_id;
+	uint8_t type;
+	uint8_t flags;
+	uint8_t mac[6];
+	int8_t ptp_ports[TOPO_IMAGE_PORTS];
+	uint8_t external_port_config;
+	// system identity
+	uint8_t priority1;
+	uint8_t clock_class;
+	uint8_t clock_accuracy;
+	uint8_t priority2;
+	uint16_t offset_scaled_log_variance;
+	uint8_t clock_identity[8];
+	uint16_t switch_rule_count;
+	uint16_t gcl_count;
+	uint16_t input_stream_count;
+	uint16_t output_stream_count;
+	uint16_t job_count;
+	uint16_t point_count;
+	uint32_t switch_rules_offset;
+	uint32_t gcls_offset;
+	uint32_t streams_offset;       // input streams first, then output streams
+	uint32_t jobs_offset;
+	uint32_t points_offset;
+} TopoImageNode;
+
+typedef struct TopoImageSwitchRule {
+	uint8_t mac[6];
+	uint8_t port;
+	uint8_t reserved;
+} TopoImageSwitchRule;
+
+// compiled GCL of one output port, time intervals in 2^11 ns
+typedef struct TopoImageGcl {
+	uint16_t port;                // port number, start from 0
+	uint16_t length;
+	uint16_t gate_states[TOPO_IMAGE_GCL_LEN];
+	uint16_t time_intervals[TOPO_IMAGE_GCL_LEN];
+} TopoImageGcl;
+
+typedef struct TopoImageStream {
+	uint32_t seq_id;              // (job_id << 8) | flow_id
+	uint8_t dst_mac[6];           // output streams only
+	uint16_t point_count;         // payload points of the stream
+	uint32_t first_point;         // index into the node's TopoImagePoint table
+	uint32_t reserved;
+} TopoImageStream;
+
+// compute window of a job, in 2^14 ns slots
+typedef struct TopoImageJob {
+	uint32_t job_id;
+	uint32_t period;
+	uint32_t start;
+	uint32_t end;
+	uint8_t input_policy;         // TOPO_POLICY_*, applied when inputs miss the compute release
+	uint8_t reserved[3];
+} TopoImageJob;
+
+// one process-image point carried in a stream's payload
+typedef struct TopoImagePoint {
+	uint8_t type;                 // TOPO_POINT_*
+	uint8_t reserved;
+	uint16_t index;               // bit address for bools (byte * 8 + bit), word address otherwise
+} TopoImagePoint;
+
+typedef struct TopoImage {
+	const uint8_t *base;
+	size_t size;
+} TopoImage;
+
+// nonzero if count entries of elem_size bytes at offset lie inside the image
+static inline int topo_image_fits(size_t size, uint32_t offset, uint64_t count, size_t elem_size) {
+	return offset + count * elem_size <= size;
+}
+
+// nonzero if the node section and all its tables lie inside the image, and every stream's
+// payload points inside the node's point table
+static inline int topo_image_node_valid(const uint8_t *base, size_t size, const TopoImageNodeIndex *index) {
+	if (!topo_image_fits(size, index->offset, 1, sizeof(TopoImageNode)) ||
+		!topo_image_fits(size, index->offset, 1, index->size)) return 0;
+	const TopoImageNode *node = (const TopoImageNode *)(base + index->offset);
+	const uint32_t stream_count = (uint32_t)node->input_stream_count + node->output_stream_count;
+	if (!topo_image_fits(size, node->switch_rules_offset, node->switch_rule_count, sizeof(TopoImageSwitchRule)) ||
+		!topo_image_fits(size, node->gcls_offset, node->gcl_count, sizeof(TopoImageGcl)) ||
+		!topo_image_fits(size, node->streams_offset, stream_count, sizeof(TopoImageStream)) ||
+		!topo_image_fits(size, node->jobs_offset, node->job_count, sizeof(TopoImageJob)) ||
+		!topo_image_fits(size, node->points_offset, node->point_count, sizeof(TopoImagePoint))) return 0;
+
+	const TopoImageGcl *gcls = (const TopoImageGcl *)(base + node->gcls_offset);
+	for (int i = 0; i < node->gcl_count; i++) {
+		if (gcls[i].length > TOPO_IMAGE_GCL_LEN) return 0;
+	}
+	const TopoImageStream *streams = (const TopoImageStream *)(base + node->streams_offset);
+	for (uint32_t i = 0; i < stream_count; i++) {
+		if ((uint64_t)streams[i].first_point + streams[i].point_count > node->point_count) return 0;
+	}
+	return 1;
+}
+
+/**
+ * @description: map a compiled image and check its header and the bounds of every node section.
+ * @return {int} 0 on success, -1 if the file is missing, -2 if it is invalid.
+ */
+static inline int topo_image_open(TopoImage *image, const char *path) {
+	struct stat st;
+	image->base = NULL;
+	image->size = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TopoImageHeader)) {
+		close(fd);
+		return -2;
+	}
+	void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return -2;
+
+	const TopoImageHeader *header = (const TopoImageHeader *)ptr;
+	if (header->magic != TOPO_IMAGE_MAGIC || header->version != TOPO_IMAGE_VERSION ||
+		header->total_size != (uint32_t)st.st_size ||
+		header->index_offset + (uint64_t)header->node_count * sizeof(TopoImageNodeIndex) > header->total_size) {
+		munmap(ptr, st.st_size);
+		return -2;
+	}
+	const TopoImageNodeIndex *index = (const TopoImageNodeIndex *)((const uint8_t *)ptr + header->index_offset);
+	for (int i = 0; i < header->node_count; i++) {
+		if (!topo_image_node_valid((const uint8_t *)ptr, st.st_size, &index[i])) {
+			munmap(ptr, st.st_size);
+			return -2;
+		}
+	}
+	image->base = (const uint8_t *)ptr;
+	image->size = st.st_size;
+	return 0;
+}
+
+/**
+ * @description: find the section of the node with the given mac address.
+ * @return {const TopoImageNode*} NULL if the node is not in the image.
+ */
+static inline const TopoImageNode *topo_image_find_node(const TopoImage *image, const uint8_t mac[6]) {
+	const TopoImageHeader *header = (const TopoImageHeader *)image->base;
+	const TopoImageNodeIndex *index = (const TopoImageNodeIndex *)(image->base + header->index_offset);
+	int lo = 0, hi = (int)header->node_count - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = memcmp(index[mid].mac, mac, 6);
+		if (cmp == 0) return (const TopoImageNode *)(image->base + index[mid].offset);
+		if (cmp < 0) lo = mid + 1;
+		else hi = mid - 1;
+	}
+	return NULL;
+}
+
+static inline const TopoImageSwitchRule *topo_image_switch_rules(const TopoImage *image, const TopoImageNode *node) {
+	return (const TopoImageSwitchRule *)(image->base + node->switch_rules_offset);
+}
+
+static inline const TopoImageGcl *topo_image_gcls(const TopoImage *image, const TopoImageNode *node) {
+	return (const TopoImageGcl *)(image->base + node->gcls_offset);
+}
+
+static inline const TopoImageStream *topo_image_input_streams(const TopoImage *image, const TopoImageNode *node) {
+	return (const TopoImageStream *)(image->base + node->streams_offset);
+}
+
+static inline const TopoImageStream *topo_image_output_streams(const TopoImage *image, const TopoImageNode *node) {
+	return (const TopoImageStream *)(image->base + node->streams_offset) + node->input_stream_count;
+}
+
+/*
+ * Destination mac r < TOPO_REPLICA_MACS of a node. Switches forward by destination mac, so every
+ * replica path gets its own address: r = 0 is the node's mac, the others flip the locally
+ * administered bit and carry r in the upper nibble of the first byte.
+ */
+static inline void topo_replica_mac(const uint8_t mac[6], int replica, uint8_t out[6]) {
+	memcpy(out, mac, 6);
+	if (replica > 0) out[0] ^= (uint8_t)(0x02 | (replica << 4));
+}
+
+static inline const TopoImageJob *topo_image_jobs(const TopoImage *image, const TopoImageNode *node) {
+	return (const TopoImageJob *)(image->base + node->jobs_offset);
+}
+
+static inline const TopoImagePoint *topo_image_points(const TopoImage *image, const TopoImageNode *node) {
+	return (const TopoImagePoint *)(image->base + node->points_offset);
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
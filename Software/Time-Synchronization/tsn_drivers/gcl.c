@@ -1,7 +1,18 @@
 #include "gcl.h"
 
+#include <inttypes.h>
+#include <string.h>
+
+#include "rtc.h"
+
+// start spinning on the RTC this long before a pending config change
+#define GCL_CONFIG_CHANGE_SPIN_NS 1000000
+
 void *base_ptr_gcl;
 
+/* admin/oper lists of each port, indexed by portNumber - 1. */
+static GCLPortConfig gcl_port_configs[N_PORTS];
+
 /* define gcl value list in each port. */
 int port_0_gcl[] = { 
 	PORT_0_GCL_0 ,
@@ -195,6 +206,27 @@ int gcl_init(void *ptr) {
 		*((unsigned *)(base_ptr_gcl + PORT_3_GCL_CTRL)) = GCL_SET_TIME_RST;
 	}
 
+	memset(gcl_port_configs, 0, sizeof(gcl_port_configs));
+	for (int i = 0; i < N_PORTS; i++) {
+		gcl_port_configs[i].oper.length = GCL_LIST_LEN;
+		for (int j = 0; j < GCL_LIST_LEN; j++) {
+			gcl_port_configs[i].oper.gate_states[j] = 2;
+			gcl_port_configs[i].oper.time_intervals[j] = 0x400;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @description: This function is used to init gcl base pointer only, keeping the lists running in hardware.
+ * Used by processes that update the schedule of a running switch.
+ * @param {void} *ptr uio base pointer.
+ * @return {*} 0 by default.
+ */
+int gcl_attach(void *ptr) {
+	base_ptr_gcl = ptr;
+	memset(gcl_port_configs, 0, sizeof(gcl_port_configs));
 	return 0;
 }
 
@@ -356,3 +388,277 @@ int set_gcl_time_interval(uint16_t portNumber, uint16_t gcl_id, uint16_t value)
 	*((unsigned *)(CTRL_ADDR)) = GCL_SET_TIME_RST;
 	return 0;
 }
+
+/**
+ * @description: This function is used to get the register addresses of port [portNumber].
+ * @param {uint16_t} portNumber port number, start from 1.
+ * @return {int} 0 on success, -1 on invalid port number.
+ */
+static int gcl_port_registers(uint16_t portNumber, UINTPTR *ctrl_addr, int **gcl_addr, int **time_addr)
+{
+	switch (portNumber)
+	{
+		case 1:
+			*ctrl_addr = (UINTPTR)(base_ptr_gcl + PORT_0_GCL_CTRL);
+			*gcl_addr  = port_0_gcl;
+			*time_addr = port_0_gcl_time;
+			return 0;
+		case 2:
+			*ctrl_addr = (UINTPTR)(base_ptr_gcl + PORT_1_GCL_CTRL);
+			*gcl_addr  = port_1_gcl;
+			*time_addr = port_1_gcl_time;
+			return 0;
+		case 3:
+			*ctrl_addr = (UINTPTR)(base_ptr_gcl + PORT_2_GCL_CTRL);
+			*gcl_addr  = port_2_gcl;
+			*time_addr = port_2_gcl_time;
+			return 0;
+		case 4:
+			*ctrl_addr = (UINTPTR)(base_ptr_gcl + PORT_3_GCL_CTRL);
+			*gcl_addr  = port_3_gcl;
+			*time_addr = port_3_gcl_time;
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+/**
+ * @description: This function is used to write a whole list into the hardware GCL of port [portNumber].
+ * Entries beyond list->length are filled with value 1 and time interval 0.
+ * No printing here, the writes have to fit into the first entry of the running cycle.
+ * @param {uint16_t} portNumber port number, start from 1.
+ * @param {GateControlList} *list the list to write.
+ * @return {*} 0 by default.
+ */
+static int gcl_write_list(uint16_t portNumber, const GateControlList *list)
+{
+	UINTPTR CTRL_ADDR;
+	int *GCL_DATA_ADDR, *GCL_TIME_ADDR;
+	if (gcl_port_registers(portNumber, &CTRL_ADDR, &GCL_DATA_ADDR, &GCL_TIME_ADDR) != 0) {
+		printf("write gcl list: Invalid portNumber.\r\n");
+		return 0;
+	}
+	for (int i = 0; i < GCL_LIST_LEN; i++) {
+		uint16_t value    = i < list->length ? list->gate_states[i] : 1;
+		uint16_t interval = i < list->length ? list->time_intervals[i] : 0;
+
+		*((unsigned *)(base_ptr_gcl + GCL_DATA_ADDR[i])) = (i << 9) + value;
+		*((unsigned *)(CTRL_ADDR)) = GCL_SET_CTRL_0;
+		*((unsigned *)(CTRL_ADDR)) = GCL_SET_RST;
+
+		*((unsigned *)(base_ptr_gcl + GCL_TIME_ADDR[i])) = (i << 20) + interval;
+		*((unsigned *)(CTRL_ADDR)) = GCL_SET_CTRL_0;
+		*((unsigned *)(CTRL_ADDR)) = GCL_SET_TIME_RST;
+	}
+	return 0;
+}
+
+/**
+ * @description: This function is used to read the list running in the hardware GCL of port [portNumber].
+ * Trailing entries with time interval 0 are not part of the list.
+ * @param {uint16_t} portNumber port number, start from 1.
+ * @param {GateControlList} *list output.
+ * @return {int} 0 on success, -1 on invalid port number.
+ */
+static int gcl_read_list(uint16_t portNumber, GateControlList *list)
+{
+	UINTPTR CTRL_ADDR;
+	int *GCL_DATA_ADDR, *GCL_TIME_ADDR;
+	if (gcl_port_registers(portNumber, &CTRL_ADDR, &GCL_DATA_ADDR, &GCL_TIME_ADDR) != 0) return -1;
+	list->length = 0;
+	for (int i = 0; i < GCL_LIST_LEN; i++) {
+		list->gate_states[i]    = *((unsigned *)(base_ptr_gcl + GCL_DATA_ADDR[i])) & 0x1FF;
+		list->time_intervals[i] = *((unsigned *)(base_ptr_gcl + GCL_TIME_ADDR[i])) & 0xFFFF;
+		if (list->time_intervals[i]) list->length = i + 1;
+	}
+	return 0;
+}
+
+/**
+ * @description: This function is used to get the cycle time of a list, i.e. the sum of its time intervals.
+ * @param {GateControlList} *list
+ * @return {uint64_t} cycle time in ns, GCL_CYCLE_TIME_NS for an empty list.
+ */
+static uint64_t gcl_list_cycle_time(const GateControlList *list)
+{
+	uint64_t cycle_time = 0;
+	for (int i = 0; i < list->length; i++) {
+		cycle_time += (uint64_t)list->time_intervals[i] << GCL_TIME_UNIT_SHIFT;
+	}
+	return cycle_time ? cycle_time : GCL_CYCLE_TIME_NS;
+}
+
+/**
+ * @description: This function is used to compute ConfigChangeTime (IEEE 802.1Q 2018, 8.6.9.1.1).
+ * The change happens at a cycle boundary of the running (oper) list, so the first entry of the
+ * new list starts where the old cycle ends: the first oper cycle boundary at or after both
+ * admin_base_time and current_time.
+ * @return {uint64_t} config change time in synchronized time (ns).
+ */
+static uint64_t gcl_config_change_time(const GCLPortConfig *config, uint64_t current_time)
+{
+	uint64_t t = config->admin_base_time > current_time ? config->admin_base_time : current_time;
+	if (t <= config->oper_base_time) return config->oper_base_time;
+	uint64_t n = (t - config->oper_base_time + config->oper_cycle_time - 1) / config->oper_cycle_time;
+	return config->oper_base_time + n * config->oper_cycle_time;
+}
+
+/**
+ * @description: This function is used to set the admin list of port [portNumber].
+ * The admin list becomes the oper list at the first cycle boundary at or after [admin_base_time],
+ * see gcl_config_change_poll(). With GCL_BASE_TIME_NOW the list is written at once, which is
+ * only safe while no TT traffic is running (e.g. during init).
+ * @param {uint16_t} portNumber port number, start from 1.
+ * @param {GateControlList} *list the new admin list.
+ * @param {uint64_t} admin_base_time AdminBaseTime in synchronized time (ns).
+ * @return {int} 0 on success, -1 on invalid arguments.
+ */
+int gcl_set_admin_list(uint16_t portNumber, const GateControlList *list, uint64_t admin_base_time)
+{
+	if (portNumber < 1 || portNumber > N_PORTS || list->length > GCL_LIST_LEN) {
+		printf("set gcl admin list: Invalid portNumber or list length.\r\n");
+		return -1;
+	}
+	GCLPortConfig *config = &gcl_port_configs[portNumber - 1];
+	config->admin = *list;
+	config->admin_base_time = admin_base_time;
+	config->cycle_time = gcl_list_cycle_time(list);
+
+	if (admin_base_time == GCL_BASE_TIME_NOW) {
+		gcl_write_list(portNumber, &config->admin);
+		config->oper = config->admin;
+		config->config_pending = 0;
+		return 0;
+	}
+
+	// the list that is running now decides where its cycles end
+	gcl_read_list(portNumber, &config->oper);
+	config->oper_cycle_time = gcl_list_cycle_time(&config->oper);
+
+	UScaledNs local_ts, sync_ts;
+	get_current_local_sync_ts(&local_ts, &sync_ts);
+	config->config_change_time = gcl_config_change_time(config, sync_ts.nsec);
+	config->config_pending = 1;
+	printf("Port[%d] GCL config change scheduled at %" PRIu64 " ns (now %" PRIu64 " ns).\r\n",
+		portNumber, config->config_change_time, sync_ts.nsec);
+	return 0;
+}
+
+/**
+ * @description: This function is used to install pending admin lists whose config change time has come.
+ * The list is written only while the first entry of the cycle that starts at config_change_time is
+ * running; if that window was missed, the change is moved to the next cycle boundary.
+ * It is cheap when nothing is pending, so it can be called from the time sync main loop.
+ * @return {int} number of ports that still have a pending config change.
+ */
+int gcl_config_change_poll(void)
+{
+	int pending = 0;
+	bool have_ts = 0;
+	UScaledNs local_ts, sync_ts;
+
+	for (uint16_t port = 1; port <= N_PORTS; port++) {
+		GCLPortConfig *config = &gcl_port_configs[port - 1];
+		if (!config->config_pending) continue;
+
+		if (!have_ts) {
+			get_current_local_sync_ts(&local_ts, &sync_ts);
+			have_ts = 1;
+		}
+		if (sync_ts.nsec < config->config_change_time) {
+			pending++;
+			continue;
+		}
+
+		const GateControlList *running = config->oper.length ? &config->oper : &config->admin;
+		uint64_t window = (uint64_t)running->time_intervals[0] << GCL_TIME_UNIT_SHIFT;
+		if (sync_ts.nsec - config->config_change_time >= window) {
+			config->config_change_time = gcl_config_change_time(config, sync_ts.nsec);
+			printf("Port[%d] GCL config change missed, moved to %" PRIu64 " ns.\r\n", port, config->config_change_time);
+			pending++;
+			continue;
+		}
+
+		gcl_write_list(port, &config->admin);
+		config->oper = config->admin;
+		config->oper_base_time = config->config_change_time;
+		config->oper_cycle_time = config->cycle_time;
+		config->config_pending = 0;
+		printf("Port[%d] GCL config change done at %" PRIu64 " ns.\r\n", port, sync_ts.nsec);
+	}
+	return pending;
+}
+
+/**
+ * @description: This function is used to get the first cycle boundary at or after [time] shared by the lists
+ * running on all ports, so that changes of several ports switch over together. The gate control module runs its
+ * cycles in phase with synchronized time, and the cycle of every list divides the schedule cycle.
+ * @param {uint64_t} time synchronized time (ns).
+ * @return {uint64_t} the boundary in synchronized time (ns).
+ */
+uint64_t gcl_common_cycle_boundary(uint64_t time)
+{
+	uint64_t cycle = 1;
+	for (uint16_t port = 1; port <= N_PORTS; port++) {
+		GateControlList running;
+		if (gcl_read_list(port, &running) != 0) continue;
+		uint64_t c = gcl_list_cycle_time(&running), a = cycle, b = c;
+		while (b) {
+			uint64_t t = a % b;
+			a = b;
+			b = t;
+		}
+		cycle = cycle / a * c;
+	}
+	return (time + cycle - 1) / cycle * cycle;
+}
+
+/**
+ * @description: This function is used to block until all pending config changes are installed.
+ * It sleeps until shortly before the next config change time and spins on the RTC for the rest.
+ * @return {void}
+ */
+void gcl_wait_config_change(void)
+{
+	UScaledNs local_ts, sync_ts;
+	while (gcl_config_change_poll() > 0) {
+		uint64_t next_change = UINT64_MAX;
+		for (int i = 0; i < N_PORTS; i++) {
+			if (gcl_port_configs[i].config_pending && gcl_port_configs[i].config_change_time < next_change) {
+				next_change = gcl_port_configs[i].config_change_time;
+			}
+		}
+		get_current_local_sync_ts(&local_ts, &sync_ts);
+		if (next_change > sync_ts.nsec + GCL_CONFIG_CHANGE_SPIN_NS) {
+			usleep((next_change - sync_ts.nsec - GCL_CONFIG_CHANGE_SPIN_NS) / 1000);
+		}
+	}
+}
+
+/**
+ * @description: This function is used to get the oper list of port [portNumber].
+ * @param {uint16_t} portNumber port number, start from 1.
+ * @param {GateControlList} *list output.
+ * @return {int} 0 on success, -1 on invalid port number.
+ */
+int gcl_get_oper_list(uint16_t portNumber, GateControlList *list)
+{
+	if (portNumber < 1 || portNumber > N_PORTS) return -1;
+	*list = gcl_port_configs[portNumber - 1].oper;
+	return 0;
+}
+
+/**
+ * @description: This function is used to get the admin list of port [portNumber] that waits for its config change time.
+ * @param {uint16_t} portNumber port number, start from 1.
+ * @param {GateControlList} *list output, only set if a config change is pending.
+ * @return {int} 1 if a config change is pending, 0 if not, -1 on invalid port number.
+ */
+int gcl_get_pending_admin_list(uint16_t portNumber, GateControlList *list)
+{
+	if (portNumber < 1 || portNumber > N_PORTS) return -1;
+	if (!gcl_port_configs[portNumber - 1].config_pending) return 0;
+	*list = gcl_port_configs[portNumber - 1].admin;
+	return 1;
+}
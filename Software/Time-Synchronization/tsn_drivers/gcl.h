@@ -169,12 +169,54 @@ extern "C"{
 #define GCL_SET_RST         0x02
 #define GCL_SET_TIME_RST    0x04
 
+// define GCL list constants
+#define GCL_LIST_LEN        16
+#define GCL_TIME_UNIT_SHIFT 11                  // GCL time interval unit is 2^11 ns
+#define GCL_CYCLE_TIME_NS   (2048ULL << 14)     // default cycle: 2048 slots of 2^14 ns
+#define GCL_BASE_TIME_NOW   0                   // install the admin list at once, without waiting for a cycle boundary
+
+/*
+ * A gate control list as programmed into one port:
+ * gate_states[i] is the 9-bit GCL value, time_intervals[i] its duration in 2^11 ns.
+ */
+typedef struct GateControlList {
+	uint16_t gate_states[GCL_LIST_LEN];
+	uint16_t time_intervals[GCL_LIST_LEN];
+	uint16_t length;
+} GateControlList;
+
+/*
+ * Per-port admin/oper state, following the 802.1Qbv (8.6.9) model:
+ * the admin list is installed as the oper list at config_change_time,
+ * the first cycle boundary of the oper list at or after admin_base_time.
+ * The gate control module runs its cycles in phase with synchronized time,
+ * so the oper cycles start at oper_base_time = 0 until the first switchover.
+ */
+typedef struct GCLPortConfig {
+	GateControlList admin;
+	GateControlList oper;         // as read back from the hardware when the admin list is set
+	uint64_t admin_base_time;     // synchronized time (ns)
+	uint64_t config_change_time;  // synchronized time (ns)
+	uint64_t cycle_time;          // cycle of the admin list, ns
+	uint64_t oper_base_time;      // start of an oper cycle, synchronized time (ns)
+	uint64_t oper_cycle_time;     // cycle of the oper list, ns
+	bool config_pending;
+} GCLPortConfig;
+
 extern void *base_ptr_gcl;
 int gcl_init(void *ptr);
+int gcl_attach(void *ptr);
 int get_gcl(uint16_t portNumber);
 int set_gcl(uint16_t portNumber, uint16_t gcl_id, uint16_t value);
 int get_gcl_time_interval(uint16_t portNumber);
 int set_gcl_time_interval(uint16_t portNumber, uint16_t gcl_id, uint16_t value);
+
+int gcl_set_admin_list(uint16_t portNumber, const GateControlList *list, uint64_t admin_base_time);
+int gcl_config_change_poll(void);
+uint64_t gcl_common_cycle_boundary(uint64_t time);
+void gcl_wait_config_change(void);
+int gcl_get_oper_list(uint16_t portNumber, GateControlList *list);
+int gcl_get_pending_admin_list(uint16_t portNumber, GateControlList *list);
 #ifdef __cplusplus
 }
 #endif
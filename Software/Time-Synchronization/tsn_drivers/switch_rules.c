@@ -9,13 +9,63 @@ In this revision we always keep the six default switch rules.
 #include "switch_rules.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #define N_DEFAULT_RULE 6
 #define SWITCH_TABLE_LEN 64
+#define N_RULE (SWITCH_TABLE_LEN / 2)
 
 int g_counter;
 void *g_base_ptr;
 
+/* software copy of the rule table, so rules can be updated in place without reading back registers. */
+typedef struct SwitchRuleShadow {
+    char mac_addr[6];
+    int output_port;
+    int valid;
+} SwitchRuleShadow;
+
+static SwitchRuleShadow g_rules[N_RULE];
+
+static int output_port_to_byte(int output_port, char *output_port_byte) {
+    switch (output_port) {
+        case 0: *output_port_byte = 0x01; return 0;
+        case 1: *output_port_byte = 0x04; return 0;
+        case 2: *output_port_byte = 0x10; return 0;
+        case 3: *output_port_byte = 0x40; return 0;
+        case 4: *output_port_byte = 0x08; return 0;
+        case 5: *output_port_byte = 0x20; return 0;
+        default: return 1;
+    }
+}
+
+/*
+    Write rule [index] with two word writes. The second register holds the output port,
+    it is written last when adding and first when removing, so a half written rule
+    never forwards to a port.
+*/
+static void write_switch_rule(int index, const char *mac_addr, char output_port_byte) {
+    volatile unsigned int *reg_ptr = (unsigned int *)g_base_ptr + index * 2;
+    unsigned int low = (unsigned char)mac_addr[2] | ((unsigned char)mac_addr[3] << 8) |
+                       ((unsigned char)mac_addr[4] << 16) | ((unsigned int)(unsigned char)mac_addr[5] << 24);
+    unsigned int high = (unsigned char)output_port_byte |
+                        ((unsigned char)mac_addr[0] << 16) | ((unsigned int)(unsigned char)mac_addr[1] << 24);
+    if (output_port_byte == 0) {
+        reg_ptr[1] = high;
+        reg_ptr[0] = low;
+    } else {
+        reg_ptr[0] = low;
+        reg_ptr[1] = high;
+    }
+}
+
+static int find_switch_rule(const char *mac_addr) {
+    for (int i = N_DEFAULT_RULE; i < g_counter / 2; i++) {
+        if (g_rules[i].valid && memcmp(g_rules[i].mac_addr, mac_addr, 6) == 0) return i;
+    }
+    return -1;
+}
+
 int switch_rule_init(void *ptr) {
     // Clear all existing switch rules except the default rules.
     // The switch rule for PTP frames are fixed in hardware, thus it will not be
@@ -26,6 +76,7 @@ int switch_rule_init(void *ptr) {
     for (int i = N_DEFAULT_RULE * 2; i < SWITCH_TABLE_LEN; i++) {
         *((unsigned *)(reg_base_ptr + i)) = 0;
     }
+    memset(g_rules, 0, sizeof(g_rules));
     return 0;
 }
 
@@ -41,6 +92,7 @@ int push_switch_rule(char *mac_addr, int output_port) {
                     5 -> to PS ETH
         The switch rule for PTP frames are fixed in hardware, no need to specify
        explicitly.
+        Return 0 on success, 1 on an unknown port or a full rule table.
     */
     char output_port_byte;
     if (output_port == 0) {
@@ -59,6 +111,10 @@ int push_switch_rule(char *mac_addr, int output_port) {
         printf("Unknown output_port.\r\n");
         return 1;
     }
+    if (g_counter >= SWITCH_TABLE_LEN) {
+        printf("Switch rule table is full.\r\n");
+        return 1;
+    }
     unsigned int *reg_base_ptr = g_base_ptr;
     unsigned int *reg_ptr = reg_base_ptr + g_counter;
     char *reg_byte_ptr = (char *)reg_ptr;
@@ -70,6 +126,59 @@ int push_switch_rule(char *mac_addr, int output_port) {
     *(reg_byte_ptr + 5) = 0x0;  // This byte is not used.
     *(reg_byte_ptr + 6) = mac_addr[0];
     *(reg_byte_ptr + 7) = mac_addr[1];
+    memcpy(g_rules[g_counter / 2].mac_addr, mac_addr, 6);
+    g_rules[g_counter / 2].output_port = output_port;
+    g_rules[g_counter / 2].valid = 1;
     g_counter = g_counter + 2;  // each rule takes two registers.
     return 0;
 }
+
+int update_switch_rule(char *mac_addr, int output_port) {
+    /*
+        Set the output port of mac_addr while the switch is forwarding.
+        An existing rule is rewritten in place, a new rule takes the first free
+        slot (left by remove_switch_rule) or is appended.
+        Return 0 if the table changed, -1 if it was already up to date, 1 on error.
+    */
+    char output_port_byte;
+    if (output_port_to_byte(output_port, &output_port_byte) != 0) {
+        printf("Unknown output_port.\r\n");
+        return 1;
+    }
+    int index = find_switch_rule(mac_addr);
+    if (index >= 0 && g_rules[index].output_port == output_port) return -1;
+    if (index < 0) {
+        for (int i = N_DEFAULT_RULE; i < g_counter / 2; i++) {
+            if (!g_rules[i].valid) {
+                index = i;
+                break;
+            }
+        }
+    }
+    if (index < 0) {
+        if (g_counter >= SWITCH_TABLE_LEN) {
+            printf("Switch rule table is full.\r\n");
+            return 1;
+        }
+        index = g_counter / 2;
+        g_counter = g_counter + 2;
+    }
+    write_switch_rule(index, mac_addr, output_port_byte);
+    memcpy(g_rules[index].mac_addr, mac_addr, 6);
+    g_rules[index].output_port = output_port;
+    g_rules[index].valid = 1;
+    return 0;
+}
+
+int remove_switch_rule(char *mac_addr) {
+    /*
+        Clear the rule of mac_addr, its slot is reused by update_switch_rule.
+        Return 0 if the rule was removed, -1 if there was no such rule.
+    */
+    static const char zero_mac[6] = {0};
+    int index = find_switch_rule(mac_addr);
+    if (index < 0) return -1;
+    write_switch_rule(index, zero_mac, 0);
+    g_rules[index].valid = 0;
+    return 0;
+}
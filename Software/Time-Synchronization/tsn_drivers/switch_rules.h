@@ -6,6 +6,8 @@ extern "C"{
 #endif
 int switch_rule_init(void *ptr); 
 int push_switch_rule(char *mac_addr, int output_port); 
+int update_switch_rule(char *mac_addr, int output_port);
+int remove_switch_rule(char *mac_addr);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,31 @@
+/*
+ * @Description: Scheduling class, priority and CPU affinity of the runtime
+ * threads, by thread role, read from a policy file shared by time_sync and the
+ * OpenPLC runtime. Every thread applies the policy of its role itself when it
+ * starts, which also pre-faults its stack and checks that the kernel gave it
+ * what the policy asks for.
+ */
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define THREAD_POLICY_FILE      "threads.conf"
+#define THREAD_POLICY_MAX_ROLES 32
+#define THREAD_ROLE_NAME_SIZE   16      // thread names are limited to 15 characters
+
+// reads the policy file, returns the number of roles or -1 if it is missing or invalid
+int thread_policy_load(const char *path);
+
+// applies the policy of role to the calling thread, returns the number of violations
+int thread_policy_apply(const char *role);
+
+// one line per role: policy, threads applied, last thread and violations
+int thread_policy_format(char *buf, int size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,563 @@
+// Offline TSN scheduler: config.json (nodes, links, fwd and jobs) -> schedule.json.
+// Usage: ./tsn_scheduler [-w window] [-d hop_delay] [config.json] [schedule.json]
+//
+// Every job runs on the PLC of a switch ("node") once per "period" for "compute_time"
+// slots. Its input flows go from their "src" node to the job's node and must have
+// arrived when the job starts, its output flows leave the job's node for their "dst"
+// node once the job ends. Flows follow the forwarding table of config.json.
+// All times are in schedule slots of 2^14 ns, periods have to divide the 2048 slot cycle.
+//
+// Heuristic: jobs are placed one after the other, shortest period first. For each job
+// the earliest free compute slot is taken whose inputs fit as late as possible before it
+// and whose outputs fit as early as possible after it; every hop of a flow gets a TT window
+// on its link, hop_delay slots after the previous one. Windows never overlap on a link, delay
+// is traded against GCL entries (windows next to existing ones are cheaper), and the TT runs
+// of a switch port always have to fit into its 16 GCL entries. The result is checked with
+// compile_gcl().
+//
+// A flow with "replicas": n is sent n times (802.1CB-style). Each further copy takes a path
+// disjoint from the other copies, addressed to topo_replica_mac(dst, r) with an r whose routes
+// to dst agree with it; it is scheduled like a flow of its own and its windows carry "replica": r.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "gcl_compiler.h"
+#include "json.hpp"
+#include "topo_image.h"
+
+using json = nlohmann::json;
+
+static const int CYCLE_SLOTS = 2048;
+static const double SLOT_US = 16.384;
+// preamble + SFD + inter frame gap
+static const int FRAME_OVERHEAD_BYTES = 20;
+
+struct Link {
+    int id;
+    int src;
+    int src_port;
+    int dst;
+    int speed_mbps;
+    bool gated;                 // output port of a switch, its windows have to fit into the GCL
+};
+
+struct Flow {
+    int job_id;
+    int flow_id;
+    int src;
+    int dst;
+    int pkt_size;               // -1 if not given
+    json payload;               // "payload" points, passed through to schedule.json, null if not given
+    int replica;                // destination mac index (topo_replica_mac()), 0 for the flow's own path
+    bool input;                 // input of its job, otherwise output
+    std::vector<int> path;      // link indices
+    int window;                 // TT window of each hop
+    int hop_delay;              // window start of hop h + 1 - window start of hop h
+    int start;                  // window start of the first hop, relative to the job's cycle
+};
+
+struct Job {
+    int id;
+    int node;
+    int period;
+    int compute_time;
+    std::string input_policy;   // "input_policy", passed through to schedule.json, empty if not given
+    std::vector<int> flows;     // flow indices
+    int start;
+};
+
+// busy slots of a link or a PLC over the whole cycle
+struct Timeline {
+    std::vector<uint8_t> busy = std::vector<uint8_t>(CYCLE_SLOTS, 0);
+
+    static int wrap(int t) { return ((t % CYCLE_SLOTS) + CYCLE_SLOTS) % CYCLE_SLOTS; }
+
+    // [start, start + length) repeated every period
+    bool free(int start, int length, int period) const {
+        for (int rep = 0; rep < CYCLE_SLOTS; rep += period) {
+            for (int i = 0; i < length; ++i) {
+                if (busy[wrap(start + rep + i)]) return false;
+            }
+        }
+        return true;
+    }
+
+    void mark(int start, int length, int period, uint8_t value) {
+        for (int rep = 0; rep < CYCLE_SLOTS; rep += period) {
+            for (int i = 0; i < length; ++i) busy[wrap(start + rep + i)] = value;
+        }
+    }
+
+    int used() const { return (int)std::count(busy.begin(), busy.end(), 1); }
+
+    // busy runs in [0, span), counted around the end; compile_gcl() needs at most 2 * runs + 1
+    // entries for them when the list is folded to span (a TT and a best-effort entry per run)
+    int runs(int span) const {
+        int n = 0;
+        for (int t = 0; t < span; ++t) {
+            if (busy[t] && !busy[(t + span - 1) % span]) n++;
+        }
+        return n;
+    }
+
+    // change of runs(span) if the free slots [start, start + length) repeated every period were marked
+    int runs_added(int start, int length, int period, int span) const {
+        int added = 0;
+        for (int rep = 0; rep < span; rep += period) {
+            added += 1 - busy[wrap(start + rep - 1)] - busy[wrap(start + rep + length)];
+        }
+        return added;
+    }
+};
+
+static int gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static json load_json(const std::string &path) {
+    json j;
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "[ERROR] Could not open " << path << std::endl;
+        exit(1);
+    }
+    file >> j;
+    return j;
+}
+
+// route of a flow: follow the forwarding table, fall back to breadth first search over the links
+static bool find_path(const json &topo, const std::vector<Link> &links, int src, int dst, std::vector<int> &path) {
+    path.clear();
+    std::map<std::pair<int, int>, int> fwd;  // (node, dst) -> output port
+    for (const auto &rule : topo["fwd"]) {
+        fwd[{rule["src"].get<int>(), rule["dst"].get<int>()}] = rule["src_port"].get<int>();
+    }
+
+    int cur = src;
+    while (cur != dst && (int)path.size() <= (int)links.size()) {
+        auto it = fwd.find({cur, dst});
+        if (it == fwd.end()) break;
+        int next = -1;
+        for (int i = 0; i < (int)links.size(); ++i) {
+            if (links[i].src == cur && links[i].src_port == it->second) {
+                next = i;
+                break;
+            }
+        }
+        if (next < 0) break;
+        path.push_back(next);
+        cur = links[next].dst;
+    }
+    if (cur == dst) return true;
+
+    std::map<int, int> prev_link;  // node -> link that reached it
+    std::vector<int> queue = {src};
+    prev_link[src] = -1;
+    for (size_t q = 0; q < queue.size(); ++q) {
+        for (int i = 0; i < (int)links.size(); ++i) {
+            if (links[i].src != queue[q] || prev_link.count(links[i].dst)) continue;
+            prev_link[links[i].dst] = i;
+            queue.push_back(links[i].dst);
+        }
+    }
+    if (!prev_link.count(dst)) return false;
+    path.clear();
+    for (int node = dst; prev_link[node] >= 0; node = links[prev_link[node]].src) path.push_back(prev_link[node]);
+    std::reverse(path.begin(), path.end());
+    return true;
+}
+
+// route of replica r of a flow: no link of the other replicas (in used) except the only link out of
+// src or into dst, and the same next link as earlier flows at every node, since switches forward
+// replica r to dst by a single mac. Breadth first, the routes are recorded in replica_fwd.
+static bool find_replica_path(const std::vector<Link> &links, int src, int dst, int replica, const std::set<int> &used,
+                              std::map<std::tuple<int, int, int>, int> &replica_fwd, std::vector<int> &path) {
+    int src_links = 0, dst_links = 0;
+    for (const auto &link : links) {
+        if (link.src == link.dst) continue;  // local port
+        src_links += link.src == src;
+        dst_links += link.dst == dst;
+    }
+
+    std::map<int, int> prev_link;  // node -> link that reached it
+    std::vector<int> queue = {src};
+    prev_link[src] = -1;
+    for (size_t q = 0; q < queue.size() && !prev_link.count(dst); ++q) {
+        const int node = queue[q];
+        auto fixed = replica_fwd.find(std::make_tuple(node, dst, replica));
+        for (int i = 0; i < (int)links.size(); ++i) {
+            if (links[i].src != node || prev_link.count(links[i].dst)) continue;
+            if (fixed != replica_fwd.end() && fixed->second != i) continue;
+            if (used.count(i) && !(node == src && src_links == 1) && !(links[i].dst == dst && dst_links == 1)) continue;
+            prev_link[links[i].dst] = i;
+            queue.push_back(links[i].dst);
+        }
+    }
+    if (!prev_link.count(dst)) return false;
+    path.clear();
+    for (int node = dst; prev_link[node] >= 0; node = links[prev_link[node]].src) path.push_back(prev_link[node]);
+    std::reverse(path.begin(), path.end());
+
+    // a replica that only shares links with the others adds nothing
+    if (std::all_of(path.begin(), path.end(), [&](int l) { return used.count(l) > 0; })) return false;
+    for (int l : path) replica_fwd[std::make_tuple(links[l].src, dst, replica)] = l;
+    return true;
+}
+
+static void mark_flow(const Flow &flow, std::vector<Timeline> &link_busy, int start, int period, uint8_t value) {
+    for (int h = 0; h < (int)flow.path.size(); ++h) {
+        link_busy[flow.path[h]].mark(start + h * flow.hop_delay, flow.window, period, value);
+    }
+}
+
+// from the first hop's window start to the end of the last hop's window
+static int flow_latency(const Flow &flow) {
+    return ((int)flow.path.size() - 1) * flow.hop_delay + flow.window;
+}
+
+// place a flow of a job whose compute window is set: inputs as late as possible before it,
+// outputs as early as possible after it. Every slot of delay is weighed against the GCL entries
+// the windows add on switch ports, and the GCL of every port has to keep fitting.
+static bool place_flow(Flow &flow, const Job &job, const std::vector<Link> &links,
+                       std::vector<Timeline> &link_busy, const std::vector<int> &link_span) {
+    const int P = job.period;
+    const int hops = (int)flow.path.size();
+    std::vector<int> runs(hops, 0);
+    for (int h = 0; h < hops; ++h) {
+        if (links[flow.path[h]].gated) runs[h] = link_busy[flow.path[h]].runs(link_span[flow.path[h]]);
+    }
+
+    // one more GCL entry is worth this many slots of latency
+    const int entry_cost = std::max(1, P / GCL_LIST_LEN);
+    int best_start = 0, best_cost = INT_MAX;
+    for (int k = 0; k < P && k < best_cost; ++k) {
+        const int start = flow.input ? job.start - flow_latency(flow) - k : job.start + job.compute_time + k;
+        bool fits = true;
+        int added = 0;
+        for (int h = 0; h < hops && fits; ++h) {
+            const int l = flow.path[h];
+            const int hop_start = start + h * flow.hop_delay;
+            if (!link_busy[l].free(hop_start, flow.window, P)) {
+                fits = false;
+            } else if (links[l].gated) {
+                const int a = link_busy[l].runs_added(hop_start, flow.window, P, link_span[l]);
+                fits = 2 * (runs[h] + a) + 1 <= GCL_LIST_LEN;
+                added += std::max(a, 0);
+            }
+        }
+        if (fits && k + entry_cost * added < best_cost) {
+            best_cost = k + entry_cost * added;
+            best_start = start;
+        }
+    }
+    if (best_cost == INT_MAX) return false;
+
+    flow.start = best_start;
+    mark_flow(flow, link_busy, best_start, P, 1);
+    return true;
+}
+
+static bool place_job(Job &job, std::vector<Flow> &flows, const std::vector<Link> &links, std::vector<Timeline> &link_busy,
+                      const std::vector<int> &link_span, Timeline &plc_busy) {
+    const int P = job.period, C = job.compute_time;
+    std::vector<int> order = job.flows;
+    // longest flows first, they are the hardest to fit
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return flows[a].path.size() > flows[b].path.size(); });
+
+    // earliest free compute slot; every offset in the period is tried for the flows,
+    // so a later compute slot would only shift the same search
+    for (int S = 0; S + C <= P; ++S) {
+        if (!plc_busy.free(S, C, P)) continue;
+        job.start = S;
+        for (int f : order) {
+            if (!place_flow(flows[f], job, links, link_busy, link_span)) return false;
+        }
+        plc_busy.mark(S, C, P, 1);
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    int opt_window = 0, opt_hop_delay = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "hw:d:")) != -1) {
+        switch (opt) {
+            case 'w':
+                opt_window = atoi(optarg);
+                break;
+            case 'd':
+                opt_hop_delay = atoi(optarg);
+                break;
+            default:
+                std::cout << "Usage: ./tsn_scheduler [-w window] [-d hop_delay] [config.json] [schedule.json]" << std::endl;
+                std::cout << "-w: TT window of every hop in slots, default: transmission time of the frame" << std::endl;
+                std::cout << "-d: delay between the windows of two hops in slots, default: transmission time of the frame" << std::endl;
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    const std::string config_path = optind < argc ? argv[optind] : "config.json";
+    const std::string schedule_path = optind + 1 < argc ? argv[optind + 1] : "schedule.json";
+
+    const auto begin = std::chrono::steady_clock::now();
+    const json topo = load_json(config_path);
+    if (topo.find("jobs") == topo.end()) {
+        std::cout << "[ERROR] " << config_path << " has no \"jobs\", see docs/software-build.md" << std::endl;
+        return 1;
+    }
+
+    std::map<int, const json *> nodes;
+    for (const auto &node : topo["nodes"]) nodes[node["id"].get<int>()] = &node;
+
+    std::vector<Link> links;
+    for (const auto &item : topo["links"]) {
+        Link link;
+        link.id = item["id"].get<int>();
+        link.src = item["src"].get<int>();
+        link.src_port = item["src_port"].get<int>();
+        link.dst = item["dst"].get<int>();
+        link.speed_mbps = item.find("link_speed") != item.end() ? item["link_speed"].get<int>() : 1000;
+        link.gated = nodes.count(link.src) && (*nodes[link.src])["type"].get<std::string>() == "switch";
+        links.push_back(link);
+    }
+
+    std::vector<Job> jobs;
+    std::vector<Flow> flows;
+    std::map<std::tuple<int, int, int>, int> replica_fwd;  // (node, dst, replica) -> link
+    for (const auto &item : topo["jobs"]) {
+        Job job;
+        job.id = item["id"].get<int>();
+        job.node = item["node"].get<int>();
+        job.period = item["period"].get<int>();
+        job.compute_time = item["compute_time"].get<int>();
+        job.input_policy = item.find("input_policy") != item.end() ? item["input_policy"].get<std::string>() : "";
+        job.start = -1;
+        if (job.period <= 0 || CYCLE_SLOTS % job.period != 0 || job.compute_time <= 0 || job.compute_time > job.period) {
+            std::cout << "[ERROR] job " << job.id << ": period has to divide " << CYCLE_SLOTS
+                      << " and compute_time has to fit into it" << std::endl;
+            return 1;
+        }
+        if (!job.input_policy.empty() && job.input_policy != "hold" && job.input_policy != "default" &&
+            job.input_policy != "skip") {
+            std::cout << "[ERROR] job " << job.id << ": input_policy has to be \"hold\", \"default\" or \"skip\""
+                      << std::endl;
+            return 1;
+        }
+        if (!nodes.count(job.node) || (*nodes[job.node])["type"].get<std::string>() != "switch") {
+            std::cout << "[ERROR] job " << job.id << ": node " << job.node << " is not a switch" << std::endl;
+            return 1;
+        }
+
+        for (const char *direction : {"inputs", "outputs"}) {
+            if (item.find(direction) == item.end()) continue;
+            for (const auto &f : item[direction]) {
+                Flow flow;
+                flow.job_id = job.id;
+                flow.flow_id = f["flow_id"].get<int>();
+                flow.input = std::string(direction) == "inputs";
+                flow.src = flow.input ? f["src"].get<int>() : job.node;
+                flow.dst = flow.input ? job.node : f["dst"].get<int>();
+                flow.pkt_size = f.find("pkt_size") != f.end() ? f["pkt_size"].get<int>() : -1;
+                if (f.find("payload") != f.end()) flow.payload = f["payload"];
+                flow.replica = 0;
+                flow.start = 0;
+                const int replicas = f.find("replicas") != f.end() ? f["replicas"].get<int>() : 1;
+                if (replicas < 1 || replicas > TOPO_MAX_REPLICAS) {
+                    std::cout << "[ERROR] flow " << flow.flow_id << " of job " << job.id << ": replicas has to be 1 to "
+                              << TOPO_MAX_REPLICAS << std::endl;
+                    return 1;
+                }
+                if (flow.src == flow.dst || !find_path(topo, links, flow.src, flow.dst, flow.path)) {
+                    std::cout << "[ERROR] flow " << flow.flow_id << " of job " << job.id << ": no route from node "
+                              << flow.src << " to node " << flow.dst << std::endl;
+                    return 1;
+                }
+
+                int speed = 1000;
+                for (int l : flow.path) speed = std::min(speed, links[l].speed_mbps);
+                const long long bits = (long long)((flow.pkt_size > 0 ? flow.pkt_size : 1500) + FRAME_OVERHEAD_BYTES) * 8;
+                const long long ns = (bits * 1000 + speed - 1) / speed;
+                const int tx_slots = std::max(1, (int)((ns + (1 << 14) - 1) >> 14));
+                flow.window = opt_window > 0 ? opt_window : tx_slots;
+                flow.hop_delay = opt_hop_delay > 0 ? opt_hop_delay : tx_slots;
+
+                job.flows.push_back((int)flows.size());
+                flows.push_back(flow);
+
+                std::set<int> used(flow.path.begin(), flow.path.end());
+                for (int copy = 1, r = 1; copy < replicas; ++copy, ++r) {
+                    Flow replica = flow;
+                    while (r < TOPO_REPLICA_MACS && !find_replica_path(links, flow.src, flow.dst, r, used, replica_fwd, replica.path)) r++;
+                    if (r == TOPO_REPLICA_MACS) {
+                        std::cout << "[ERROR] flow " << flow.flow_id << " of job " << job.id << ": no path for replica " << copy
+                                  << " from node " << flow.src << " to node " << flow.dst
+                                  << " disjoint from the other replicas" << std::endl;
+                        return 1;
+                    }
+                    replica.replica = r;
+                    used.insert(replica.path.begin(), replica.path.end());
+                    job.flows.push_back((int)flows.size());
+                    flows.push_back(replica);
+                }
+            }
+        }
+        jobs.push_back(job);
+    }
+
+    // rate monotonic: shortest period first, then the job with the most hops
+    std::vector<int> order;
+    for (int i = 0; i < (int)jobs.size(); ++i) order.push_back(i);
+    auto hops = [&](const Job &job) {
+        int n = 0;
+        for (int f : job.flows) n += (int)flows[f].path.size();
+        return n;
+    };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        if (jobs[a].period != jobs[b].period) return jobs[a].period < jobs[b].period;
+        return hops(jobs[a]) > hops(jobs[b]);
+    });
+
+    // lcm of the periods on each link: its GCL is folded to it, so runs repeat with it
+    std::vector<int> link_span(links.size(), 1);
+    for (const auto &job : jobs) {
+        for (int f : job.flows) {
+            for (int l : flows[f].path) link_span[l] = link_span[l] / gcd(link_span[l], job.period) * job.period;
+        }
+    }
+
+    std::vector<Timeline> link_busy(links.size());
+    std::map<int, Timeline> plc_busy;
+    for (int j : order) {
+        if (!place_job(jobs[j], flows, links, link_busy, link_span, plc_busy[jobs[j].node])) {
+            std::cout << "[ERROR] Could not schedule job " << jobs[j].id << " on node " << jobs[j].node
+                      << ": no free compute slot with conflict-free windows for its flows" << std::endl;
+            return 1;
+        }
+    }
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    // schedule.json, same layout as the files in config/
+    nlohmann::ordered_json sche = nlohmann::ordered_json::array();
+    for (const auto &node : topo["nodes"]) {
+        if (node["type"].get<std::string>() != "switch") continue;
+        const int id = node["id"].get<int>();
+        bool forwards = false;
+        for (const auto &flow : flows) {
+            for (int l : flow.path) forwards |= links[l].src == id;
+        }
+        nlohmann::ordered_json item;
+        item["type"] = "switch";
+        item["id"] = id;
+        item["mac"] = node["mac"];
+        item["schedule"] = nlohmann::ordered_json::array();
+        for (const auto &job : jobs) {
+            if (job.node != id) continue;
+            nlohmann::ordered_json entry = {{"period", job.period},
+                                            {"start", job.start},
+                                            {"end", job.start + job.compute_time},
+                                            {"job_id", job.id}};
+            if (!job.input_policy.empty()) entry["input_policy"] = job.input_policy;
+            item["schedule"].push_back(entry);
+        }
+        // switches without jobs are listed when they forward TT flows, so that they get a GCL
+        if (!item["schedule"].empty() || forwards) sche.push_back(item);
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "link utilization:" << std::endl;
+    double max_util = 0;
+    for (int l = 0; l < (int)links.size(); ++l) {
+        nlohmann::ordered_json item;
+        item["type"] = "link";
+        item["from"] = links[l].src;
+        item["to"] = links[l].dst;
+        item["from_port"] = links[l].src_port;
+        item["id"] = links[l].id;
+        item["schedule"] = nlohmann::ordered_json::array();
+
+        std::vector<GclFlowWindow> windows;
+        for (const auto &flow : flows) {
+            const int P = jobs[std::find_if(jobs.begin(), jobs.end(), [&](const Job &job) { return job.id == flow.job_id; }) - jobs.begin()].period;
+            for (int h = 0; h < (int)flow.path.size(); ++h) {
+                if (flow.path[h] != l) continue;
+                const int start = ((flow.start + h * flow.hop_delay) % P + P) % P;
+                nlohmann::ordered_json window = {{"period", P},
+                                                 {"start", start},
+                                                 {"end", start + flow.window},
+                                                 {"job_id", flow.job_id},
+                                                 {"flow_id", flow.flow_id}};
+                if (flow.pkt_size > 0) window["pkt_size"] = flow.pkt_size;
+                if (!flow.payload.is_null()) window["payload"] = flow.payload;
+                if (flow.replica > 0) window["replica"] = flow.replica;
+                item["schedule"].push_back(window);
+                windows.push_back({P, start, start + flow.window});
+            }
+        }
+        if (item["schedule"].empty()) continue;
+        sche.push_back(item);
+
+        const double util = 100.0 * link_busy[l].used() / CYCLE_SLOTS;
+        max_util = std::max(max_util, util);
+        std::cout << "  link " << links[l].src << " -> " << links[l].dst << " (port " << links[l].src_port
+                  << "): " << util << "%";
+        if (links[l].gated) {
+            GclCompileResult gcl;
+            const bool fits = compile_gcl(windows, GclCompilerOptions(), &gcl);
+            std::cout << ", GCL " << gcl.entries_needed << "/" << GCL_LIST_LEN << " entries";
+            if (!fits) std::cout << std::endl << "  [WARNING] GCL does not fit: " << gcl.report;
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << "jobs:" << std::endl;
+    for (const auto &job : jobs) {
+        // end-to-end bound: first input window start to last output window end
+        int first = job.start, last = job.start + job.compute_time;
+        for (int f : job.flows) {
+            if (flows[f].input) first = std::min(first, flows[f].start);
+            else last = std::max(last, flows[f].start + flow_latency(flows[f]));
+        }
+        std::cout << "  job " << job.id << " on node " << job.node << ": period " << job.period << ", compute ["
+                  << job.start << ", " << job.start + job.compute_time << "), PLC "
+                  << 100.0 * plc_busy[job.node].used() / CYCLE_SLOTS << "%, end-to-end " << last - first
+                  << " slots (" << (last - first) * SLOT_US << " us)" << std::endl;
+        for (int f : job.flows) {
+            const Flow &flow = flows[f];
+            const int wait = flow.input ? job.start - flow.start - flow_latency(flow)
+                                        : flow.start - job.start - job.compute_time;
+            std::cout << "    " << (flow.input ? "input " : "output") << " flow " << flow.flow_id << " ";
+            if (flow.replica > 0) std::cout << "replica " << flow.replica << " ";
+            std::cout << flow.src << " -> " << flow.dst << ": " << flow.path.size() << " hops, latency "
+                      << flow_latency(flow) << " slots (" << flow_latency(flow) * SLOT_US << " us), waits "
+                      << wait << " slots" << std::endl;
+        }
+    }
+    std::cout << jobs.size() << " jobs, " << flows.size() << " flows scheduled in " << std::setprecision(2)
+              << elapsed_ms << " ms, max link utilization " << std::setprecision(1) << max_util << "%" << std::endl;
+
+    std::ofstream file(schedule_path);
+    if (!file) {
+        std::cout << "[ERROR] Could not write " << schedule_path << std::endl;
+        return 1;
+    }
+    file << sche.dump(4) << std::endl;
+    std::cout << "[INFO] wrote " << schedule_path << std::endl;
+    return 0;
+}